@@ -1,18 +1,35 @@
 CC	= gcc
-CFLAGS	= -Wall --std=c99 -g
+CFLAGS	= -Wall --std=c99 -g -pthread
 CPPFLAGS= -D_DEFAULT_SOURCE
-LDFLAGS	= -lpcap
+LDFLAGS	= -lpcap -pthread
 
 NAME    = protodump
 
 OBJS    = $(PARTS:%=src/%.o)
 PARTS   = \
+          adapt \
           arg \
           capture \
+          capwriter \
           ccan/json/json \
           ccan/tap/tap \
           common \
+          decode \
+          defrag \
+          filter \
+          hist \
           netutil \
+          options \
+          output \
+          pcapfile \
+          pcapng \
+          reorder \
+          replay \
+          ring \
+          sink \
+          stats \
+          tpacket \
+          uring \
 
 DEBUG	= 1
 ifdef DEBUG
@@ -0,0 +1,85 @@
+/*
+ * adapt.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "adapt.h"
+
+void adapt_init(struct adapt *a, int buffer_size, int timeout, int max_buffer,
+                long long now) {
+  a->buffer_size = buffer_size;
+  a->timeout = timeout;
+  a->max_buffer = max_buffer > buffer_size ? max_buffer : buffer_size;
+  a->base_timeout = timeout;
+  a->next_ns = now + ADAPT_PERIOD_NS;
+  a->last_drop = 0;
+  a->pkts = 0;
+  a->reads = 0;
+  a->calm = 0;
+}
+
+bool adapt_update(struct adapt *a, unsigned drops, int batch, long long now) {
+  unsigned dropped = drops - a->last_drop;
+  bool changed = false;
+  bool short_reads = a->pkts < a->reads * batch / 4;
+
+  a->last_drop = drops;
+  a->next_ns = now + ADAPT_PERIOD_NS;
+
+  if(dropped) {
+    a->calm = 0;
+    if(a->buffer_size < a->max_buffer) {
+      a->buffer_size = a->buffer_size > a->max_buffer / 2 ? a->max_buffer
+                                                          : 2 * a->buffer_size;
+      changed = true;
+    } else if(a->timeout > 1) {
+      a->timeout /= 2;
+      changed = true;
+    }
+
+    if(changed)
+      plog(1, "%u drops: going to a %d byte buffer and %d ms timeout",
+           dropped, a->buffer_size, a->timeout);
+  } else if(++a->calm >= ADAPT_CALM_PERIODS && short_reads
+            && a->timeout < a->base_timeout) {
+    a->calm = 0;
+    a->timeout = 2 * a->timeout < a->base_timeout ? 2 * a->timeout
+                                                  : a->base_timeout;
+    changed = true;
+    plog(1, "No drops lately: going back to a %d ms timeout", a->timeout);
+  }
+
+  a->pkts = a->reads = 0;
+  return changed;
+}
+
+void adapt_reopened(struct adapt *a) {
+  a->last_drop = 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * adapt.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_ADAPT_H
+#define PROTODUMP_ADAPT_H
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "options.h"
+
+/* How often the controller looks at the counters, in ns */
+#define ADAPT_PERIOD_NS 1000000000LL
+
+/* Drop-free periods after which the timeout may creep back up */
+#define ADAPT_CALM_PERIODS 10
+
+/* A controller for one capture handle's buffer size and read timeout. The
+ * user's settings are only a starting point: whenever the kernel drops
+ * packets, the buffer is doubled, up to a memory limit. Once the buffer can't
+ * grow any more, the timeout is halved instead, so that partly filled blocks
+ * are handed over, and freed, sooner. After a while without drops, if reads
+ * come back mostly short of a full batch, the timeout is raised back toward
+ * where it started. The buffer never shrinks, since giving memory back would
+ * mean another reopen for little gain.
+ *
+ * buffer_size:  Buffer size the handle should have, in bytes
+ * timeout:      Read timeout the handle should have, in ms
+ * max_buffer:   Largest buffer the controller may ask for
+ * base_timeout: The timeout we started out with, and won't go above
+ * next_ns:      When the controller should look at the counters next
+ * last_drop:    Drop count of the handle as of the last look
+ * pkts:         Packets read during the current period
+ * reads:        Reads during the current period
+ * calm:         Periods in a row without drops
+ */
+struct adapt {
+  int buffer_size;
+  int timeout;
+  int max_buffer;
+  int base_timeout;
+  long long next_ns;
+  unsigned last_drop;
+  unsigned long pkts;
+  unsigned long reads;
+  int calm;
+};
+
+/* Start a controller at the given settings.
+ *
+ * a:           Controller to initialize
+ * buffer_size: Buffer size the handle is opened with
+ * timeout:     Read timeout the handle is opened with
+ * max_buffer:  Largest buffer size to go up to
+ * now:         Current time in ns
+ */
+void adapt_init(struct adapt *a, int buffer_size, int timeout, int max_buffer,
+                long long now);
+
+/* Note that a read returned n packets. */
+static inline void adapt_read(struct adapt *a, int n) {
+  a->pkts += n;
+  ++a->reads;
+}
+
+/* Return true if it is time to call adapt_update(). */
+static inline bool adapt_due(const struct adapt *a, long long now) {
+  return now >= a->next_ns;
+}
+
+/* Look at the handle's drop count and the reads since the last call, and
+ * decide on new settings. Return true if buffer_size or timeout changed, in
+ * which case the handle should be reopened with them and adapt_reopened()
+ * called.
+ *
+ * a:     The controller
+ * drops: Total number of packets the handle has dropped
+ * batch: Number of packets a full read returns
+ * now:   Current time in ns
+ */
+bool adapt_update(struct adapt *a, unsigned drops, int batch, long long now);
+
+/* Note that the handle was replaced by one with fresh counters. */
+void adapt_reopened(struct adapt *a);
+
+#endif
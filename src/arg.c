@@ -39,6 +39,7 @@ const char *argtype_names[] = {
   "POSITIVE_INTEGER",
   "IPv4_ADDRESS",
   "IPv6_ADDRESS",
+  "SECONDS[.FRACTION]",
 };
 
 /* Regexes for argument matching */
@@ -52,6 +53,7 @@ const char *argtype_names[] = {
 #define IPV6_OCTET "([0-9a-fA-F]{,4})" /* FIXME: This is wrong. */
 #define IPV6_CIDR  "(/(0?[0-9]?[0-9]|1[0-1][0-9]|12[0-8]))"
 #define IPV6_ADDR  "(" "(" IPV6_OCTET ":){,7}" IPV6_OCTET "(" IPV6_CIDR ")?" ")" /* FIXME: Totally wrong. */
+#define TIME_SECS  "^[0-9]+(\\.[0-9]{1,9})?$"
 
 #define ADD_TO_BUF(_buf, _c, _i, _len) do{_buf[(_i < _len) ? (_i++) : (_len - 1)] = _c;}while(0)
 char *make_optstr(struct flag *flaglist, int nflags) {
@@ -62,6 +64,8 @@ char *make_optstr(struct flag *flaglist, int nflags) {
     ADD_TO_BUF(optstr, flaglist[i].name, c, BUFSIZ);
     if(flaglist[i].arg != ARG_NONE)
       ADD_TO_BUF(optstr, ':', c, BUFSIZ);
+    if(flaglist[i].optional_arg)
+      ADD_TO_BUF(optstr, ':', c, BUFSIZ);
   }
   ADD_TO_BUF(optstr, '\0', c, BUFSIZ);
 
@@ -80,6 +84,9 @@ static bool reg_matches(const char *regex, const char *s) {
 }
 
 static bool arg_is_valid(struct flag *pflag, char *arg) {
+  if(!arg && pflag->optional_arg)
+    return true;
+
   switch(pflag->arg) {
     case ARG_NONE:
       return arg == NULL;
@@ -93,6 +100,8 @@ static bool arg_is_valid(struct flag *pflag, char *arg) {
       return reg_matches(IPV4_ADDR, arg);
     case ARG_IPV6:
       return reg_matches(IPV6_ADDR, arg);
+    case ARG_TIME:
+      return reg_matches(TIME_SECS, arg);
   }
 
   return false;
@@ -170,7 +179,11 @@ void print_flag_usage(FILE *fp, struct flag *flaglist, int nflags) {
   modes[j] = opts[k] = opts_wargs[l] = NULL;
 
   for(i = 0, k = 0; modes[i]; ++i, k = 0) {
-    snprintf(prefix, 256, "%-7s%s -%c", usage, NAME, modes[i]->name);
+    if(modes[i]->optional_arg)
+      snprintf(prefix, 256, "%-7s%s -%c[<%s>]", usage, NAME, modes[i]->name,
+                                                argtype_names[modes[i]->arg]);
+    else
+      snprintf(prefix, 256, "%-7s%s -%c", usage, NAME, modes[i]->name);
     usage[0] = '\0';
 
     for(j = 0; opts_wargs[j]; ++j)
@@ -204,3 +217,17 @@ void print_flag_usage(FILE *fp, struct flag *flaglist, int nflags) {
   for(i = 0; opts[i]; ++i)
     fprintf(fp, "\t-%c\t%s\n", opts[i]->name, opts[i]->description);
 }
+
+/* Convert an ARG_TIME argument, which has already been checked against
+ * TIME_SECS, to nanoseconds since the epoch. */
+long long time_arg_to_ns(const char *arg) {
+  char *frac;
+  long long ns = strtoll(arg, &frac, 10) * 1000000000LL;
+  long long scale = 100000000LL;
+
+  if(*frac == '.')
+    for(++frac; *frac; ++frac, scale /= 10)
+      ns += (*frac - '0') * scale;
+
+  return ns;
+}
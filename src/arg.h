@@ -50,12 +50,14 @@ enum argtype {
   ARG_POSINTEGER,
   ARG_IPV4,
   ARG_IPV6,
+  ARG_TIME,
 };
 
 struct flag {
   char name;
   const char *description;
   enum argtype arg;
+  bool optional_arg;
   bool mode;
   const char *mode_blacklist;
   int action;
@@ -65,5 +67,6 @@ char *make_optstr(struct flag *flaglist, int nflags);
 int getflag(int argc, char **argv, struct flag *flaglist, int nflags,
             const char *optstr, char **parg);
 void print_flag_usage(FILE *fp, struct flag *flaglist, int nflags);
+long long time_arg_to_ns(const char *arg);
 
 #endif
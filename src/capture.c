@@ -243,9 +243,8 @@ void dev_info(const char *regex) {
   pcap_freealldevs(devs);
 }
 
-static char *match_dev_regex_or_die(const char *regstr) {
-  static char dev[1024];
-  int matches = 0, devlen = 0;
+int match_devs_regex_or_die(const char *regstr, char ***devs) {
+  int matches = 0;
   char errbuf[PCAP_ERRBUF_SIZE];
   pcap_if_t *interfaces, *cur;
   int err;
@@ -254,23 +253,50 @@ static char *match_dev_regex_or_die(const char *regstr) {
   if(err)
     die(0, "pcap_findalldevs(): %s", errbuf);
 
+  *devs = NULL;
   for(cur = interfaces; cur; cur = cur->next)
-    if(regex_matches_or_is_null(regstr, cur->name))
-      devlen = snprintf(&dev[devlen], sizeof(dev) - devlen
-                        , "%s%s"
-                        , matches++ ? ", " : ""
-                        , cur->name);
+    if(regex_matches_or_is_null(regstr, cur->name)) {
+      *devs = realloc_or_die(*devs, (matches + 1) * sizeof **devs);
+      (*devs)[matches] = malloc_or_die(strlen(cur->name) + 1);
+      strcpy((*devs)[matches++], cur->name);
+    }
 
   if(!matches)
     die(0, "No device matching regex: %s", regstr);
-  else if(matches > 1)
-    die(0, "Ambiguous device regex: %s\nDid you mean one of these: %s", regstr, dev);
 
   pcap_freealldevs(interfaces);
+  return matches;
+}
+
+void free_devs(char **devs, int ndevs) {
+  int i;
+
+  for(i = 0; i < ndevs; ++i)
+    free(devs[i]);
+  free(devs);
+}
+
+char *match_dev_regex_or_die(const char *regstr) {
+  static char dev[1024];
+  int i, matches, devlen = 0;
+  char **devs;
+
+  matches = match_devs_regex_or_die(regstr, &devs);
+  for(i = 0; i < matches; ++i)
+    devlen += snprintf(&dev[devlen], sizeof(dev) - devlen
+                       , "%s%s"
+                       , i ? ", " : ""
+                       , devs[i]);
+
+  if(matches > 1)
+    die(0, "Ambiguous device regex: %s\nDid you mean one of these: %s\n"
+           "Use -g to capture on all of them", regstr, dev);
+
+  free_devs(devs, matches);
   return dev;
 }
 
-static void prep_pcap_handle(pcap_t *handle) {
+static void prep_pcap_handle(pcap_t *handle, int buffer_size, int timeout) {
   int err;
 
   err = pcap_set_rfmon(handle, options.rfmon);
@@ -285,12 +311,18 @@ static void prep_pcap_handle(pcap_t *handle) {
   if(err)
     die(0, "DEBUG: pcap handle should not be activated at %s:%d", __FILE__, __LINE__);
 
-  err = pcap_set_timeout(handle, options.read_timeout);
+  err = pcap_set_timeout(handle, timeout);
   if(err)
     die(0, "DEBUG: pcap handle should not be activated at %s:%d", __FILE__, __LINE__);
 
-  if(options.buffer_size > 0) {
-    err = pcap_set_buffer_size(handle, options.buffer_size);
+  if(options.tune & TUNE_LATENCY) {
+    err = pcap_set_immediate_mode(handle, 1);
+    if(err)
+      die(0, "DEBUG: pcap handle should not be activated at %s:%d", __FILE__, __LINE__);
+  }
+
+  if(buffer_size > 0) {
+    err = pcap_set_buffer_size(handle, buffer_size);
     if(err)
       die(0, "DEBUG: pcap handle should not be activated at %s:%d", __FILE__, __LINE__);
   }
@@ -320,16 +352,360 @@ static void prep_pcap_handle(pcap_t *handle) {
   }
 }
 
-int capture_live(const char *filter) {
+#define WORKER_RING_SIZE 8192
+#define FILE_CHUNK_SIZE  (4 << 20)
+
+/* libpcap's own default buffer size, where adaptive tuning starts from */
+#define PCAP_DEFAULT_BUFFER (2 << 20)
+
+/* With TUNE_LATENCY, capture threads spin this long for new packets before
+ * going to sleep, and ask the kernel to busy-poll the device for this many
+ * microseconds on each read */
+#define LATENCY_SPIN_NS      200000LL
+#define LATENCY_BUSY_POLL_US 50
+
+/* Adaptive tuning won't grow all workers' buffers past this share of RAM,
+ * nor any single buffer past ADAPT_MAX_BUFFER */
+#define ADAPT_RAM_SHARE  8
+#define ADAPT_MAX_BUFFER (1 << 30)
+
+/* State for a single worker. Each worker has its own capture handle and its
+ * own writer buffers, and runs the whole pipeline for the share of the
+ * traffic the kernel hands it. The pipeline is split over two threads: the
+ * capture thread only pulls packets out of the kernel and queues them on the
+ * ring, and the encoder thread turns them into JSON records. That way a slow
+ * writer never holds up the capture loop.
+ *
+ * ring:          Packets on their way from the capture to the encoder thread
+ * pool:          Buffers holding the packets' data. Filled by the capture
+ *                thread and given back by whichever stage is done last.
+ * thread:        The capture thread
+ * encoder:       The encoder thread
+ * dev:           Device to capture on, if capturing live
+ * file:          Mapped pcap file to read from, if not capturing live. The
+ *                packet data is passed along in place, not through the pool.
+ * handle:        The worker's pcap handle, if it uses the pcap backend. This
+ *                is closed by the main thread, after the worker has been
+ *                joined.
+ * out:           Writer for the worker's records, sharing the main writer's
+ *                stream
+ * iface:         Index of the worker's device in the pcap writer, if -w
+ * decoder:       Decoder for the link type of the worker's packets, picked
+ *                once its handle is open
+ * defrag:        Reassembler for the IP fragments among the worker's
+ *                packets, used by whichever thread encodes them if
+ *                defragging
+ * count:         Number of packets the worker captured
+ * filter_gen:    Generation of the filter attached to the worker's handle
+ * kstats:        Kernel counters for the worker's handle, as last sampled
+ * kstats_base:   Final kernel counters of handles the worker has replaced
+ * stats_gen:     Generation of the stats request kstats answers
+ * encoded:       Number of the worker's packets encoded so far
+ * json_bytes:    Bytes of JSON the worker's packets came to so far
+ * hists:         Stage latencies and batch sizes, if the pipeline is timed.
+ *                Each histogram is recorded by the thread running its stage.
+ * adapt:         Buffer size and timeout for the worker's handle, tuned as
+ *                the capture goes if options.tune has TUNE_ADAPTIVE
+ * capture_done:  Set by the capture thread once it won't queue any more
+ */
+struct worker {
+  struct ring ring;
+  struct pool pool;
+  pthread_t thread;
+  pthread_t encoder;
+  const char *dev;
+  struct pcapfile *file;
+  pcap_t *handle;
+  struct jsonw out;
+  int iface;
+  struct decoder decoder;
+  struct defrag defrag;
+  int count;
+  unsigned filter_gen;
+  struct pcap_stat kstats;
+  struct pcap_stat kstats_base;
+  unsigned stats_gen;
+  unsigned long long encoded;
+  unsigned long long json_bytes;
+  struct hist hists[STATS_NHISTS];
+  struct adapt adapt;
+  bool capture_done;
+};
+
+static struct worker *workers;
+static int nworkers;
+static struct filter capfilter;
+
+/* Bumped by the stats thread to ask capture threads for fresh kernel
+ * counters. Capture threads are the only ones that touch their handles, so
+ * they do the sampling and then acknowledge by copying the generation. */
+static unsigned stats_gen;
+
+/* True if the stages of the pipeline are being timed for the stats file */
+static bool timed;
+
+/* Where records go: a pcap writer if -w was given, and JSON unless only -w
+ * was given */
+static struct capwriter capw;
+static bool to_pcap, to_json;
+
+/* True if IP fragments are put back together before being written out, which
+ * is worth it only if some JSON field looks past the IP header */
+static bool defragging;
+
+/* Filter for packets read from a file, which is never swapped */
+static const struct bpf_program *file_prog;
+volatile sig_atomic_t stop_requested;
+
+/* Number of stop handlers currently looking at the workers' handles. A
+ * worker replacing its handle waits for this to drop to zero before closing
+ * the old one. */
+static int stop_handlers;
+
+static void stop_capture(int sig) {
+  int i;
+  pcap_t *handle;
+
+  stop_requested = 1;
+  __atomic_add_fetch(&stop_handlers, 1, __ATOMIC_SEQ_CST);
+  for(i = 0; i < nworkers; ++i) {
+    handle = __atomic_load_n(&workers[i].handle, __ATOMIC_SEQ_CST);
+    if(handle)
+      pcap_breakloop(handle);
+  }
+  __atomic_sub_fetch(&stop_handlers, 1, __ATOMIC_SEQ_CST);
+}
+
+void catch_stop_signals(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = stop_capture;
+  sigemptyset(&sa.sa_mask);
+
+  if(sigaction(SIGINT, &sa, NULL) || sigaction(SIGTERM, &sa, NULL))
+    die(errno, "sigaction()");
+}
+
+static long long pkt_ts_ns(const struct pcap_pkthdr *hdr) {
+  return hdr->ts.tv_sec * 1000000000LL
+       + hdr->ts.tv_usec * (options.tstamp_nano ? 1LL : 1000LL);
+}
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned fanout_group(void) {
+  return getpid() & 0xffff;
+}
+
+/* Queue a packet for the encoder thread. This is the only copy the packet
+ * data goes through; later stages pass the pooled buffer along. If the pool
+ * or the ring is full, wait for the encoder to catch up rather than lose the
+ * packet; the kernel's buffer keeps absorbing traffic in the meantime. */
+static void handle_packet(u_char *user, const struct pcap_pkthdr *hdr,
+                          const u_char *bytes) {
+  struct worker *w = (struct worker*)user;
+  struct pktdesc d;
+  long long lat;
+
+  if(timed) {
+    d.queued_ns = now_ns();
+    lat = d.queued_ns - pkt_ts_ns(hdr);
+    hist_record(&w->hists[STATS_CAPTURE_NS], lat > 0 ? lat : 0);
+  }
+
+  while(!(d.data = pool_get(&w->pool)))
+    sched_yield();
+
+  d.hdr = *hdr;
+  if(d.hdr.caplen > w->pool.slot_size)
+    d.hdr.caplen = w->pool.slot_size;
+  memcpy(d.data, bytes, d.hdr.caplen);
+
+  while(!ring_push(&w->ring, &d))
+    sched_yield();
+}
+
+/* Queue a packet whose data stays valid for the whole capture, such as one in
+ * a mapped file, without copying it. */
+static void handle_mapped_packet(struct worker *w,
+                                 const struct pcap_pkthdr *hdr,
+                                 const u_char *bytes) {
+  struct pktdesc d;
+
+  d.hdr = *hdr;
+  d.data = (u_char*)bytes;
+  if(timed)
+    d.queued_ns = now_ns();
+
+  while(!ring_push(&w->ring, &d))
+    sched_yield();
+}
+
+/* Wait a little when there is no work, spinning briefly first so that a busy
+ * pipeline doesn't pay for a sleep on every empty poll. */
+static void idle_wait(unsigned *idle) {
+  static const struct timespec nap = { .tv_sec = 0, .tv_nsec = 100000 };
+
+  /* When latency matters, a nap costs more than the CPU we'd save */
+  if(++*idle < 64 || options.tune & TUNE_LATENCY)
+    sched_yield();
+  else
+    nanosleep(&nap, NULL);
+}
+
+/* Encode a packet from w's ring into out and/or the pcap writer, keeping w's
+ * counters.
+ *
+ * w:   Worker the packet came from
+ * out: JSON writer to append the record to
+ * dev: Device to name in the record, or NULL
+ * d:   The packet
+ */
+static void encode_packet(struct worker *w, struct jsonw *out, const char *dev,
+                          const struct pktdesc *d) {
+  struct decode_summary sum;
+  size_t len = out->len;
+  long long start = 0, decode_start = 0, decode_ns = 0;
+
+  if(timed) {
+    start = now_ns();
+    hist_record(&w->hists[STATS_QUEUE_NS], start - d->queued_ns);
+  }
+
+  if(to_pcap)
+    capwriter_packet(&capw, w->iface, &d->hdr, d->data);
+  if(to_json) {
+    if(timed)
+      decode_start = now_ns();
+    decode_packet(&w->decoder, d->data, d->hdr.caplen, &sum);
+    if(defragging && sum.layers & DECODE_FRAG)
+      defrag_packet(&w->defrag, d->data, d->hdr.caplen,
+                    w->file ? pcapfile_ts_ns(w->file, &d->hdr)
+                            : pkt_ts_ns(&d->hdr), &sum);
+    if(timed) {
+      decode_ns = now_ns() - decode_start;
+      hist_record(&w->hists[STATS_DECODE_NS], decode_ns);
+    }
+    jsonw_packet_dev(out, dev, &d->hdr, d->data, &sum);
+  }
+
+  /* Decoding has a histogram of its own */
+  if(timed)
+    hist_record(&w->hists[STATS_ENCODE_NS], now_ns() - start - decode_ns);
+  __atomic_store_n(&w->encoded, w->encoded + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->json_bytes, w->json_bytes + out->len - len,
+                   __ATOMIC_RELAXED);
+}
+
+/* Write out the records buffered in out, timing the write into w's
+ * histograms.
+ *
+ * w:       Worker to keep the timings in
+ * out:     Writer to flush
+ * flushed: Number of records out had written by the last flush
+ */
+static void write_batch(struct worker *w, struct jsonw *out,
+                        unsigned long *flushed) {
+  long long start;
+
+  if(!out->len)
+    return;
+
+  if(!timed) {
+    jsonw_flush(out);
+    return;
+  }
+
+  start = now_ns();
+  jsonw_flush(out);
+  hist_record(&w->hists[STATS_WRITE_NS], now_ns() - start);
+  hist_record(&w->hists[STATS_WRITE_BATCH], out->records - *flushed);
+  *flushed = out->records;
+}
+
+static void *run_encoder(void *arg) {
+  struct worker *w = arg;
+  struct pktdesc d;
+  unsigned idle = 0;
+  unsigned long flushed = 0;
+
+  for(;;) {
+    if(ring_pop(&w->ring, &d)) {
+      encode_packet(w, &w->out, NULL, &d);
+      if(!w->file)
+        pool_put(&w->pool, d.data);
+      idle = 0;
+      continue;
+    }
+
+    /* The ring has been drained, so this is the end of a batch */
+    write_batch(w, &w->out, &flushed);
+
+    if(__atomic_load_n(&w->capture_done, __ATOMIC_ACQUIRE)) {
+      if(!ring_count(&w->ring))
+        break;
+    } else {
+      idle_wait(&idle);
+    }
+  }
+
+  return NULL;
+}
+
+/* Sample the kernel counters of the worker's pcap handle if the stats thread
+ * has asked for them since the last time, or unconditionally if force is
+ * set. */
+static void sample_pcap_stats(struct worker *w, bool force) {
+  unsigned gen = __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE);
+  struct pcap_stat ps;
+
+  if(gen == w->stats_gen && !force)
+    return;
+
+  if(!pcap_stats(w->handle, &ps)) {
+    w->kstats.ps_recv = w->kstats_base.ps_recv + ps.ps_recv;
+    w->kstats.ps_drop = w->kstats_base.ps_drop + ps.ps_drop;
+    w->kstats.ps_ifdrop = w->kstats_base.ps_ifdrop + ps.ps_ifdrop;
+  }
+  __atomic_store_n(&w->stats_gen, gen, __ATOMIC_RELEASE);
+}
+
+/* Same as sample_pcap_stats(), for a tpacket ring */
+static void sample_tpacket_stats(struct worker *w, struct tpacket *tp,
+                                 bool force) {
+  unsigned gen = __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE);
+  struct pcap_stat ps;
+
+  if(gen == w->stats_gen && !force)
+    return;
+
+  tpacket_stats(tp, &ps);
+  w->kstats.ps_recv = w->kstats_base.ps_recv + ps.ps_recv;
+  w->kstats.ps_drop = w->kstats_base.ps_drop + ps.ps_drop;
+  __atomic_store_n(&w->stats_gen, gen, __ATOMIC_RELEASE);
+}
+
+/* Create and activate a pcap handle.
+ *
+ * dev:         Device to capture on
+ * buffer_size: Buffer size in bytes, or 0 for libpcap's default
+ * timeout:     Read timeout in ms
+ */
+static pcap_t *open_pcap(const char *dev, int buffer_size, int timeout) {
   int err;
   char errbuf[PCAP_ERRBUF_SIZE];
   pcap_t *handle;
-  char *dev = options.dev ? match_dev_regex_or_die(options.dev) : "all";
-
-  plog(1, "Capturing on device: %s", dev);
 
   handle = pcap_create(dev, errbuf);
-  prep_pcap_handle(handle);
+  if(!handle)
+    die(0, "pcap_create(): %s", errbuf);
+  prep_pcap_handle(handle, buffer_size, timeout);
 
   err = pcap_activate(handle);
   if(err == PCAP_WARNING)
@@ -339,15 +715,941 @@ int capture_live(const char *filter) {
   else if(err)
     die(0, "pcap_activate(): %s", pcap_geterr(handle));
 
-  pcap_close(handle);
-  return 0;
+  /* Reads never block, so that capture threads can spin before sleeping */
+  if(options.tune & TUNE_LATENCY) {
+    if(pcap_setnonblock(handle, 1, errbuf))
+      die(0, "pcap_setnonblock(): %s", errbuf);
+    if(!tpacket_busy_poll(pcap_get_selectable_fd(handle), LATENCY_BUSY_POLL_US))
+      plog(1, "Can't busy-poll %s: %s", dev, strerror(errno));
+  }
+
+  return handle;
+}
+
+/* Wait for a nonblocking handle to have packets: spin for a little while,
+ * since the next packet is often right behind, then sleep in poll() for up
+ * to a read timeout. spin_until is when the current spell of spinning
+ * should end, or 0 if we aren't spinning. */
+static void wait_for_packets(pcap_t *handle, int timeout,
+                             long long *spin_until) {
+  struct pollfd pfd = { .fd = pcap_get_selectable_fd(handle), .events = POLLIN };
+  long long now = now_ns();
+
+  if(!*spin_until) {
+    *spin_until = now + LATENCY_SPIN_NS;
+    return;
+  }
+  if(now < *spin_until)
+    return;
+
+  *spin_until = 0;
+  if(poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+    die(errno, "poll()");
+}
+
+/* Largest buffer adaptive tuning may give a single worker */
+static int adapt_max_buffer(void) {
+  long long ram = (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  long long share = ram / ADAPT_RAM_SHARE / options.workers;
+
+  return share < ADAPT_MAX_BUFFER ? share : ADAPT_MAX_BUFFER;
+}
+
+/* Read whatever an old socket still holds after it has been replaced, until
+ * a read comes back empty. Give up after its read timeout in case it keeps
+ * getting new packets; whatever is left is lost when it is closed. The caller
+ * should close it straight after, since any packet arriving in between is
+ * lost too.
+ *
+ * w:        Worker to queue the packets on
+ * handle:   The old pcap handle, or NULL
+ * tp:       The old tpacket ring, if handle is NULL
+ * timeout:  The old socket's read timeout
+ */
+static void drain_old(struct worker *w, pcap_t *handle, struct tpacket *tp,
+                      int timeout) {
+  long long until = now_ns() + timeout * 1000000LL;
+  int n;
+
+  do {
+    if(handle)
+      n = pcap_dispatch(handle, options.batch, handle_packet, (u_char*)w);
+    else
+      n = tpacket_dispatch(tp, handle_packet, (u_char*)w);
+    if(n > 0)
+      w->count += n;
+  } while(n > 0 && now_ns() < until);
+}
+
+/* Replace the worker's pcap handle with one using the settings the adaptive
+ * controller asked for, then drain and close the old one. Packets can be
+ * missed while this happens:
+ *
+ * - Without fanout, both sockets would see every packet, so the old one gets
+ *   a drop-everything filter before the new one is opened. Packets arriving
+ *   while pcap_activate() sets up the new one are lost.
+ * - In a fanout group, each packet only goes to one socket, and the old one
+ *   stays in the group until it is closed. Packets hashed to it after
+ *   drain_old() gives up or finds it empty are lost. Until the new socket
+ *   joins the group, it sees packets the old one may see as well.
+ */
+static void reopen_pcap(struct worker *w, int old_timeout) {
+  pcap_t *old = w->handle;
+  pcap_t *handle;
+  unsigned gen = 0;
+  struct pcap_stat ps;
+
+  if(options.workers == 1)
+    tpacket_drop_all(pcap_get_selectable_fd(old));
+  handle = open_pcap(w->dev, w->adapt.buffer_size, w->adapt.timeout);
+  filter_attach_pcap(&capfilter, handle, &gen);
+  if(options.workers > 1)
+    tpacket_join_fanout(pcap_get_selectable_fd(handle), fanout_group());
+
+  __atomic_store_n(&w->handle, handle, __ATOMIC_SEQ_CST);
+  w->filter_gen = gen;
+
+  /* A stop handler may still be about to break the old handle's loop */
+  while(__atomic_load_n(&stop_handlers, __ATOMIC_SEQ_CST))
+    sched_yield();
+
+  drain_old(w, old, NULL, old_timeout);
+  if(!pcap_stats(old, &ps)) {
+    w->kstats_base.ps_recv += ps.ps_recv;
+    w->kstats_base.ps_drop += ps.ps_drop;
+    w->kstats_base.ps_ifdrop += ps.ps_ifdrop;
+  }
+  pcap_close(old);
+
+  adapt_reopened(&w->adapt);
+}
+
+/* Set up a freshly opened ring for low latency if asked to */
+static void tune_tpacket(struct tpacket *tp) {
+  if(!(options.tune & TUNE_LATENCY))
+    return;
+
+  tp->spin_ns = LATENCY_SPIN_NS;
+  if(!tpacket_busy_poll(tp->fd, LATENCY_BUSY_POLL_US))
+    plog(1, "Can't busy-poll: %s", strerror(errno));
+}
+
+/* Same as reopen_pcap(), for a tpacket ring. Since the new ring is set up
+ * before it is bound, the old socket only stops taking packets right before
+ * the new one starts, so without fanout little more than a system call's
+ * worth of packets can be lost. */
+static void reopen_tpacket(struct worker *w, struct tpacket *tp,
+                           int old_timeout) {
+  struct tpacket old = *tp;
+  unsigned gen = 0;
+  struct pcap_stat ps;
+
+  tpacket_open(tp, w->dev, w->adapt.buffer_size, w->adapt.timeout);
+  filter_attach_tpacket(&capfilter, tp, &gen);
+  if(options.workers == 1)
+    tpacket_drop_all(old.fd);
+  tpacket_bind(tp, w->dev);
+  w->adapt.buffer_size = tp->maplen;
+  tune_tpacket(tp);
+  if(options.workers > 1)
+    tpacket_join_fanout(tp->fd, fanout_group());
+  w->filter_gen = gen;
+
+  drain_old(w, NULL, &old, old_timeout);
+  tpacket_stats(&old, &ps);
+  w->kstats_base.ps_recv += ps.ps_recv;
+  w->kstats_base.ps_drop += ps.ps_drop;
+  tpacket_close(&old);
+
+  adapt_reopened(&w->adapt);
+}
+
+static void capture_pcap(struct worker *w) {
+  int n, timeout;
+  long long now, spin_until = 0;
+  struct pcap_stat ps;
+  pcap_t *handle;
+
+  w->handle = open_pcap(w->dev, w->adapt.buffer_size, w->adapt.timeout);
+  handle = w->handle;
+  if(options.workers > 1)
+    tpacket_join_fanout(pcap_get_selectable_fd(handle), fanout_group());
+  decode_select(&w->decoder, pcap_datalink(handle));
+  if(to_pcap)
+    w->iface = capwriter_add_interface(&capw, w->dev, w->decoder.linktype);
+
+  /* Each pcap_dispatch() call hands us up to one batch worth of packets, which
+   * are buffered by the writer and flushed together once the call returns. */
+  while(!stop_requested) {
+    filter_attach_pcap(&capfilter, handle, &w->filter_gen);
+    sample_pcap_stats(w, false);
+    n = pcap_dispatch(handle, options.batch, handle_packet, (u_char*)w);
+    if(n == PCAP_ERROR_BREAK)
+      break;
+    else if(n < 0)
+      die(0, "pcap_dispatch(): %s", pcap_geterr(handle));
+
+    if(timed && n)
+      hist_record(&w->hists[STATS_CAPTURE_BATCH], n);
+    w->count += n;
+
+    if(options.tune & TUNE_LATENCY) {
+      if(n)
+        spin_until = 0;
+      else
+        wait_for_packets(handle, w->adapt.timeout, &spin_until);
+    }
+
+    if(options.tune & TUNE_ADAPTIVE) {
+      adapt_read(&w->adapt, n);
+      now = now_ns();
+      timeout = w->adapt.timeout;
+      if(adapt_due(&w->adapt, now) && !pcap_stats(handle, &ps)
+         && adapt_update(&w->adapt, ps.ps_drop, options.batch, now)) {
+        reopen_pcap(w, timeout);
+        handle = w->handle;
+      }
+    }
+  }
+
+  sample_pcap_stats(w, true);
+}
+
+static void capture_tpacket(struct worker *w) {
+  int n, timeout;
+  long long now;
+  struct pcap_stat ps;
+  struct tpacket tp;
+
+  tpacket_open(&tp, w->dev, w->adapt.buffer_size, w->adapt.timeout);
+  /* Only let matching packets into the ring, right from the start */
+  filter_attach_tpacket(&capfilter, &tp, &w->filter_gen);
+  tpacket_bind(&tp, w->dev);
+  /* The ring is rounded up to whole blocks, so start from its real size */
+  w->adapt.buffer_size = tp.maplen;
+  tune_tpacket(&tp);
+  if(options.workers > 1)
+    tpacket_join_fanout(tp.fd, fanout_group());
+  decode_select(&w->decoder, tp.linktype);
+  if(to_pcap)
+    w->iface = capwriter_add_interface(&capw, w->dev, tp.linktype);
+
+  /* Here a batch is whatever the kernel managed to put in one block. */
+  while(!stop_requested) {
+    filter_attach_tpacket(&capfilter, &tp, &w->filter_gen);
+    sample_tpacket_stats(w, &tp, false);
+    n = tpacket_dispatch(&tp, handle_packet, (u_char*)w);
+    if(n < 0)
+      continue;
+
+    if(timed && n)
+      hist_record(&w->hists[STATS_CAPTURE_BATCH], n);
+    w->count += n;
+
+    if(options.tune & TUNE_ADAPTIVE) {
+      adapt_read(&w->adapt, n);
+      now = now_ns();
+      timeout = w->adapt.timeout;
+      if(adapt_due(&w->adapt, now)) {
+        tpacket_stats(&tp, &ps);
+        if(adapt_update(&w->adapt, ps.ps_drop, options.batch, now))
+          reopen_tpacket(w, &tp, timeout);
+      }
+    }
+  }
+
+  sample_tpacket_stats(w, &tp, true);
+
+  tpacket_close(&tp);
+}
+
+static bool in_time_bounds(const struct pcapfile *pf,
+                           const struct pcap_pkthdr *hdr) {
+  long long ts = pcapfile_ts_ns(pf, hdr);
+
+  return ts >= options.time_start && ts <= options.time_end;
+}
+
+static bool passes_file_filter(const struct pcap_pkthdr *hdr,
+                               const u_char *bytes) {
+  return !file_prog || pcap_offline_filter(file_prog, hdr, bytes);
+}
+
+static void capture_file(struct worker *w) {
+  struct pcap_pkthdr hdr;
+  const u_char *bytes;
+
+  while(!stop_requested && pcapfile_next(w->file, &hdr, &bytes)) {
+    if(!in_time_bounds(w->file, &hdr)) {
+      /* If the records are in time order, we're done once we're past the
+       * end */
+      if(w->file->ordered && pcapfile_ts_ns(w->file, &hdr) > options.time_end)
+        break;
+      continue;
+    }
+    if(!passes_file_filter(&hdr, bytes))
+      continue;
+
+    handle_mapped_packet(w, &hdr, bytes);
+    ++w->count;
+  }
+}
+
+/* Set up the worker's buffer size and timeout controller */
+static void start_adapt(struct worker *w) {
+  int size = options.buffer_size, timeout = options.read_timeout;
+
+  if(options.tune & TUNE_ADAPTIVE && size <= 0)
+    size = options.backend == BACKEND_TPACKET ? TPACKET_DEFAULT_RING
+                                              : PCAP_DEFAULT_BUFFER;
+
+  /* TPACKET_V3 only hands over blocks when they fill up or time out, and
+   * can't time out any sooner than this */
+  if(options.tune & TUNE_LATENCY && options.backend == BACKEND_TPACKET)
+    timeout = 1;
+
+  adapt_init(&w->adapt, size, timeout, adapt_max_buffer(), now_ns());
+}
+
+static void *run_worker(void *arg) {
+  struct worker *w = arg;
+
+  if(!w->file)
+    start_adapt(w);
+
+  if(w->file)
+    capture_file(w);
+  else switch(options.backend) {
+    case BACKEND_TPACKET:
+      capture_tpacket(w);
+      break;
+    default:
+      capture_pcap(w);
+  }
+
+  __atomic_store_n(&w->capture_done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Print how quickly packets made it from the kernel to the capture threads
+ * and on to the encoders, over every worker. */
+static void report_latency(void) {
+  struct hist wake, queue;
+  int i;
+
+  hist_init(&wake);
+  hist_init(&queue);
+  for(i = 0; i < nworkers; ++i) {
+    hist_merge(&wake, &workers[i].hists[STATS_CAPTURE_NS]);
+    hist_merge(&queue, &workers[i].hists[STATS_QUEUE_NS]);
+  }
+
+  if(!wake.count)
+    return;
+
+  plog(0, "Wake-up latency (ns): p50 %" PRIu64 ", p99 %" PRIu64
+       ", p99.9 %" PRIu64 ", max %" PRIu64,
+       hist_percentile(&wake, 50), hist_percentile(&wake, 99),
+       hist_percentile(&wake, 99.9), wake.max);
+  plog(0, "Queue latency (ns): p50 %" PRIu64 ", p99 %" PRIu64
+       ", p99.9 %" PRIu64 ", max %" PRIu64,
+       hist_percentile(&queue, 50), hist_percentile(&queue, 99),
+       hist_percentile(&queue, 99.9), queue.max);
+}
+
+/* Print what became of the IP fragments counted in total. */
+static void log_defrag(const struct defrag_stats *total) {
+  if(!total->fragments)
+    return;
+
+  plog(1, "Fragments: %llu, reassembled %llu datagrams; dropped %llu "
+       "expired, %llu evicted, %llu overlapping and %llu unusable",
+       total->fragments, total->reassembled, total->expired, total->evicted,
+       total->overlaps, total->dropped);
+}
+
+/* Print what became of the IP fragments every worker came across. */
+static void report_defrag(void) {
+  struct defrag_stats total = {0};
+  const struct defrag_stats *s;
+  int i;
+
+  for(i = 0; i < nworkers; ++i) {
+    s = &workers[i].defrag.stats;
+    total.fragments += s->fragments;
+    total.reassembled += s->reassembled;
+    total.expired += s->expired;
+    total.evicted += s->evicted;
+    total.overlaps += s->overlaps;
+    total.dropped += s->dropped;
+  }
+
+  log_defrag(&total);
+}
+
+/* True if some JSON field would be worse off for a datagram cut into
+ * fragments: anything past the IP header, which includes the inner addresses
+ * of tunnels */
+static bool wants_defrag(void) {
+  return to_json && (decode_wants(DECODE_PORTS | DECODE_ICMP | DECODE_TUNNEL)
+                     || options.fields & DECODE_FIELD(DECODE_F_REASSEMBLED));
+}
+
+/* Collect the counters of every worker for the stats thread. Capture
+ * threads sample their kernel counters between batches, so give them up to a
+ * read timeout to answer before settling for their last sample. */
+static void collect_stats(struct stats_counters *c, void *user) {
+  static const struct timespec nap = { .tv_sec = 0, .tv_nsec = 1000000 };
+  unsigned gen = __atomic_add_fetch(&stats_gen, 1, __ATOMIC_ACQ_REL);
+  int i, waited;
+  struct worker *w;
+
+  for(i = 0; i < nworkers; ++i) {
+    w = &workers[i];
+    for(waited = 0; !w->file && waited < options.read_timeout + 10; ++waited) {
+      if(__atomic_load_n(&w->stats_gen, __ATOMIC_ACQUIRE) == gen
+         || __atomic_load_n(&w->capture_done, __ATOMIC_ACQUIRE))
+        break;
+      nanosleep(&nap, NULL);
+    }
+
+    c[i].dev = w->dev;
+    c[i].recv = w->kstats.ps_recv;
+    c[i].drop = w->kstats.ps_drop;
+    c[i].ifdrop = w->kstats.ps_ifdrop;
+    c[i].captured = __atomic_load_n(&w->count, __ATOMIC_RELAXED);
+    c[i].encoded = __atomic_load_n(&w->encoded, __ATOMIC_RELAXED);
+    c[i].json_bytes = __atomic_load_n(&w->json_bytes, __ATOMIC_RELAXED);
+    c[i].queued = ring_count(&w->ring);
+    c[i].reassembled = __atomic_load_n(&w->defrag.stats.reassembled,
+                                       __ATOMIC_RELAXED);
+    c[i].frag_expired = __atomic_load_n(&w->defrag.stats.expired,
+                                        __ATOMIC_RELAXED);
+    c[i].frag_evicted = __atomic_load_n(&w->defrag.stats.evicted,
+                                        __ATOMIC_RELAXED);
+    c[i].frag_overlaps = __atomic_load_n(&w->defrag.stats.overlaps,
+                                         __ATOMIC_RELAXED);
+    c[i].hists = timed ? w->hists : NULL;
+  }
+}
+
+/* Run the capture pipeline with count workers until the source runs dry or
+ * we are told to stop, and return the number of packets captured.
+ *
+ * dev:     Device to capture on, or NULL if reading from file
+ * file:    Mapped pcap file to read from, or NULL if capturing live
+ * count:   Number of workers
+ * snaplen: Largest packet the pipeline has to hold
+ * nano:    True if timestamps will have ns rather than us resolution
+ */
+static int run_pipeline(const char *dev, struct pcapfile *file, int count,
+                        int snaplen, bool nano) {
+  int i, j, n, err, total = 0;
+  struct jsonw out;
+  struct stats st;
+  sigset_t stopsigs, oldmask;
+
+  jsonw_open(&out, options.jsonfile, nano);
+  to_pcap = options.capwrite != NULL;
+  to_json = !to_pcap || options.jsonfile;
+  defragging = wants_defrag();
+  if(to_pcap)
+    capwriter_open(&capw, options.capwrite, nano, snaplen);
+
+  workers = aligned_malloc_or_die(CACHELINE_SIZE, count * sizeof *workers);
+  nworkers = count;
+  timed = options.statsfile || options.tune & TUNE_LATENCY;
+  catch_stop_signals();
+
+  /* Workers block the stop signals so that the handler always runs on this
+   * thread, which is also the only one that closes handles. */
+  sigemptyset(&stopsigs);
+  sigaddset(&stopsigs, SIGINT);
+  sigaddset(&stopsigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopsigs, &oldmask);
+
+  for(i = 0; i < nworkers; ++i) {
+    workers[i].dev = dev;
+    workers[i].file = file;
+    workers[i].iface = 0;
+    if(file)
+      decode_select(&workers[i].decoder, file->linktype);
+    if(to_pcap && file)
+      workers[i].iface = capwriter_add_interface(&capw, NULL, file->linktype);
+    workers[i].handle = NULL;
+    workers[i].count = 0;
+    workers[i].filter_gen = 0;
+    memset(&workers[i].kstats, 0, sizeof workers[i].kstats);
+    memset(&workers[i].kstats_base, 0, sizeof workers[i].kstats_base);
+    workers[i].stats_gen = 0;
+    workers[i].encoded = 0;
+    workers[i].json_bytes = 0;
+    for(j = 0; j < STATS_NHISTS; ++j)
+      hist_init(&workers[i].hists[j]);
+    workers[i].capture_done = false;
+    memset(&workers[i].defrag, 0, sizeof workers[i].defrag);
+    if(defragging)
+      defrag_init(&workers[i].defrag);
+    ring_init(&workers[i].ring, WORKER_RING_SIZE);
+    if(!file)
+      pool_init(&workers[i].pool, snaplen, WORKER_RING_SIZE);
+    jsonw_attach(&workers[i].out, &out);
+
+    err = pthread_create(&workers[i].encoder, NULL, run_encoder, &workers[i]);
+    if(err)
+      die(err, "pthread_create()");
+    err = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    if(err)
+      die(err, "pthread_create()");
+  }
+
+  pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+  if(options.statsfile)
+    stats_start(&st, options.statsfile, options.stats_interval, nworkers,
+                collect_stats, NULL);
+
+  for(i = 0; i < nworkers; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    pthread_join(workers[i].encoder, NULL);
+    total += workers[i].count;
+  }
+
+  if(options.statsfile)
+    stats_stop(&st);
+  if(options.tune & TUNE_LATENCY && !file)
+    report_latency();
+  report_defrag();
+
+  n = nworkers;
+  nworkers = 0;
+  for(i = 0; i < n; ++i) {
+    if(workers[i].handle)
+      pcap_close(workers[i].handle);
+    jsonw_close(&workers[i].out);
+    ring_free(&workers[i].ring);
+    defrag_free(&workers[i].defrag);
+    if(!file)
+      pool_free(&workers[i].pool);
+  }
+  free(workers);
+  workers = NULL;
+
+  if(to_pcap)
+    capwriter_close(&capw);
+  jsonw_close(&out);
+  return total;
+}
+
+/* Packets captured this long ago are written out even if some other device
+ * has not caught up yet, on top of the time pcap may sit on a packet. */
+#define MERGE_SLACK_NS 10000000LL
+
+/* Poll every device's handle from a single epoll loop, queueing each
+ * device's packets on its own worker's ring. */
+static void *run_poller(void *arg) {
+  int i, n, got, epfd;
+  struct epoll_event ev, evs[16];
+  struct worker *w;
+
+  epfd = epoll_create1(0);
+  if(epfd < 0)
+    die(errno, "epoll_create1()");
+
+  for(i = 0; i < nworkers; ++i) {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &workers[i];
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, pcap_get_selectable_fd(workers[i].handle),
+                 &ev))
+      die(errno, "epoll_ctl()");
+  }
+
+  while(!stop_requested) {
+    for(i = 0; i < nworkers; ++i) {
+      filter_attach_pcap(&capfilter, workers[i].handle, &workers[i].filter_gen);
+      sample_pcap_stats(&workers[i], false);
+    }
+
+    n = epoll_wait(epfd, evs, sizeof evs / sizeof *evs, options.read_timeout);
+    if(n < 0 && errno != EINTR)
+      die(errno, "epoll_wait()");
+
+    /* pcap may hold packets back until its timeout runs out without the fd
+     * ever becoming readable, so sweep every handle when nothing happens */
+    for(i = 0; i < (n > 0 ? n : nworkers); ++i) {
+      w = n > 0 ? evs[i].data.ptr : &workers[i];
+      got = pcap_dispatch(w->handle, options.batch, handle_packet, (u_char*)w);
+      if(got == PCAP_ERROR_BREAK)
+        break;
+      else if(got < 0)
+        die(0, "pcap_dispatch(%s): %s", w->dev, pcap_geterr(w->handle));
+      if(timed && got)
+        hist_record(&w->hists[STATS_CAPTURE_BATCH], got);
+      w->count += got;
+    }
+  }
+
+  close(epfd);
+  for(i = 0; i < nworkers; ++i) {
+    sample_pcap_stats(&workers[i], true);
+    __atomic_store_n(&workers[i].capture_done, true, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+/* Write out the packets queued by run_poller() in timestamp order. Each
+ * device's packets arrive in order, so the oldest packet at the front of any
+ * ring goes next, once every ring has something in it to compare against.
+ * A quiet device only holds the others back for as long as a packet could
+ * still be on its way from it. */
+static void *run_merger(void *arg) {
+  struct jsonw *out = arg;
+  const struct pktdesc *d, *oldest;
+  struct pktdesc pd;
+  struct worker *from = NULL;
+  long long holdback = options.read_timeout * 1000000LL + MERGE_SLACK_NS;
+  unsigned idle = 0;
+  unsigned long flushed = 0;
+  bool done, waiting;
+  int i;
+
+  for(;;) {
+    done = __atomic_load_n(&workers[0].capture_done, __ATOMIC_ACQUIRE);
+    oldest = NULL;
+    waiting = false;
+
+    for(i = 0; i < nworkers; ++i) {
+      d = ring_peek(&workers[i].ring);
+      if(!d)
+        waiting = true;
+      else if(!oldest || pkt_ts_ns(&d->hdr) < pkt_ts_ns(&oldest->hdr)) {
+        oldest = d;
+        from = &workers[i];
+      }
+    }
+
+    if(oldest && (!waiting || done
+                  || pkt_ts_ns(&oldest->hdr) + holdback <= now_ns())) {
+      ring_pop(&from->ring, &pd);
+      encode_packet(from, out, from->dev, &pd);
+      pool_put(&from->pool, pd.data);
+      idle = 0;
+      continue;
+    }
+
+    /* The devices share a writer, so its writes are timed on the first */
+    write_batch(&workers[0], out, &flushed);
+    if(done && !oldest)
+      break;
+    idle_wait(&idle);
+  }
+
+  return NULL;
+}
+
+/* Capture on several devices at once with a pcap handle each, and write their
+ * packets out as a single stream, merged by timestamp. Return the number of
+ * packets captured.
+ *
+ * devs:  Devices to capture on
+ * ndevs: Number of devices
+ */
+static int run_multi_pipeline(char **devs, int ndevs) {
+  int i, j, err, total = 0;
+  struct jsonw out;
+  pthread_t poller, merger;
+  struct stats st;
+  sigset_t stopsigs, oldmask;
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  jsonw_open(&out, options.jsonfile, options.tstamp_nano);
+  to_pcap = options.capwrite != NULL;
+  to_json = !to_pcap || options.jsonfile;
+  defragging = wants_defrag();
+  if(to_pcap)
+    capwriter_open(&capw, options.capwrite, options.tstamp_nano,
+                   options.snaplen);
+
+  workers = aligned_malloc_or_die(CACHELINE_SIZE, ndevs * sizeof *workers);
+  timed = options.statsfile || options.tune & TUNE_LATENCY;
+  for(i = 0; i < ndevs; ++i) {
+    workers[i].dev = devs[i];
+    workers[i].file = NULL;
+    workers[i].count = 0;
+    workers[i].filter_gen = 0;
+    memset(&workers[i].kstats, 0, sizeof workers[i].kstats);
+    memset(&workers[i].kstats_base, 0, sizeof workers[i].kstats_base);
+    workers[i].stats_gen = 0;
+    workers[i].encoded = 0;
+    workers[i].json_bytes = 0;
+    for(j = 0; j < STATS_NHISTS; ++j)
+      hist_init(&workers[i].hists[j]);
+    workers[i].capture_done = false;
+    memset(&workers[i].defrag, 0, sizeof workers[i].defrag);
+    if(defragging)
+      defrag_init(&workers[i].defrag);
+    ring_init(&workers[i].ring, WORKER_RING_SIZE);
+    pool_init(&workers[i].pool, options.snaplen, WORKER_RING_SIZE);
+    workers[i].handle = open_pcap(devs[i], options.buffer_size,
+                                  options.read_timeout);
+    if(pcap_setnonblock(workers[i].handle, 1, errbuf))
+      die(0, "pcap_setnonblock(): %s", errbuf);
+    decode_select(&workers[i].decoder, pcap_datalink(workers[i].handle));
+    if(to_pcap)
+      workers[i].iface = capwriter_add_interface(&capw, devs[i],
+                                          workers[i].decoder.linktype);
+  }
+  nworkers = ndevs;
+  catch_stop_signals();
+
+  sigemptyset(&stopsigs);
+  sigaddset(&stopsigs, SIGINT);
+  sigaddset(&stopsigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopsigs, &oldmask);
+
+  err = pthread_create(&merger, NULL, run_merger, &out);
+  if(err)
+    die(err, "pthread_create()");
+  err = pthread_create(&poller, NULL, run_poller, NULL);
+  if(err)
+    die(err, "pthread_create()");
+
+  pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+  if(options.statsfile)
+    stats_start(&st, options.statsfile, options.stats_interval, nworkers,
+                collect_stats, NULL);
+
+  pthread_join(poller, NULL);
+  pthread_join(merger, NULL);
+
+  if(options.statsfile)
+    stats_stop(&st);
+  if(options.tune & TUNE_LATENCY)
+    report_latency();
+  report_defrag();
+
+  nworkers = 0;
+  for(i = 0; i < ndevs; ++i) {
+    plog(1, "%s: %d packets", workers[i].dev, workers[i].count);
+    total += workers[i].count;
+    pcap_close(workers[i].handle);
+    ring_free(&workers[i].ring);
+    defrag_free(&workers[i].defrag);
+    pool_free(&workers[i].pool);
+  }
+  free(workers);
+  workers = NULL;
+
+  if(to_pcap)
+    capwriter_close(&capw);
+  jsonw_close(&out);
+  return total;
+}
+
+/* Capture on every device matching options.dev. */
+static int capture_all_devs(void) {
+  int i, count, ndevs;
+  char **devs;
+
+  if(options.backend == BACKEND_TPACKET)
+    die(0, "-g only works with the pcap backend");
+  if(options.workers > 1)
+    plog(0, "Ignoring the worker count with -g; using one handle per device");
+  if(options.tune & TUNE_ADAPTIVE)
+    plog(0, "Ignoring adaptive tuning with -g");
+
+  ndevs = match_devs_regex_or_die(options.dev, &devs);
+  for(i = 0; i < ndevs; ++i)
+    plog(1, "Capturing on device: %s", devs[i]);
+
+  count = run_multi_pipeline(devs, ndevs);
+
+  plog(1, "Captured %d packets on %d device(s)", count, ndevs);
+  free_devs(devs, ndevs);
+  return count;
+}
+
+int capture_live(const char *filter) {
+  int count;
+  char *dev;
+
+  filter_init(&capfilter, filter);
+  if(options.all_devs) {
+    count = capture_all_devs();
+    filter_free(&capfilter);
+    return count;
+  }
+
+  dev = options.dev ? match_dev_regex_or_die(options.dev) : "all";
+
+  if(options.backend == BACKEND_TPACKET && !options.dev)
+    die(0, "The tpacket backend needs a device to be given with -d");
+  if(options.backend == BACKEND_TPACKET
+     && (options.rfmon || options.tstamp_type != PCAP_ERROR
+         || options.linktype != PCAP_ERROR))
+    plog(0, "Ignoring -m, -u and -l with the tpacket backend");
+
+  plog(1, "Capturing on device: %s with %d worker(s)", dev, options.workers);
+
+  count = run_pipeline(dev, NULL, options.workers, options.snaplen,
+                       options.tstamp_nano);
+  filter_free(&capfilter);
+
+  plog(1, "Captured %d packets", count);
+  return count;
+}
+
+/* Shared state for converting a single file on several threads. The file is
+ * split into chunks of whole records up front; threads claim chunks in order,
+ * encode them into a slot of the reorder buffer, and the main thread writes
+ * the slots out in the original order.
+ *
+ * pf:      The mapped file
+ * chunks:  Record boundaries of each chunk
+ * ro:      Reorder buffer the chunks are encoded into
+ * count:   Number of packets encoded so far
+ * decoder: Decoder for the file's link type
+ * frags:   What became of the fragments, added up as the threads finish
+ */
+struct filejob {
+  struct pcapfile *pf;
+  struct pcapfile_chunk *chunks;
+  struct reorder ro;
+  int count;
+  struct decoder decoder;
+  struct defrag_stats frags;
+};
+
+static void *run_chunk_worker(void *arg) {
+  struct filejob *job = arg;
+  struct pcapfile_chunk *c;
+  struct pcap_pkthdr hdr;
+  struct decode_summary sum;
+  struct defrag df = {0};
+  const u_char *bytes;
+  struct jsonw *out;
+  size_t item, off, i;
+  int n;
+
+  if(defragging)
+    defrag_init(&df);
+
+  while((out = reorder_claim(&job->ro, &item))) {
+    c = &job->chunks[item];
+    off = c->off;
+    /* Chunks are encoded independently, so fragments are only put back
+     * together within one, keeping the output the same every run */
+    if(defragging)
+      defrag_reset(&df);
+    for(i = n = 0; i < c->npkts && pcapfile_read(job->pf, &off, &hdr, &bytes); ++i)
+      if(in_time_bounds(job->pf, &hdr) && passes_file_filter(&hdr, bytes)) {
+        decode_packet(&job->decoder, bytes, hdr.caplen, &sum);
+        if(defragging && sum.layers & DECODE_FRAG)
+          defrag_packet(&df, bytes, hdr.caplen, pcapfile_ts_ns(job->pf, &hdr),
+                        &sum);
+        jsonw_packet(out, &hdr, bytes, &sum);
+        ++n;
+      }
+
+    __atomic_add_fetch(&job->count, n, __ATOMIC_RELAXED);
+    reorder_complete(&job->ro, item);
+
+    if(stop_requested)
+      reorder_stop(&job->ro);
+  }
+
+  __atomic_add_fetch(&job->frags.fragments, df.stats.fragments,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->frags.reassembled, df.stats.reassembled,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->frags.expired, df.stats.expired, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->frags.evicted, df.stats.evicted, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->frags.overlaps, df.stats.overlaps,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->frags.dropped, df.stats.dropped, __ATOMIC_RELAXED);
+  defrag_free(&df);
+  return NULL;
+}
+
+static int capture_file_parallel(struct pcapfile *pf, int nthreads) {
+  int i, err;
+  size_t nchunks;
+  struct jsonw out;
+  struct filejob job;
+  pthread_t *threads;
+  sigset_t stopsigs, oldmask;
+
+  nchunks = pcapfile_chunks(pf, FILE_CHUNK_SIZE, &job.chunks);
+  plog(1, "Split file into %lu chunks for %d threads", nchunks, nthreads);
+
+  jsonw_open(&out, options.jsonfile, pf->nano);
+  job.pf = pf;
+  job.count = 0;
+  memset(&job.frags, 0, sizeof job.frags);
+  to_json = true;
+  defragging = wants_defrag();
+  decode_select(&job.decoder, pf->linktype);
+  reorder_init(&job.ro, &out, 4 * nthreads, nchunks);
+
+  threads = malloc_or_die(nthreads * sizeof *threads);
+  catch_stop_signals();
+
+  sigemptyset(&stopsigs);
+  sigaddset(&stopsigs, SIGINT);
+  sigaddset(&stopsigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopsigs, &oldmask);
+
+  for(i = 0; i < nthreads; ++i) {
+    err = pthread_create(&threads[i], NULL, run_chunk_worker, &job);
+    if(err)
+      die(err, "pthread_create()");
+  }
+
+  pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+  reorder_drain(&job.ro);
+
+  for(i = 0; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+  log_defrag(&job.frags);
+
+  free(threads);
+  reorder_free(&job.ro);
+  free(job.chunks);
+  jsonw_close(&out);
+
+  return job.count;
 }
 
 int capture_from_file(const char *filter, const char *file) {
+  int count;
+  struct pcapfile pf;
+
   if(!file)
     die(0, "DEBUG: \"file\" should not be NULL at %s:%lu", __FILE__, __LINE__);
 
-  die(0, "Capture from file not yet implemented");
+  pcapfile_open(&pf, file);
+  if(options.time_start > 0 || options.time_end < LLONG_MAX)
+    pcapfile_seek(&pf, file, options.time_start, options.time_end);
+
+  plog(1, "Reading packets from file: %s", file);
+
+  filter_init(&capfilter, filter);
+  file_prog = filter_program(&capfilter, pcapfile_dlt(pf.linktype));
+
+  /* The parallel path only produces JSON */
+  if(options.workers > 1 && options.capwrite)
+    plog(0, "Ignoring the worker count with -w; reading the file on one");
+  if(options.workers > 1 && !options.capwrite)
+    count = capture_file_parallel(&pf, options.workers);
+  else
+    count = run_pipeline(NULL, &pf, 1, pf.snaplen, pf.nano);
+
+  pcapfile_close(&pf);
+  filter_free(&capfilter);
+  file_prog = NULL;
 
-  return 0;
+  plog(1, "Read %d packets", count);
+  return count;
 }
@@ -28,15 +28,33 @@
 #ifndef PROTODUMP_CAPTURE_H
 #define PROTODUMP_CAPTURE_H
 
+#include <inttypes.h>
+#include <limits.h>
 #include <pcap/pcap.h>
+#include <poll.h>
+#include <pthread.h>
 #include <regex.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
 
+#include "adapt.h"
+#include "capwriter.h"
 #include "common.h"
+#include "defrag.h"
+#include "filter.h"
 #include "options.h"
 #include "netutil.h"
+#include "output.h"
+#include "pcapfile.h"
+#include "reorder.h"
+#include "ring.h"
+#include "stats.h"
+#include "tpacket.h"
 
 /* Print information about devices available for capture. If opts.verbose is
  * false, just print device indices, device names, and a list of attributes.
@@ -46,18 +64,75 @@
  */
 void dev_info(const char *regex);
 
+/* Set by the SIGINT/SIGTERM handler installed by catch_stop_signals(). */
+extern volatile sig_atomic_t stop_requested;
+
+/* Install a handler for SIGINT and SIGTERM that sets stop_requested and
+ * breaks out of any running capture loops. */
+void catch_stop_signals(void);
+
+/* Return the name of the only device matching regstr, dying if there is no
+ * such device or more than one. The result is in a static buffer.
+ *
+ * regstr: Regex to match device names against, as a whole
+ */
+char *match_dev_regex_or_die(const char *regstr);
+
+/* Find every device matching regstr, dying if there is none. Return the
+ * number of devices and store their names in *devs, to be freed with
+ * free_devs().
+ *
+ * regstr: Regex to match device names against, as a whole, or NULL to match
+ *         every device
+ * devs:   Where to put the array of names
+ */
+int match_devs_regex_or_die(const char *regstr, char ***devs);
+
+/* Free a device list from match_devs_regex_or_die(). */
+void free_devs(char **devs, int ndevs);
+
 /* Capture packets based on the given filter. If filter is NULL, capture all
- * packets. Return the number of packets captured.
+ * packets. Packets are read by options.workers threads through the backend
+ * chosen by options.backend, options.batch at a time, and written as JSON
+ * records to options.jsonfile (or stdout) after each batch. Capture runs until
+ * SIGINT or SIGTERM is received. With more than one worker, the workers' sockets
+ * share a PACKET_FANOUT group, so each flow is handled by a single worker.
+ * With options.all_devs set, every device matching options.dev gets a pcap
+ * handle of its own instead, and the devices' packets are merged into one
+ * stream in timestamp order, each record naming its device. If
+ * options.statsfile is set, kernel and pipeline counters are appended to it
+ * every options.stats_interval seconds and on SIGUSR1 (see stats.h). With
+ * TUNE_ADAPTIVE in options.tune, options.buffer_size and options.read_timeout
+ * are only starting points: each worker's handle is replaced by one with a
+ * bigger buffer or shorter timeout while the kernel drops packets (see
+ * adapt.h). With TUNE_LATENCY, handles are put in immediate mode and
+ * busy-polled, capture threads spin briefly before sleeping, and the
+ * latency from the kernel to the capture and encoder threads is printed at
+ * the end. With options.capwrite set, packets are written to pcap files
+ * instead, rotated as options.rotate_size and options.rotate_secs say, or to
+ * pcapng files that describe each device in a block of its own (see
+ * capwriter.h). JSON is then only written if options.jsonfile is also set.
+ * Return the number of packets captured.
  *
- * filter: If non-NULL, specifies an in-kernel filter ala pcap-filter(7)
+ * filter: If non-NULL, specifies an in-kernel filter ala pcap-filter(7), or
+ *         @FILE to read it from a file and swap in a new one on SIGHUP (see
+ *         filter.h)
  */
 int capture_live(const char *filter);
 
 /* Capture packets from file based on the given filter. If filter is NULL,
- * capture all packets. Return the number of packets captured.
+ * capture all packets. The file is mapped into memory and its records are fed
+ * to the same pipeline as live captures, without copying the packet data.
+ * With more than one worker, the file is instead split into chunks that are
+ * encoded in parallel and written out in the original packet order, unless
+ * packets are written to pcap files as with capture_live(). Only
+ * packets between options.time_start and options.time_end are captured; if
+ * the file has a sidecar index, reading starts right at the start time.
+ * Return the number of packets captured.
  *
  * file:   File to capture from, which should not be NULL
- * filter: If non-NULL, specifies an in-kernel filter ala pcap-filter(7)
+ * filter: If non-NULL, specifies a filter ala pcap-filter(7), or @FILE to
+ *         read it from a file. Packets are checked against it in userspace.
  */
 int capture_from_file(const char *filter, const char *file);
 
@@ -0,0 +1,252 @@
+/*
+ * capwriter.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "capwriter.h"
+
+bool parse_rotate(const char *arg) {
+  char *end;
+  double size;
+  long secs = 0;
+
+  size = strtod(arg, &end);
+  if(end == arg || size < 0)
+    return false;
+
+  switch(*end) {
+    case 'k': size *= 1e3; ++end; break;
+    case 'M': size *= 1e6; ++end; break;
+    case 'G': size *= 1e9; ++end; break;
+  }
+
+  if(*end == ',') {
+    arg = end + 1;
+    secs = strtol(arg, &end, 0);
+    if(end == arg || secs < 0)
+      return false;
+  }
+  if(*end)
+    return false;
+
+  options.rotate_size = (long long)size;
+  options.rotate_secs = (int)secs;
+  return true;
+}
+
+/* Name the seq'th file. When rotating, the sequence number goes in front of
+ * the extension, if the file name has one. */
+static char *file_name(void *user, unsigned seq) {
+  const char *path = ((struct capwriter*)user)->path;
+  const char *base = strrchr(path, '/'), *ext;
+  char *name = malloc_or_die(strlen(path) + 16);
+
+  if(!options.rotate_size && !options.rotate_secs) {
+    strcpy(name, path);
+    return name;
+  }
+
+  base = base ? base + 1 : path;
+  ext = strrchr(base, '.');
+  if(!ext || ext == base)
+    ext = base + strlen(base);
+
+  sprintf(name, "%.*s_%05u%s", (int)(ext - path), path, seq, ext);
+  return name;
+}
+
+void capwriter_open(struct capwriter *cw, const char *path, bool nano,
+                    int snaplen) {
+  size_t len = strlen(path);
+  unsigned flags = 0;
+
+  if(options.tune & TUNE_URING)
+    flags |= SINK_URING;
+  if(options.tune & TUNE_DIRECT)
+    flags |= SINK_DIRECT;
+
+  cw->path = path;
+  cw->ng = len >= strlen(PCAPNG_SUFFIX)
+        && !strcmp(path + len - strlen(PCAPNG_SUFFIX), PCAPNG_SUFFIX);
+  cw->nano = nano;
+  cw->snaplen = snaplen;
+  cw->ifaces = NULL;
+  cw->nifaces = 0;
+  cw->file_bytes = 0;
+  cw->file_packets = 0;
+  cw->file_start = 0;
+  cw->nfiles = 0;
+  cw->packets = 0;
+
+  sink_open_files(&cw->sink, file_name, cw, options.rotate_size, flags);
+}
+
+/* Append an Interface Description Block for ifaces[i]. Called with the lock
+ * held. */
+static void append_idb(struct capwriter *cw, int i) {
+  u_char idb[PCAPNG_IDB_MAXLEN];
+  size_t len = pcapng_put_idb(idb, cw->ifaces[i].linktype, cw->snaplen,
+                              cw->ifaces[i].name, cw->nano);
+
+  sink_append(&cw->sink, idb, len);
+  cw->file_bytes += len;
+}
+
+static bool same_name(const char *a, const char *b) {
+  return a == b || (a && b && !strcmp(a, b));
+}
+
+int capwriter_add_interface(struct capwriter *cw, const char *name,
+                            int linktype) {
+  int i;
+
+  /* Handles give DLT_* values, but files need the LINKTYPE_* ones */
+  linktype = pcapfile_linktype(linktype);
+
+  sink_lock(&cw->sink);
+
+  for(i = 0; i < cw->nifaces; ++i)
+    if(same_name(cw->ifaces[i].name, name)
+       && cw->ifaces[i].linktype == linktype)
+      break;
+
+  if(i == cw->nifaces) {
+    /* Its packets would be unreadable under the file's link type */
+    if(!cw->ng && i && cw->ifaces[0].linktype != linktype)
+      die(0, "%s has link type %d, but %s already has link type %d; "
+          "name it *%s to write both", name ? name : "The input", linktype,
+          cw->path, cw->ifaces[0].linktype, PCAPNG_SUFFIX);
+
+    cw->ifaces = realloc_or_die(cw->ifaces, (i + 1) * sizeof *cw->ifaces);
+    cw->ifaces[i].name = NULL;
+    if(name) {
+      cw->ifaces[i].name = malloc_or_die(strlen(name) + 1);
+      strcpy(cw->ifaces[i].name, name);
+    }
+    cw->ifaces[i].linktype = linktype;
+    ++cw->nifaces;
+
+    /* Later files describe it up front, but this one needs it now */
+    if(cw->ng && cw->nfiles)
+      append_idb(cw, i);
+  }
+
+  sink_unlock(&cw->sink);
+  return i;
+}
+
+/* Return true if a packet of len bytes at ts should go in a new file. Every
+ * file gets at least one packet, however small the size limit. */
+static bool rotate_due(const struct capwriter *cw, long long ts, size_t len) {
+  if(!cw->nfiles)
+    return true;
+
+  if(options.rotate_size && cw->file_packets
+     && cw->file_bytes + (long long)len > options.rotate_size)
+    return true;
+
+  return options.rotate_secs
+      && ts - cw->file_start >= options.rotate_secs * 1000000000LL;
+}
+
+/* Start a new file with the headers it needs before any packets. Called with
+ * the lock held. */
+static void start_file(struct capwriter *cw, long long ts) {
+  u_char fh[PCAPNG_SHB_LEN > PCAP_FILEHDR_LEN ? PCAPNG_SHB_LEN
+                                              : PCAP_FILEHDR_LEN];
+  int i;
+
+  if(!cw->nifaces)
+    die(0, "DEBUG: an interface should be added at %s:%d", __FILE__, __LINE__);
+
+  if(cw->nfiles)
+    sink_next_file(&cw->sink);
+  cw->file_bytes = 0;
+  cw->file_packets = 0;
+  cw->file_start = ts;
+  ++cw->nfiles;
+
+  if(!cw->ng) {
+    pcapfile_put_header(fh, cw->nano, cw->snaplen, cw->ifaces[0].linktype);
+    sink_append(&cw->sink, fh, PCAP_FILEHDR_LEN);
+    cw->file_bytes += PCAP_FILEHDR_LEN;
+    return;
+  }
+
+  pcapng_put_shb(fh);
+  sink_append(&cw->sink, fh, PCAPNG_SHB_LEN);
+  cw->file_bytes += PCAPNG_SHB_LEN;
+  for(i = 0; i < cw->nifaces; ++i)
+    append_idb(cw, i);
+}
+
+void capwriter_packet(struct capwriter *cw, int iface,
+                      const struct pcap_pkthdr *hdr, const u_char *bytes) {
+  u_char rh[PCAPNG_EPB_HDRLEN], trailer[3 + PCAPNG_EPB_TRAILER];
+  size_t rhlen, trailerlen = 0, len;
+  long long ts = hdr->ts.tv_sec * 1000000000LL
+               + hdr->ts.tv_usec * (cw->nano ? 1LL : 1000LL);
+
+  if(cw->ng) {
+    pcapng_put_epb_header(rh, iface, hdr, cw->nano);
+    rhlen = PCAPNG_EPB_HDRLEN;
+    trailerlen = pcapng_put_epb_trailer(trailer, hdr);
+  } else {
+    pcapfile_put_record_header(rh, hdr);
+    rhlen = PCAP_RECHDR_LEN;
+  }
+  len = rhlen + hdr->caplen + trailerlen;
+
+  sink_lock(&cw->sink);
+
+  if(rotate_due(cw, ts, len))
+    start_file(cw, ts);
+
+  sink_append(&cw->sink, rh, rhlen);
+  sink_append(&cw->sink, bytes, hdr->caplen);
+  if(trailerlen)
+    sink_append(&cw->sink, trailer, trailerlen);
+  cw->file_bytes += len;
+  ++cw->file_packets;
+  ++cw->packets;
+
+  sink_unlock(&cw->sink);
+}
+
+void capwriter_close(struct capwriter *cw) {
+  int i;
+
+  sink_close(&cw->sink);
+  plog(1, "Wrote %llu packets to %u file(s)", cw->packets, cw->nfiles);
+
+  for(i = 0; i < cw->nifaces; ++i)
+    free(cw->ifaces[i].name);
+  free(cw->ifaces);
+}
@@ -0,0 +1,136 @@
+/*
+ * capwriter.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_CAPWRITER_H
+#define PROTODUMP_CAPWRITER_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "options.h"
+#include "pcapfile.h"
+#include "pcapng.h"
+#include "sink.h"
+
+/* A device packets are written for.
+ *
+ * name:     Name of the device, or NULL if packets come from a file
+ * linktype: LINKTYPE_* value of its packets, as written to the file
+ */
+struct capwriter_iface {
+  char *name;
+  int linktype;
+};
+
+/* Writes packets to pcap files, or to pcapng files if the file name ends in
+ * PCAPNG_SUFFIX, moving on to a new file once the current one reaches
+ * options.rotate_size bytes or spans options.rotate_secs seconds of capture
+ * time. A pcap file has a single link type for all its packets, whereas a
+ * pcapng file describes each device in a block of its own, so packets from
+ * several devices can share it. The records go through a sink (see sink.h),
+ * so the threads handing packets over only copy them into memory, and the
+ * disk is left to the sink's writer thread. With TUNE_URING in options.tune
+ * the sink writes through io_uring, and with TUNE_DIRECT it opens files with
+ * O_DIRECT.
+ *
+ * sink:         Where the records go. Its lock also protects the fields
+ *               below.
+ * path:         File name to write to, numbered if rotating
+ * ng:           True if writing pcapng rather than pcap
+ * nano:         True if timestamps have ns rather than us resolution
+ * snaplen:      Snapshot length for the file headers
+ * ifaces:       Devices added so far, numbered as in pcapng files
+ * nifaces:      Number of devices in ifaces
+ * file_bytes:   Bytes in the current file
+ * file_packets: Packets in the current file
+ * file_start:   Capture time of the current file's first packet, in ns
+ * nfiles:       Number of files started
+ * packets:      Number of packets written
+ */
+struct capwriter {
+  struct sink sink;
+  const char *path;
+  bool ng;
+  bool nano;
+  uint32_t snaplen;
+  struct capwriter_iface *ifaces;
+  int nifaces;
+  long long file_bytes;
+  unsigned long file_packets;
+  long long file_start;
+  unsigned nfiles;
+  unsigned long long packets;
+};
+
+/* Parse a -z rotation spec of the form SIZE[,SECS] into options.rotate_size
+ * and options.rotate_secs. SIZE may end in k, M or G, and either may be 0 to
+ * leave that limit out. Return false if the spec is malformed. */
+bool parse_rotate(const char *arg);
+
+/* Start a writer. No file is created until the first packet.
+ *
+ * cw:      Writer to initialize
+ * path:    File to write to. When rotating, a sequence number is put in
+ *          front of the extension, e.g. dump_00000.pcapng.
+ * nano:    True if timestamps will have ns rather than us resolution
+ * snaplen: Largest packet that will be written
+ */
+void capwriter_open(struct capwriter *cw, const char *path, bool nano,
+                    int snaplen);
+
+/* Add a device packets will be written for, and return its index for
+ * capwriter_packet(). Adding a device that is there already returns the same
+ * index, so each of several workers on one device can add it. A pcap file
+ * takes the link type of the first device; die if a device of another link
+ * type is added to one. Safe to call from several threads.
+ *
+ * name:     Name of the device, or NULL if packets come from a file
+ * linktype: DLT_* value of its packets, or the LINKTYPE_* value from a file
+ */
+int capwriter_add_interface(struct capwriter *cw, const char *name,
+                            int linktype);
+
+/* Append a packet, rotating to a new file first if it is due. This blocks only
+ * if every buffer is waiting on the disk. Safe to call from several threads.
+ *
+ * iface: Index of the packet's device from capwriter_add_interface()
+ */
+void capwriter_packet(struct capwriter *cw, int iface,
+                      const struct pcap_pkthdr *hdr, const u_char *bytes);
+
+/* Write out everything still buffered and close the last file. */
+void capwriter_close(struct capwriter *cw);
+
+#endif
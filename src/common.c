@@ -67,6 +67,17 @@ void *realloc_or_die(void *p, size_t sz) {
   return ret;
 }
 
+void *aligned_malloc_or_die(size_t align, size_t sz) {
+  void *ret;
+  int err;
+
+  err = posix_memalign(&ret, align, sz);
+  if(err)
+    die(err, "posix_memalign(%lu, %lu)", align, sz);
+
+  return ret;
+}
+
 FILE *fopen_or_die(const char *filename, const char *mode) {
   FILE *fp;
 
@@ -97,7 +108,51 @@ void plog(int required_verbosity, char *fmt, ...) {
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
     va_end(ap);
+    fputc('\n', stderr);
   }
+}
+
+void pool_init(struct pool *p, size_t slot_size, size_t nslots) {
+  size_t i;
+
+  /* Keep every buffer cache line aligned */
+  p->slot_size = (slot_size + CACHELINE_SIZE - 1) & ~(size_t)(CACHELINE_SIZE - 1);
+  p->nslots = nslots;
+  p->mem = aligned_malloc_or_die(CACHELINE_SIZE, p->slot_size * nslots);
+  p->slots = malloc_or_die(nslots * sizeof *p->slots);
+
+  for(i = 0; i < nslots; ++i)
+    p->slots[i].next = i + 1 < nslots ? &p->slots[i + 1] : NULL;
+  p->free = nslots ? &p->slots[0] : NULL;
+}
+
+void pool_free(struct pool *p) {
+  free(p->mem);
+  free(p->slots);
+  p->mem = NULL;
+  p->slots = p->free = NULL;
+}
+
+void *pool_get(struct pool *p) {
+  struct pool_slot *slot, *next;
+
+  slot = __atomic_load_n(&p->free, __ATOMIC_ACQUIRE);
+  do {
+    if(!slot)
+      return NULL;
+    next = slot->next;
+  } while(!__atomic_compare_exchange_n(&p->free, &slot, next, true,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  return p->mem + (slot - p->slots) * p->slot_size;
+}
+
+void pool_put(struct pool *p, void *buf) {
+  struct pool_slot *slot = &p->slots[((unsigned char*)buf - p->mem)
+                                     / p->slot_size];
 
-  fputc('\n', stderr);
+  slot->next = __atomic_load_n(&p->free, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&p->free, &slot->next, slot, true,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
 }
@@ -31,6 +31,8 @@
 #include <errno.h>
 #include <regex.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,12 +44,52 @@
 #define VER    "0.1"
 #define AUTHOR "Ben Hamlin"
 
+#define CACHELINE_SIZE 64
+
+/* A pool of fixed-size buffers for packet data. Buffers are handed out as
+ * plain pointers to their data, so a packet can be passed from stage to stage
+ * without copying and goes back to the pool when the last stage is done with
+ * it. The bookkeeping lives apart from the data, so setting up a pool doesn't
+ * touch the (possibly large) data area.
+ *
+ * Only one thread may take buffers out of a pool, but they may be put back
+ * from any thread: the free list is a lock-free stack with a single popper,
+ * which is immune to ABA.
+ *
+ * slot_size: Usable size of each buffer in bytes
+ * nslots:    Number of buffers in the pool
+ * mem:       The data area, nslots * slot_size bytes
+ * slots:     Per-buffer bookkeeping
+ * free:      Top of the free list
+ */
+struct pool_slot {
+  struct pool_slot *next;
+};
+
+struct pool {
+  size_t slot_size;
+  size_t nslots;
+  unsigned char *mem;
+  struct pool_slot *slots;
+  struct pool_slot *free;
+};
+
 /* External functions */
 void die(int err, char *fmt, ...);
 void *malloc_or_die(size_t sz);
 void *realloc_or_die(void *p, size_t sz);
+void *aligned_malloc_or_die(size_t align, size_t sz);
 FILE *fopen_or_die(const char *filename, const char *mode);
 void regcomp_or_die(regex_t *preg, const char *regex, int cflags);
 void plog(int required_verbosity, char *fmt, ...);
 
+/* Set up a pool of nslots buffers of at least slot_size bytes each. */
+void pool_init(struct pool *p, size_t slot_size, size_t nslots);
+/* Free a pool's memory. All buffers should have been returned by now. */
+void pool_free(struct pool *p);
+/* Take a buffer out of the pool, or return NULL if the pool is exhausted. */
+void *pool_get(struct pool *p);
+/* Return a buffer from pool_get() to the pool. */
+void pool_put(struct pool *p, void *buf);
+
 #endif
@@ -0,0 +1,957 @@
+/*
+ * decode.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <netinet/in.h>
+#include <string.h>
+
+#include "decode.h"
+
+#define ETHERTYPE_IPV4    0x0800
+#define ETHERTYPE_IPV6    0x86dd
+#define ETHERTYPE_TEB     0x6558    /* Ethernet bridged over GRE and such */
+#define ETHERTYPE_VLAN    0x8100
+#define ETHERTYPE_QINQ    0x88a8
+#define ETHERTYPE_QINQ1   0x9100    /* Before 802.1ad had a number */
+#define ETHERTYPE_MPLS    0x8847
+#define ETHERTYPE_MPLS_MC 0x8848
+
+#define PORT_VXLAN  4789
+#define PORT_GENEVE 6081
+
+#define ETH_HDRLEN    14
+#define SLL_HDRLEN    16
+#define SLL2_HDRLEN   20
+#define NULL_HDRLEN   4
+#define IPV4_HDRLEN   20
+#define IPV6_HDRLEN   40
+#define IPV6_EXTLEN   8
+#define TCP_HDRLEN    20
+#define UDP_HDRLEN    8
+#define ICMP_HDRLEN   4
+#define DNS_HDRLEN    12
+#define TLS_HDRLEN    5
+#define VLAN_HDRLEN   4
+#define MPLS_HDRLEN   4
+#define GRE_HDRLEN    4
+#define VXLAN_HDRLEN  8
+#define GENEVE_HDRLEN 8
+
+/* Address families BSDs use for IPv6 in DLT_NULL headers */
+#define NULL_AF_INET    2
+#define NULL_AF_INET6_1 24
+#define NULL_AF_INET6_2 28
+#define NULL_AF_INET6_3 30
+
+#define TLS_HANDSHAKE      22
+#define TLS_CLIENT_HELLO   1
+#define TLS_EXT_SNI        0
+#define TLS_SNI_HOST_NAME  0
+
+#define TRANSPORT (DECODE_PORTS | DECODE_ICMP)
+
+const struct decode_field_info decode_fields[DECODE_NFIELDS] = {
+  [DECODE_F_DEV]         = {"dev",         0,             0},
+  [DECODE_F_TS]          = {"ts",          0,             0},
+  [DECODE_F_CAPLEN]      = {"caplen",      0,             0},
+  [DECODE_F_LEN]         = {"len",         0,             0},
+  [DECODE_F_LINKTYPE]    = {"linktype",    0,             0},
+  [DECODE_F_SRC_MAC]     = {"src_mac",     DECODE_LINK,   DECODE_LINK},
+  [DECODE_F_DST_MAC]     = {"dst_mac",     DECODE_ETH,    DECODE_ETH},
+  [DECODE_F_ETHERTYPE]   = {"ethertype",   DECODE_LINK,   DECODE_LINK},
+  [DECODE_F_VLAN]        = {"vlan",        DECODE_VLAN,   DECODE_VLAN},
+  [DECODE_F_MPLS]        = {"mpls",        DECODE_MPLS,   DECODE_MPLS},
+  [DECODE_F_TUNNEL]      = {"tunnel",      DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_TUNNEL_ID]   = {"tunnel_id",   DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_OUTER_SRC]   = {"outer_src",   DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_OUTER_DST]   = {"outer_dst",   DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_OUTER_PROTO] = {"outer_proto", DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_OUTER_SPORT] = {"outer_sport", DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_OUTER_DPORT] = {"outer_dport", DECODE_TUNNEL, DECODE_TUNNEL},
+  [DECODE_F_SRC]         = {"src",         DECODE_IP,     DECODE_IP},
+  [DECODE_F_DST]         = {"dst",         DECODE_IP,     DECODE_IP},
+  [DECODE_F_PROTO]       = {"proto",       DECODE_IP,     DECODE_IP},
+  [DECODE_F_TTL]         = {"ttl",         DECODE_IP,     DECODE_IP},
+  [DECODE_F_IP_LEN]      = {"ip_len",      DECODE_IP,     DECODE_IP},
+  [DECODE_F_FRAGMENT]    = {"fragment",    DECODE_IP,     DECODE_IP},
+  [DECODE_F_REASSEMBLED] = {"reassembled", DECODE_REASM,  DECODE_IP},
+  [DECODE_F_SPORT]       = {"sport",       DECODE_PORTS,  DECODE_PORTS},
+  [DECODE_F_DPORT]       = {"dport",       DECODE_PORTS,  DECODE_PORTS},
+  [DECODE_F_TCP_FLAGS]   = {"tcp_flags",   DECODE_TCP,    DECODE_TCP},
+  [DECODE_F_ICMP_TYPE]   = {"icmp_type",   DECODE_ICMP,   DECODE_ICMP},
+  [DECODE_F_ICMP_CODE]   = {"icmp_code",   DECODE_ICMP,   DECODE_ICMP},
+  [DECODE_F_DNS_ID]      = {"dns_id",      DECODE_DNS,    DECODE_DNS},
+  [DECODE_F_DNS_QR]      = {"dns_qr",      DECODE_DNS,    DECODE_DNS},
+  [DECODE_F_DNS_RCODE]   = {"dns_rcode",   DECODE_DNS,    DECODE_DNS},
+  [DECODE_F_DNS_QTYPE]   = {"dns_qtype",   DECODE_DNS,    DECODE_DNS},
+  [DECODE_F_DNS_QNAME]   = {"dns_qname",   DECODE_DNS,    DECODE_DNS},
+  [DECODE_F_TLS_TYPE]    = {"tls_type",    DECODE_TLS,    DECODE_TLS},
+  [DECODE_F_TLS_VERSION] = {"tls_version", DECODE_TLS,    DECODE_TLS},
+  [DECODE_F_TLS_HS]      = {"tls_hs",      DECODE_TLS,    DECODE_TLS},
+  [DECODE_F_TLS_SNI]     = {"tls_sni",     DECODE_TLS,    DECODE_TLS},
+  /* Applications don't move the offset, so this ends at the transport */
+  [DECODE_F_PAYLOAD_LEN] = {"payload_len", 0,             TRANSPORT},
+  [DECODE_F_DATA]        = {"data",        0,             0},
+};
+
+static struct decode_plan plan;
+static struct decode_table linktypes, ethertypes, ipprotos, tcp_ports,
+                           udp_ports;
+
+static inline uint16_t get16(const u_char *p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get32(const u_char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static inline bool have(const struct decode_state *st, uint32_t len) {
+  return st->caplen >= st->off && st->caplen - st->off >= len;
+}
+
+static inline void then(struct decode_state *st,
+                        const struct decode_table *next,
+                        uint32_t key, uint32_t alt_key) {
+  st->next = next;
+  st->key = key;
+  st->alt_key = alt_key;
+}
+
+static inline uint32_t slot_of(uint32_t key) {
+  return (key * 2654435761u) >> (32 - DECODE_TABLE_BITS);
+}
+
+static void table_add(struct decode_table *t, uint32_t key, uint32_t layer,
+                      decode_fn fn) {
+  struct decode_entry *e;
+  uint32_t i = slot_of(key);
+  unsigned n;
+
+  for(n = 0; n < DECODE_TABLE_SIZE; ++n) {
+    e = &t->slots[(i + n) % DECODE_TABLE_SIZE];
+    if(!e->fn || e->key == key) {
+      e->key = key;
+      e->layer = layer;
+      e->fn = fn;
+      return;
+    }
+  }
+  die(0, "Too many dissectors in one table");
+}
+
+static inline const struct decode_entry *table_find(
+    const struct decode_table *t, uint32_t key) {
+  const struct decode_entry *e;
+  uint32_t i = slot_of(key);
+  unsigned n;
+
+  for(n = 0; n < DECODE_TABLE_SIZE; ++n) {
+    e = &t->slots[(i + n) % DECODE_TABLE_SIZE];
+    if(!e->fn)
+      return NULL;
+    if(e->key == key)
+      return e;
+  }
+  return NULL;
+}
+
+/* Also decodes Ethernet frames inside tunnels, which only say what comes
+ * next; the link-layer fields stay those of the outermost frame. */
+static bool decode_eth(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+
+  if(!have(st, ETH_HDRLEN))
+    return false;
+  if(!(sum->layers & (DECODE_LINK | DECODE_TUNNEL))) {
+    memcpy(sum->dst_mac, p, 6);
+    memcpy(sum->src_mac, p + 6, 6);
+    sum->addr_len = 6;
+    sum->ethertype = get16(p + 12);
+    sum->layers |= DECODE_ETH;
+  }
+  st->off += ETH_HDRLEN;
+  then(st, &ethertypes, get16(p + 12), DECODE_NO_KEY);
+  return true;
+}
+
+static void put_sll_addr(struct decode_summary *sum, const u_char *addr,
+                         uint16_t len) {
+  sum->addr_len = len > sizeof sum->src_mac ? sizeof sum->src_mac : len;
+  memcpy(sum->src_mac, addr, sum->addr_len);
+  sum->layers |= DECODE_SLL;
+}
+
+static bool decode_sll(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+
+  if(!have(st, SLL_HDRLEN))
+    return false;
+  st->sum->ethertype = get16(p + 14);
+  put_sll_addr(st->sum, p + 6, get16(p + 4));
+  st->off += SLL_HDRLEN;
+  then(st, &ethertypes, st->sum->ethertype, DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_sll2(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+
+  if(!have(st, SLL2_HDRLEN))
+    return false;
+  st->sum->ethertype = get16(p);
+  put_sll_addr(st->sum, p + 12, p[11]);
+  st->off += SLL2_HDRLEN;
+  then(st, &ethertypes, st->sum->ethertype, DECODE_NO_KEY);
+  return true;
+}
+
+/* Say what comes next after a header with no type field, going by the IP
+ * version nibble at the offset. Return false if it's neither 4 nor 6. */
+static bool then_ip_version(struct decode_state *st) {
+  switch(st->pkt[st->off] >> 4) {
+    case 4:
+      then(st, &ethertypes, ETHERTYPE_IPV4, DECODE_NO_KEY);
+      break;
+    case 6:
+      then(st, &ethertypes, ETHERTYPE_IPV6, DECODE_NO_KEY);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+/* Raw IP has no link header; the version nibble says which IP it is */
+static bool decode_raw(struct decode_state *st) {
+  if(!have(st, 1))
+    return false;
+  return then_ip_version(st);
+}
+
+/* DLT_NULL carries the address family in the capturing host's byte order */
+static bool decode_null(struct decode_state *st) {
+  uint32_t af;
+
+  if(!have(st, NULL_HDRLEN))
+    return false;
+  memcpy(&af, st->pkt + st->off, sizeof af);
+  st->off += NULL_HDRLEN;
+  switch(af) {
+    case NULL_AF_INET:
+      then(st, &ethertypes, ETHERTYPE_IPV4, DECODE_NO_KEY);
+      break;
+    case NULL_AF_INET6_1:
+    case NULL_AF_INET6_2:
+    case NULL_AF_INET6_3:
+      then(st, &ethertypes, ETHERTYPE_IPV6, DECODE_NO_KEY);
+      break;
+  }
+  return true;
+}
+
+/* One 802.1Q or 802.1ad tag. Stacked tags each come back through the
+ * ethertype table, so the depth bound applies to them. */
+static bool decode_vlan(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+
+  if(!have(st, VLAN_HDRLEN))
+    return false;
+  if(!(sum->layers & DECODE_VLAN))
+    sum->nvlans = 0;
+  if(sum->nvlans < DECODE_MAX_VLANS)
+    sum->vlan[sum->nvlans++] = get16(p) & 0x0fff;
+  sum->layers |= DECODE_VLAN;
+  st->off += VLAN_HDRLEN;
+  then(st, &ethertypes, get16(p + 2), DECODE_NO_KEY);
+  return true;
+}
+
+/* A whole MPLS label stack. Nothing says what is under the bottom label, so
+ * guess from the first nibble: IPv4, IPv6, or a pseudowire control word
+ * followed by an Ethernet frame. */
+static bool decode_mpls(struct decode_state *st) {
+  struct decode_summary *sum = st->sum;
+  uint32_t entry;
+  unsigned n;
+
+  if(!(sum->layers & DECODE_MPLS))
+    sum->nlabels = 0;
+  sum->layers |= DECODE_MPLS;
+  for(n = 0; n < DECODE_MAX_DEPTH; ++n) {
+    if(!have(st, MPLS_HDRLEN))
+      return false;
+    entry = get32(st->pkt + st->off);
+    if(sum->nlabels < DECODE_MAX_LABELS)
+      sum->mpls[sum->nlabels++] = entry >> 12;
+    st->off += MPLS_HDRLEN;
+    if(entry & 0x100)
+      break;
+  }
+  if(n == DECODE_MAX_DEPTH || !have(st, 1))
+    return false;
+
+  if(!(st->pkt[st->off] >> 4)) {
+    st->off += MPLS_HDRLEN;
+    then(st, &ethertypes, ETHERTYPE_TEB, DECODE_NO_KEY);
+  } else
+    then_ip_version(st);
+  return true;
+}
+
+/* Stop at the end of the datagram, so link-layer padding isn't taken for
+ * payload */
+static inline void clamp(struct decode_state *st, uint32_t len) {
+  if(st->caplen - st->off > len)
+    st->caplen = st->off + len;
+}
+
+static bool decode_ipv4(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+  uint32_t hdrlen;
+  uint16_t frag;
+
+  if(!have(st, IPV4_HDRLEN) || p[0] >> 4 != 4)
+    return false;
+  hdrlen = (p[0] & 0x0f) * 4u;
+  if(hdrlen < IPV4_HDRLEN || !have(st, hdrlen))
+    return false;
+
+  sum->ip_len = get16(p + 2);
+  frag = get16(p + 6);
+  sum->fragment = frag & 0x3fff;
+  sum->ip_off = st->off;
+  if(sum->fragment && !(sum->layers & DECODE_FRAG)) {
+    sum->frag_v6 = false;
+    memcpy(sum->frag_src, p + 12, 4);
+    memcpy(sum->frag_dst, p + 16, 4);
+    sum->frag_id = get16(p + 4);
+    sum->frag_hdr = st->off;
+    sum->frag_off = (frag & 0x1fff) * 8u;
+    sum->frag_more = frag & 0x2000;
+    sum->frag_proto = p[9];
+    sum->frag_data = st->off + hdrlen;
+    sum->frag_len = sum->ip_len > hdrlen ? sum->ip_len - hdrlen : 0;
+    sum->frag_layers = sum->layers;
+    sum->layers |= DECODE_FRAG;
+  }
+  sum->ttl = p[8];
+  sum->proto = p[9];
+  memcpy(sum->src, p + 12, 4);
+  memcpy(sum->dst, p + 16, 4);
+  sum->layers |= DECODE_IPV4;
+
+  if(sum->ip_len >= hdrlen)
+    clamp(st, sum->ip_len);
+  st->off += hdrlen;
+  /* Only the first fragment has the transport header */
+  if(!(frag & 0x1fff))
+    then(st, &ipprotos, sum->proto, DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_ipv6(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+
+  if(!have(st, IPV6_HDRLEN) || p[0] >> 4 != 6)
+    return false;
+  sum->ip_len = get16(p + 4) + IPV6_HDRLEN;
+  sum->proto = p[6];
+  sum->ttl = p[7];
+  sum->fragment = false;
+  sum->ip_off = st->off;
+  memcpy(sum->src, p + 8, 16);
+  memcpy(sum->dst, p + 24, 16);
+  sum->layers |= DECODE_IPV6;
+
+  clamp(st, sum->ip_len);
+  st->off += IPV6_HDRLEN;
+  then(st, &ipprotos, sum->proto, DECODE_NO_KEY);
+  return true;
+}
+
+/* Hop-by-hop, routing and destination options all share a layout */
+static bool decode_ipv6_ext(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  uint32_t len;
+
+  if(!(st->sum->layers & DECODE_IPV6) || !have(st, IPV6_EXTLEN))
+    return false;
+  len = (p[1] + 1u) * 8;
+  if(!have(st, len))
+    return false;
+  st->sum->proto = p[0];
+  st->off += len;
+  then(st, &ipprotos, st->sum->proto, DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_ipv6_frag(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+  uint32_t end;
+  uint16_t frag;
+
+  if(!(sum->layers & DECODE_IPV6) || !have(st, IPV6_EXTLEN))
+    return false;
+  frag = get16(p + 2);
+  sum->proto = p[0];
+  sum->fragment = true;
+  if(!(sum->layers & DECODE_FRAG)) {
+    sum->frag_v6 = true;
+    memcpy(sum->frag_src, sum->src, 16);
+    memcpy(sum->frag_dst, sum->dst, 16);
+    sum->frag_id = get32(p + 4);
+    sum->frag_hdr = sum->ip_off;
+    sum->frag_off = frag & 0xfff8;
+    sum->frag_more = frag & 1;
+    sum->frag_proto = p[0];
+    sum->frag_data = st->off + IPV6_EXTLEN;
+    end = sum->ip_off + sum->ip_len;
+    sum->frag_len = end > sum->frag_data ? end - sum->frag_data : 0;
+    sum->frag_layers = sum->layers & ~DECODE_IPV6;
+    sum->layers |= DECODE_FRAG;
+  }
+  st->off += IPV6_EXTLEN;
+  if(!(frag & 0xfff8))
+    then(st, &ipprotos, sum->proto, DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_tcp(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+  uint32_t hdrlen;
+
+  if(!have(st, TCP_HDRLEN))
+    return false;
+  hdrlen = (p[12] >> 4) * 4u;
+  if(hdrlen < TCP_HDRLEN || !have(st, hdrlen))
+    return false;
+  sum->sport = get16(p);
+  sum->dport = get16(p + 2);
+  sum->tcp_flags = p[13];
+  sum->layers |= DECODE_TCP;
+  st->off += hdrlen;
+  if(have(st, 1))
+    then(st, &tcp_ports, sum->dport, sum->sport);
+  return true;
+}
+
+static bool decode_udp(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+  uint16_t len;
+
+  if(!have(st, UDP_HDRLEN))
+    return false;
+  sum->sport = get16(p);
+  sum->dport = get16(p + 2);
+  len = get16(p + 4);
+  sum->layers |= DECODE_UDP;
+  if(len >= UDP_HDRLEN)
+    clamp(st, len);
+  st->off += UDP_HDRLEN;
+  if(have(st, 1))
+    then(st, &udp_ports, sum->dport, sum->sport);
+  return true;
+}
+
+static bool decode_icmp(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+
+  if(!have(st, ICMP_HDRLEN))
+    return false;
+  st->sum->icmp_type = p[0];
+  st->sum->icmp_code = p[1];
+  st->sum->layers |= DECODE_ICMP;
+  st->off += ICMP_HDRLEN;
+  return true;
+}
+
+/* Note that the packet goes into a tunnel of the given kind. At the
+ * outermost tunnel, the 5-tuple so far is kept as the outer one; from here
+ * on the IP and transport fields start over for the inner packet. */
+static void enter_tunnel(struct decode_state *st, uint32_t layer,
+                         uint32_t id) {
+  struct decode_summary *sum = st->sum;
+
+  if(!(sum->layers & DECODE_TUNNEL)) {
+    sum->outer_v6 = sum->layers & DECODE_IPV6;
+    memcpy(sum->outer_src, sum->src, sizeof sum->src);
+    memcpy(sum->outer_dst, sum->dst, sizeof sum->dst);
+    sum->outer_proto = sum->proto;
+    sum->outer_sport = sum->layers & DECODE_PORTS ? sum->sport : 0;
+    sum->outer_dport = sum->layers & DECODE_PORTS ? sum->dport : 0;
+  }
+  sum->layers &= ~(DECODE_IP | DECODE_PORTS | DECODE_ICMP);
+  sum->layers |= layer;
+  sum->tunnel = layer;
+  sum->tunnel_id = id;
+}
+
+/* GRE, version 0 only; the enhanced GRE of PPTP isn't followed */
+static bool decode_gre(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  uint32_t len = GRE_HDRLEN, key = 0;
+  uint16_t flags;
+
+  if(!have(st, GRE_HDRLEN))
+    return false;
+  flags = get16(p);
+  if(flags & 0x0007)
+    return false;
+  if(flags & 0x8000)                          /* Checksum */
+    len += 4;
+  if(flags & 0x2000) {                        /* Key */
+    if(!have(st, len + 4))
+      return false;
+    key = get32(p + len);
+    len += 4;
+  }
+  if(flags & 0x1000)                          /* Sequence number */
+    len += 4;
+  if(!have(st, len))
+    return false;
+
+  enter_tunnel(st, DECODE_GRE, key);
+  st->off += len;
+  then(st, &ethertypes, get16(p + 2), DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_vxlan(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+
+  if(!have(st, VXLAN_HDRLEN) || !(p[0] & 0x08))
+    return false;
+  enter_tunnel(st, DECODE_VXLAN, get32(p + 4) >> 8);
+  st->off += VXLAN_HDRLEN;
+  then(st, &ethertypes, ETHERTYPE_TEB, DECODE_NO_KEY);
+  return true;
+}
+
+static bool decode_geneve(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  uint32_t len;
+
+  if(!have(st, GENEVE_HDRLEN) || p[0] >> 6)
+    return false;
+  len = GENEVE_HDRLEN + (p[0] & 0x3f) * 4u;
+  if(!have(st, len))
+    return false;
+  enter_tunnel(st, DECODE_GENEVE, get32(p + 4) >> 8);
+  st->off += len;
+  then(st, &ethertypes, get16(p + 2), DECODE_NO_KEY);
+  return true;
+}
+
+/* IPv4 or IPv6 directly inside IP */
+static bool decode_ipip(struct decode_state *st) {
+  uint8_t proto = st->sum->proto;
+
+  enter_tunnel(st, DECODE_IPIP, 0);
+  then(st, &ethertypes, proto == IPPROTO_IPIP ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6,
+       DECODE_NO_KEY);
+  return true;
+}
+
+/* Copy the dotted form of the uncompressed name at p into buf. Returns the
+ * number of bytes the name takes up in the message, or 0 if it doesn't fit in
+ * len bytes. A compression pointer ends the name where it is. */
+static uint32_t copy_dns_name(const u_char *p, uint32_t len, char *buf) {
+  uint32_t in = 0, out = 0, i;
+  uint8_t label;
+
+  while(in < len) {
+    label = p[in++];
+    if(!label)
+      break;
+    if((label & 0xc0) == 0xc0) {
+      ++in;
+      break;
+    }
+    if(label > len - in)
+      return 0;
+    if(out && out < DECODE_NAME_MAX - 1)
+      buf[out++] = '.';
+    for(i = 0; i < label && out < DECODE_NAME_MAX - 1; ++i)
+      buf[out++] = (char)p[in + i];
+    in += label;
+  }
+  buf[out] = '\0';
+  return in <= len ? in : 0;
+}
+
+/* Application dissectors summarize the payload without moving past it, so
+ * payload_off still points at the start of the message. */
+static bool dns_message(struct decode_state *st, uint32_t off) {
+  const u_char *p = st->pkt + off;
+  struct decode_summary *sum = st->sum;
+  uint32_t len, namelen;
+
+  if(st->caplen < off || st->caplen - off < DNS_HDRLEN)
+    return false;
+  len = st->caplen - off;
+  sum->dns_id = get16(p);
+  sum->dns_qr = p[2] >> 7;
+  sum->dns_rcode = p[3] & 0x0f;
+  sum->dns_qtype = 0;
+  sum->dns_qname[0] = '\0';
+  if(get16(p + 4)) {
+    namelen = copy_dns_name(p + DNS_HDRLEN, len - DNS_HDRLEN, sum->dns_qname);
+    if(!namelen)
+      return false;
+    if(len - DNS_HDRLEN - namelen >= 2)
+      sum->dns_qtype = get16(p + DNS_HDRLEN + namelen);
+  }
+  sum->layers |= DECODE_DNS;
+  return true;
+}
+
+static bool decode_dns(struct decode_state *st) {
+  return dns_message(st, st->off);
+}
+
+/* DNS over TCP puts a length in front of each message */
+static bool decode_dns_tcp(struct decode_state *st) {
+  return dns_message(st, st->off + 2);
+}
+
+/* Find the server name in the ClientHello body at p */
+static void tls_sni(const u_char *p, uint32_t len, char *buf) {
+  uint32_t off = 2 + 32, end, ext_len, n;
+  uint16_t type;
+
+  if(off >= len)
+    return;
+  off += 1 + p[off];                         /* session ID */
+  if(off + 2 > len)
+    return;
+  off += 2 + get16(p + off);                 /* cipher suites */
+  if(off + 1 > len)
+    return;
+  off += 1 + p[off];                         /* compression methods */
+  if(off + 2 > len)
+    return;
+  end = off + 2 + get16(p + off);
+  if(end > len)
+    end = len;
+  off += 2;
+
+  while(off + 4 <= end) {
+    type = get16(p + off);
+    ext_len = get16(p + off + 2);
+    off += 4;
+    if(type == TLS_EXT_SNI && off + 5 <= end &&
+       p[off + 2] == TLS_SNI_HOST_NAME) {
+      n = get16(p + off + 3);
+      if(n > end - off - 5)
+        n = end - off - 5;
+      if(n > DECODE_NAME_MAX - 1)
+        n = DECODE_NAME_MAX - 1;
+      memcpy(buf, p + off + 5, n);
+      buf[n] = '\0';
+      return;
+    }
+    off += ext_len;
+  }
+}
+
+static bool decode_tls(struct decode_state *st) {
+  const u_char *p = st->pkt + st->off;
+  struct decode_summary *sum = st->sum;
+  uint32_t len;
+
+  if(!have(st, TLS_HDRLEN))
+    return false;
+  /* Record types run from change_cipher_spec (20) to heartbeat (24) */
+  if(p[0] < 20 || p[0] > 24 || p[1] != 3)
+    return false;
+  sum->tls_type = p[0];
+  sum->tls_version = get16(p + 1);
+  sum->tls_hs = 0;
+  sum->tls_sni[0] = '\0';
+  len = st->caplen - st->off - TLS_HDRLEN;
+  if(sum->tls_type == TLS_HANDSHAKE && len >= 4) {
+    sum->tls_hs = p[TLS_HDRLEN];
+    if(sum->tls_hs == TLS_CLIENT_HELLO)
+      tls_sni(p + TLS_HDRLEN + 4, len - 4, sum->tls_sni);
+  }
+  sum->layers |= DECODE_TLS;
+  return true;
+}
+
+/* Every dissector, the key it's found under, and the layer it decodes (0 for
+ * dissectors that only work out what comes next). New protocols go here. */
+static const struct {
+  struct decode_table *table;
+  uint32_t key;
+  uint32_t layer;
+  decode_fn fn;
+} dissectors[] = {
+  {&linktypes,  DLT_NULL,          0,             decode_null},
+  {&linktypes,  DLT_EN10MB,        DECODE_ETH,    decode_eth},
+  {&linktypes,  DLT_RAW,           0,             decode_raw},
+  {&linktypes,  LINKTYPE_RAW,      0,             decode_raw},
+  {&linktypes,  DLT_LINUX_SLL,     DECODE_SLL,    decode_sll},
+  {&linktypes,  DLT_LINUX_SLL2,    DECODE_SLL,    decode_sll2},
+#ifdef DLT_IPV4
+  {&linktypes,  DLT_IPV4,          DECODE_IPV4,   decode_ipv4},
+  {&linktypes,  DLT_IPV6,          DECODE_IPV6,   decode_ipv6},
+#endif
+  {&ethertypes, ETHERTYPE_IPV4,    DECODE_IPV4,   decode_ipv4},
+  {&ethertypes, ETHERTYPE_IPV6,    DECODE_IPV6,   decode_ipv6},
+  {&ethertypes, ETHERTYPE_TEB,     DECODE_ETH,    decode_eth},
+  {&ethertypes, ETHERTYPE_VLAN,    DECODE_VLAN,   decode_vlan},
+  {&ethertypes, ETHERTYPE_QINQ,    DECODE_VLAN,   decode_vlan},
+  {&ethertypes, ETHERTYPE_QINQ1,   DECODE_VLAN,   decode_vlan},
+  {&ethertypes, ETHERTYPE_MPLS,    DECODE_MPLS,   decode_mpls},
+  {&ethertypes, ETHERTYPE_MPLS_MC, DECODE_MPLS,   decode_mpls},
+  {&ipprotos,   IPPROTO_HOPOPTS,   DECODE_IPV6,   decode_ipv6_ext},
+  {&ipprotos,   IPPROTO_ICMP,      DECODE_ICMP,   decode_icmp},
+  {&ipprotos,   IPPROTO_IPIP,      DECODE_IPIP,   decode_ipip},
+  {&ipprotos,   IPPROTO_TCP,       DECODE_TCP,    decode_tcp},
+  {&ipprotos,   IPPROTO_UDP,       DECODE_UDP,    decode_udp},
+  {&ipprotos,   IPPROTO_IPV6,      DECODE_IPIP,   decode_ipip},
+  {&ipprotos,   IPPROTO_ROUTING,   DECODE_IPV6,   decode_ipv6_ext},
+  {&ipprotos,   IPPROTO_FRAGMENT,  DECODE_IPV6,   decode_ipv6_frag},
+  {&ipprotos,   IPPROTO_GRE,       DECODE_GRE,    decode_gre},
+  {&ipprotos,   IPPROTO_ICMPV6,    DECODE_ICMP,   decode_icmp},
+  {&ipprotos,   IPPROTO_DSTOPTS,   DECODE_IPV6,   decode_ipv6_ext},
+  {&udp_ports,  53,                DECODE_DNS,    decode_dns},
+  {&udp_ports,  5353,              DECODE_DNS,    decode_dns},
+  {&udp_ports,  PORT_VXLAN,        DECODE_VXLAN,  decode_vxlan},
+  {&udp_ports,  PORT_GENEVE,       DECODE_GENEVE, decode_geneve},
+  {&tcp_ports,  53,                DECODE_DNS,    decode_dns_tcp},
+  {&tcp_ports,  443,               DECODE_TLS,    decode_tls},
+  {&tcp_ports,  853,               DECODE_TLS,    decode_tls},
+};
+
+bool parse_fields(const char *arg) {
+  size_t len, i;
+
+  options.fields = 0;
+  while(*arg) {
+    len = strcspn(arg, ",");
+    for(i = 0; i < DECODE_NFIELDS; ++i)
+      if(strlen(decode_fields[i].name) == len &&
+         !strncmp(arg, decode_fields[i].name, len))
+        break;
+    if(i == DECODE_NFIELDS)
+      return false;
+
+    options.fields |= DECODE_FIELD(i);
+    arg += len;
+    if(*arg)
+      ++arg;
+  }
+
+  return options.fields != 0;
+}
+
+/* Add the layers that have to be decoded to get at the given ones. Anything
+ * from IP up may be inside a tunnel, and tunnels are found behind VLAN tags,
+ * MPLS labels, IP and (for VXLAN and Geneve) UDP. */
+static uint32_t with_carriers(uint32_t layers) {
+  if(layers & (DECODE_DNS | DECODE_TLS))
+    layers |= DECODE_PORTS;
+  if(layers & (DECODE_IP | DECODE_PORTS | DECODE_ICMP | DECODE_TUNNEL))
+    layers |= DECODE_TUNNEL | DECODE_UDP | DECODE_IP;
+  if(layers & DECODE_IP)
+    layers |= DECODE_VLAN | DECODE_MPLS;
+  if(layers & (DECODE_IP | DECODE_VLAN | DECODE_MPLS))
+    layers |= DECODE_LINK;
+  return layers;
+}
+
+void decode_init(void) {
+  size_t i;
+  unsigned f;
+
+  for(i = 0; i < sizeof dissectors / sizeof *dissectors; ++i)
+    table_add(dissectors[i].table, dissectors[i].key, dissectors[i].layer,
+              dissectors[i].fn);
+
+  plan.layers = 0;
+  for(f = 0; f < DECODE_NFIELDS; ++f)
+    if(options.fields & DECODE_FIELD(f))
+      plan.layers |= decode_fields[f].needs;
+  plan.layers = with_carriers(plan.layers);
+}
+
+bool decode_wants(uint32_t layers) {
+  return plan.layers & layers;
+}
+
+/* True if e is a dissector the plan has any use for */
+static inline bool wanted(const struct decode_entry *e) {
+  return e && (!e->layer || e->layer & plan.layers);
+}
+
+static inline void start(struct decode_state *st, const u_char *pkt,
+                         uint32_t caplen, struct decode_summary *sum) {
+  st->pkt = pkt;
+  st->caplen = caplen;
+  st->off = 0;
+  st->next = NULL;
+  st->sum = sum;
+  sum->layers = 0;
+}
+
+static inline void finish(struct decode_state *st) {
+  st->sum->payload_off = st->off;
+  st->sum->payload_len = st->caplen - st->off;
+}
+
+/* Decode whatever st->next says comes next, and so on, through the tables */
+static void run(struct decode_state *st) {
+  const struct decode_entry *e;
+  unsigned depth;
+
+  for(depth = 0; st->next && depth < DECODE_MAX_DEPTH; ++depth) {
+    e = table_find(st->next, st->key);
+    if(!wanted(e) && st->alt_key != DECODE_NO_KEY)
+      e = table_find(st->next, st->alt_key);
+    if(!wanted(e))
+      break;
+    st->next = NULL;
+    if(!e->fn(st))
+      break;
+  }
+}
+
+/* Go straight to IPv4 or IPv6, which is what nearly every packet carries,
+ * and leave anything else to the tables */
+static inline void run_from_net(struct decode_state *st) {
+  if(st->next == &ethertypes) {
+    if(st->key == ETHERTYPE_IPV4 && plan.layers & DECODE_IPV4) {
+      st->next = NULL;
+      if(!decode_ipv4(st))
+        return;
+    } else if(st->key == ETHERTYPE_IPV6 && plan.layers & DECODE_IPV6) {
+      st->next = NULL;
+      if(!decode_ipv6(st))
+        return;
+    }
+  }
+  run(st);
+}
+
+static void run_generic(const struct decoder *d, const u_char *pkt,
+                        uint32_t caplen, struct decode_summary *sum) {
+  struct decode_state st;
+
+  start(&st, pkt, caplen, sum);
+  if(plan.layers)
+    then(&st, &linktypes, (uint32_t)d->linktype, DECODE_NO_KEY);
+  run(&st);
+  finish(&st);
+}
+
+static void run_en10mb(const struct decoder *d, const u_char *pkt,
+                       uint32_t caplen, struct decode_summary *sum) {
+  struct decode_state st;
+
+  start(&st, pkt, caplen, sum);
+  if(plan.layers & DECODE_ETH && decode_eth(&st))
+    run_from_net(&st);
+  finish(&st);
+}
+
+static void run_sll(const struct decoder *d, const u_char *pkt,
+                    uint32_t caplen, struct decode_summary *sum) {
+  struct decode_state st;
+
+  start(&st, pkt, caplen, sum);
+  if(plan.layers & DECODE_SLL && decode_sll(&st))
+    run_from_net(&st);
+  finish(&st);
+}
+
+static void run_sll2(const struct decoder *d, const u_char *pkt,
+                     uint32_t caplen, struct decode_summary *sum) {
+  struct decode_state st;
+
+  start(&st, pkt, caplen, sum);
+  if(plan.layers & DECODE_SLL && decode_sll2(&st))
+    run_from_net(&st);
+  finish(&st);
+}
+
+static void run_raw(const struct decoder *d, const u_char *pkt,
+                    uint32_t caplen, struct decode_summary *sum) {
+  struct decode_state st;
+
+  start(&st, pkt, caplen, sum);
+  if(plan.layers && decode_raw(&st))
+    run_from_net(&st);
+  finish(&st);
+}
+
+void decode_datagram(const u_char *pkt, uint32_t len,
+                     struct decode_summary *sum) {
+  struct decode_state st;
+  uint32_t outside = sum->frag_layers;
+
+  start(&st, pkt, len, sum);
+  sum->layers = outside;
+  if(decode_raw(&st))
+    run_from_net(&st);
+  finish(&st);
+}
+
+void decode_select(struct decoder *d, int linktype) {
+  d->linktype = linktype;
+  switch(linktype) {
+    case DLT_EN10MB:
+      d->run = run_en10mb;
+      break;
+    case DLT_LINUX_SLL:
+      d->run = run_sll;
+      break;
+    case DLT_LINUX_SLL2:
+      d->run = run_sll2;
+      break;
+    case DLT_RAW:
+    case LINKTYPE_RAW:
+      d->run = run_raw;
+      break;
+    default:
+      d->run = run_generic;
+      break;
+  }
+}
@@ -0,0 +1,397 @@
+/*
+ * decode.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_DECODE_H
+#define PROTODUMP_DECODE_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "options.h"
+#include "pcapfile.h"
+
+/* Link types that the platform's pcap headers may not know about */
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+
+/* Most layers decoded for a single packet, to bound the work on anything
+ * that nests deeper. Every VLAN tag and every tunnel counts as a layer. */
+#define DECODE_MAX_DEPTH 16
+
+/* Most VLAN IDs and MPLS labels kept, outermost first */
+#define DECODE_MAX_VLANS  4
+#define DECODE_MAX_LABELS 4
+
+/* Longest DNS name or TLS server name kept, including the terminating NUL */
+#define DECODE_NAME_MAX 256
+
+/* Layers a packet was found to have, as bits in decode_summary.layers */
+enum decode_layer {
+  DECODE_ETH  = 1 << 0,
+  DECODE_SLL  = 1 << 1,
+  DECODE_IPV4 = 1 << 2,
+  DECODE_IPV6 = 1 << 3,
+  DECODE_TCP  = 1 << 4,
+  DECODE_UDP  = 1 << 5,
+  DECODE_ICMP = 1 << 6,
+  DECODE_DNS  = 1 << 7,
+  DECODE_TLS  = 1 << 8,
+  DECODE_VLAN   = 1 << 9,
+  DECODE_MPLS   = 1 << 10,
+  DECODE_GRE    = 1 << 11,
+  DECODE_VXLAN  = 1 << 12,
+  DECODE_GENEVE = 1 << 13,
+  DECODE_IPIP   = 1 << 14,
+  DECODE_REASM  = 1 << 15,
+  DECODE_FRAG   = 1 << 16,
+
+  DECODE_LINK   = DECODE_ETH | DECODE_SLL,
+  DECODE_IP     = DECODE_IPV4 | DECODE_IPV6,
+  DECODE_PORTS  = DECODE_TCP | DECODE_UDP,
+  DECODE_TUNNEL = DECODE_GRE | DECODE_VXLAN | DECODE_GENEVE | DECODE_IPIP,
+};
+
+/* What a packet was decoded into. The layout is fixed and nothing points
+ * outside it, so a summary can be filled in without allocating and written
+ * out field by field. A field is only meaningful if the layer it belongs to
+ * is in layers; nothing else is cleared between packets.
+ *
+ * Tunnels are decapsulated. The link-layer fields describe the outermost
+ * frame, while the IP, transport and application fields describe the
+ * innermost packet, so that tunnelled traffic is told apart by its own flows.
+ * The 5-tuple outside the outermost tunnel is kept in the outer_* fields.
+ *
+ * linktype:    DLT_* or LINKTYPE_* value the packet was decoded as
+ * layers:      DECODE_* bits of the layers found
+ * src_mac:     Source MAC address, with DECODE_ETH, or the link-layer
+ *              address with DECODE_SLL (of addr_len bytes)
+ * dst_mac:     Destination MAC address, with DECODE_ETH
+ * addr_len:    Length of the link-layer address in src_mac
+ * ethertype:   Protocol of the network layer, with DECODE_LINK
+ * vlan:        VLAN IDs of the first nvlans 802.1Q/802.1ad tags, with
+ *              DECODE_VLAN
+ * nvlans:      Number of IDs in vlan
+ * mpls:        First nlabels MPLS labels, with DECODE_MPLS
+ * nlabels:     Number of labels in mpls
+ * tunnel:      DECODE_* bit of the innermost tunnel, with DECODE_TUNNEL
+ * tunnel_id:   VXLAN or Geneve VNI, or GRE key, of the innermost tunnel, or 0
+ *              if it has none, with DECODE_TUNNEL
+ * outer_v6:    True if the outer_* addresses are IPv6, with DECODE_TUNNEL
+ * outer_src:   Source address outside the outermost tunnel, with
+ *              DECODE_TUNNEL
+ * outer_dst:   Destination address outside it, likewise
+ * outer_proto: IP protocol carrying the tunnel, with DECODE_TUNNEL
+ * outer_sport: Source port carrying the tunnel, or 0 if it isn't carried
+ *              over TCP or UDP, with DECODE_TUNNEL
+ * outer_dport: Destination port, likewise
+ * src:         Source address, with DECODE_IP; IPv4 addresses take the first
+ *              four bytes
+ * dst:         Destination address, likewise
+ * proto:       IP protocol of the transport layer, with DECODE_IP
+ * ttl:         TTL or hop limit, with DECODE_IP
+ * ip_len:      Length of the IP datagram, with DECODE_IP
+ * fragment:    True if the datagram is a fragment, with DECODE_IP
+ * frag_*:      The outermost fragment in the packet, with DECODE_FRAG. Inner
+ *              headers found in a first fragment, such as those of a tunnel,
+ *              don't change these.
+ * frag_v6:     True if the fragmented datagram is IPv6
+ * frag_src:    Its source address
+ * frag_dst:    Its destination address
+ * frag_id:     Its identification
+ * frag_hdr:    Offset of its IP header in the packet
+ * frag_off:    Offset of the fragment's data in the datagram
+ * frag_more:   True unless this is the last fragment
+ * frag_proto:  Protocol of the datagram's payload
+ * frag_data:   Offset of the fragment's data in the packet
+ * frag_len:    Length of the fragment's data, as the IP header has it
+ * frag_layers: Layers found outside the fragmented datagram
+ * ip_off:      Offset of the (innermost) IP header in the packet, with
+ *              DECODE_IP
+ * reassembled: Number of fragments the datagram was put back together from,
+ *              with DECODE_REASM. The fields from IP up then describe the
+ *              whole datagram, and payload_off is an offset into it.
+ * sport:       Source port, with DECODE_PORTS
+ * dport:       Destination port, with DECODE_PORTS
+ * tcp_flags:   TCP flags, with DECODE_TCP
+ * icmp_type:   ICMP or ICMPv6 type, with DECODE_ICMP
+ * icmp_code:   ICMP or ICMPv6 code, with DECODE_ICMP
+ * dns_id:      DNS transaction ID, with DECODE_DNS
+ * dns_qr:      True for a response, with DECODE_DNS
+ * dns_rcode:   Response code, with DECODE_DNS
+ * dns_qtype:   Type of the first question, or 0 if there is none, with
+ *              DECODE_DNS
+ * dns_qname:   Name in the first question, or "" if there is none, with
+ *              DECODE_DNS
+ * tls_type:    Content type of the first TLS record, with DECODE_TLS
+ * tls_version: Protocol version of the first TLS record, with DECODE_TLS
+ * tls_hs:      Handshake message type, or 0 if not a handshake, with
+ *              DECODE_TLS
+ * tls_sni:     Server name from a ClientHello, or "", with DECODE_TLS
+ * payload_off: Offset of the first byte no layer accounted for
+ * payload_len: Number of captured bytes from payload_off on
+ */
+struct decode_summary {
+  int linktype;
+  uint32_t layers;
+  uint8_t src_mac[8];
+  uint8_t dst_mac[6];
+  uint8_t addr_len;
+  uint16_t ethertype;
+  uint16_t vlan[DECODE_MAX_VLANS];
+  uint8_t nvlans;
+  uint32_t mpls[DECODE_MAX_LABELS];
+  uint8_t nlabels;
+  uint32_t tunnel;
+  uint32_t tunnel_id;
+  bool outer_v6;
+  uint8_t outer_src[16];
+  uint8_t outer_dst[16];
+  uint8_t outer_proto;
+  uint16_t outer_sport;
+  uint16_t outer_dport;
+  uint8_t src[16];
+  uint8_t dst[16];
+  uint8_t proto;
+  uint8_t ttl;
+  uint16_t ip_len;
+  bool fragment;
+  bool frag_v6;
+  uint8_t frag_src[16];
+  uint8_t frag_dst[16];
+  uint32_t frag_id;
+  uint32_t frag_hdr;
+  uint32_t frag_off;
+  bool frag_more;
+  uint8_t frag_proto;
+  uint32_t frag_data;
+  uint32_t frag_len;
+  uint32_t frag_layers;
+  uint32_t ip_off;
+  uint16_t reassembled;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t tcp_flags;
+  uint8_t icmp_type;
+  uint8_t icmp_code;
+  uint16_t dns_id;
+  bool dns_qr;
+  uint8_t dns_rcode;
+  uint16_t dns_qtype;
+  char dns_qname[DECODE_NAME_MAX];
+  uint8_t tls_type;
+  uint16_t tls_version;
+  uint8_t tls_hs;
+  char tls_sni[DECODE_NAME_MAX];
+  uint32_t payload_off;
+  uint32_t payload_len;
+};
+
+/* Fields a JSON record can have, in the order they are written. Besides the
+ * summary's fields, these take in the members every record had before there
+ * was any decoding, so that a -i list can pick from both. */
+enum decode_field {
+  DECODE_F_DEV,
+  DECODE_F_TS,
+  DECODE_F_CAPLEN,
+  DECODE_F_LEN,
+  DECODE_F_LINKTYPE,
+  DECODE_F_SRC_MAC,
+  DECODE_F_DST_MAC,
+  DECODE_F_ETHERTYPE,
+  DECODE_F_VLAN,
+  DECODE_F_MPLS,
+  DECODE_F_TUNNEL,
+  DECODE_F_TUNNEL_ID,
+  DECODE_F_OUTER_SRC,
+  DECODE_F_OUTER_DST,
+  DECODE_F_OUTER_PROTO,
+  DECODE_F_OUTER_SPORT,
+  DECODE_F_OUTER_DPORT,
+  DECODE_F_SRC,
+  DECODE_F_DST,
+  DECODE_F_PROTO,
+  DECODE_F_TTL,
+  DECODE_F_IP_LEN,
+  DECODE_F_FRAGMENT,
+  DECODE_F_REASSEMBLED,
+  DECODE_F_SPORT,
+  DECODE_F_DPORT,
+  DECODE_F_TCP_FLAGS,
+  DECODE_F_ICMP_TYPE,
+  DECODE_F_ICMP_CODE,
+  DECODE_F_DNS_ID,
+  DECODE_F_DNS_QR,
+  DECODE_F_DNS_RCODE,
+  DECODE_F_DNS_QTYPE,
+  DECODE_F_DNS_QNAME,
+  DECODE_F_TLS_TYPE,
+  DECODE_F_TLS_VERSION,
+  DECODE_F_TLS_HS,
+  DECODE_F_TLS_SNI,
+  DECODE_F_PAYLOAD_LEN,
+  DECODE_F_DATA,
+  DECODE_NFIELDS
+};
+
+#define DECODE_FIELD(f)    (1ULL << (f))
+#define DECODE_ALL_FIELDS  (DECODE_FIELD(DECODE_NFIELDS) - 1)
+
+/* What is known about each field, indexed by enum decode_field.
+ *
+ * name:  Name of the field in -i lists and JSON records
+ * layer: Layer that must have been found for the field to be written, or 0 if
+ *        it always is
+ * needs: Layers that must be decoded to fill the field in. Whatever carries
+ *        them is decoded as well.
+ */
+struct decode_field_info {
+  const char *name;
+  uint32_t layer;
+  uint32_t needs;
+};
+extern const struct decode_field_info decode_fields[DECODE_NFIELDS];
+
+/* A dissector. It decodes the layer starting at st->off, fills in its part of
+ * st->sum, and moves st->off past the layer. To have the next layer decoded,
+ * it points st->next at the table to look it up in, with st->key and, if
+ * the first finds nothing, st->alt_key. Return false if the layer is
+ * truncated or malformed, which ends decoding there. */
+struct decode_state;
+typedef bool (*decode_fn)(struct decode_state *st);
+
+/* Dispatch tables are small open-addressed hash tables from protocol numbers
+ * to dissectors, filled in once by decode_init(). */
+#define DECODE_TABLE_BITS 6
+#define DECODE_TABLE_SIZE (1 << DECODE_TABLE_BITS)
+
+struct decode_entry {
+  uint32_t key;
+  uint32_t layer;
+  decode_fn fn;
+};
+
+struct decode_table {
+  struct decode_entry slots[DECODE_TABLE_SIZE];
+};
+
+/* No alternative key to try */
+#define DECODE_NO_KEY UINT32_MAX
+
+/* A packet in the middle of being decoded.
+ *
+ * pkt:     The packet data
+ * caplen:  Number of bytes captured
+ * off:     Offset of the layer to decode next
+ * next:    Table to look the next layer up in, or NULL to stop
+ * key:     Key to look up in next
+ * alt_key: Key to try if key finds nothing, or DECODE_NO_KEY
+ * sum:     Summary being filled in
+ */
+struct decode_state {
+  const u_char *pkt;
+  uint32_t caplen;
+  uint32_t off;
+  const struct decode_table *next;
+  uint32_t key;
+  uint32_t alt_key;
+  struct decode_summary *sum;
+};
+
+/* The work decode_packet() does for the fields in options.fields.
+ *
+ * layers: Layers worth decoding. The dissector for any other layer is never
+ *         called, which ends decoding where it would have been.
+ */
+struct decode_plan {
+  uint32_t layers;
+};
+
+/* Parse a comma-separated -i list of field names into options.fields. The
+ * name "ts" stands for both the "sec" and "nsec" members. Return false if any
+ * name is unknown. */
+bool parse_fields(const char *arg);
+
+/* Fill in the dispatch tables and work out the decode plan for
+ * options.fields. Call once before decoding anything. */
+void decode_init(void);
+
+/* True if the plan decodes any of the given layers. */
+bool decode_wants(uint32_t layers);
+
+/* Decodes packets of one link type. Since the link type is fixed for as long
+ * as a handle or file is open, the entry point is picked once, by
+ * decode_select(), rather than looked up for every packet. Ethernet, Linux
+ * cooked v1 and v2 and raw IP get their own entry points, which go straight
+ * from the link layer to IPv4 or IPv6 before falling back on the tables.
+ *
+ * run:      Entry point for the link type
+ * linktype: DLT_* or LINKTYPE_* value of the packets
+ */
+struct decoder {
+  void (*run)(const struct decoder *d, const u_char *pkt, uint32_t caplen,
+              struct decode_summary *sum);
+  int linktype;
+};
+
+/* Pick the entry point for packets of the given link type. */
+void decode_select(struct decoder *d, int linktype);
+
+/* Decode a packet as far as the dissectors go, or as far as the plan says
+ * anything is wanted from, whichever is less.
+ *
+ * d:      Decoder for the packet's link type
+ * pkt:    The packet data
+ * caplen: Number of bytes captured
+ * sum:    Summary to fill in
+ */
+static inline void decode_packet(const struct decoder *d, const u_char *pkt,
+                                 uint32_t caplen, struct decode_summary *sum) {
+  sum->linktype = d->linktype;
+  d->run(d, pkt, caplen, sum);
+}
+
+/* Decode a datagram put back together from fragments, starting at its IP
+ * header. The layers that were found outside the fragments, according to
+ * sum->frag_layers, are kept; everything from IP up is decoded afresh.
+ *
+ * pkt: The datagram
+ * len: Its length
+ * sum: Summary of the fragment that completed the datagram
+ */
+void decode_datagram(const u_char *pkt, uint32_t len,
+                     struct decode_summary *sum);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * defrag.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <string.h>
+
+#include "defrag.h"
+
+/* Offset and length fields of the IP headers rebuilt */
+#define IPV4_LEN_OFF   2
+#define IPV4_FRAG_OFF  6
+#define IPV4_MAX_LEN   65535
+#define IPV6_HDRLEN    40
+#define IPV6_PLEN_OFF  4
+#define IPV6_NEXT_OFF  6
+
+/* What fill_hole() made of a fragment */
+enum fill {
+  FILL_OK,
+  FILL_OVERLAP,
+  FILL_TOO_MANY,
+};
+
+/* Other threads may sample the counters, so store them in one piece */
+static inline void bump(unsigned long long *counter) {
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static inline unsigned addr_len(bool v6) {
+  return v6 ? 16 : 4;
+}
+
+static unsigned bucket_of(const uint8_t *src, const uint8_t *dst,
+                          uint32_t id, uint8_t proto, bool v6) {
+  uint32_t h = id ^ (uint32_t)proto << 24;
+  unsigned i;
+
+  for(i = 0; i < addr_len(v6); ++i)
+    h = h * 31 + src[i] * 7 + dst[i];
+  return (h * 2654435761u) >> (32 - DEFRAG_BUCKET_BITS);
+}
+
+static bool same_datagram(const struct defrag_datagram *dg,
+                          const struct decode_summary *sum, bool v6) {
+  return dg->id == sum->frag_id && dg->proto == sum->frag_proto &&
+         dg->v6 == v6 && !memcmp(dg->src, sum->frag_src, addr_len(v6)) &&
+         !memcmp(dg->dst, sum->frag_dst, addr_len(v6));
+}
+
+static uint16_t find(struct defrag *df, const struct decode_summary *sum,
+                     bool v6, unsigned bucket) {
+  uint16_t i;
+  for(i = df->buckets[bucket]; i != DEFRAG_NONE; i = df->dgrams[i].next)
+    if(same_datagram(&df->dgrams[i], sum, v6))
+      return i;
+  return DEFRAG_NONE;
+}
+
+/* Give a datagram's blocks and slot back */
+static void release(struct defrag *df, uint16_t i) {
+  struct defrag_datagram *dg = &df->dgrams[i];
+  uint16_t *link;
+  unsigned b;
+
+  for(b = 0; b < DEFRAG_DGRAM_BLOCKS; ++b)
+    if(dg->blocks[b] != DEFRAG_NONE) {
+      df->free_blocks[df->nfree++] = dg->blocks[b];
+      dg->blocks[b] = DEFRAG_NONE;
+    }
+
+  link = &df->buckets[bucket_of(dg->src, dg->dst, dg->id, dg->proto,
+                                dg->v6)];
+  while(*link != i)
+    link = &df->dgrams[*link].next;
+  *link = dg->next;
+
+  if(dg->older != DEFRAG_NONE)
+    df->dgrams[dg->older].newer = dg->newer;
+  else
+    df->oldest = dg->newer;
+  if(dg->newer != DEFRAG_NONE)
+    df->dgrams[dg->newer].older = dg->older;
+  else
+    df->newest = dg->older;
+
+  dg->next = df->free_dgrams;
+  df->free_dgrams = i;
+}
+
+static void expire(struct defrag *df, long long now) {
+  while(df->oldest != DEFRAG_NONE &&
+        df->dgrams[df->oldest].first_ns + DEFRAG_TIMEOUT_NS < now) {
+    release(df, df->oldest);
+    bump(&df->stats.expired);
+  }
+}
+
+/* Start a datagram for the fragment in sum, evicting the oldest one if every
+ * slot is taken */
+static uint16_t start_datagram(struct defrag *df,
+                               const struct decode_summary *sum, bool v6,
+                               unsigned bucket, long long now) {
+  struct defrag_datagram *dg;
+  uint16_t i;
+
+  if(df->free_dgrams == DEFRAG_NONE) {
+    release(df, df->oldest);
+    bump(&df->stats.evicted);
+  }
+  i = df->free_dgrams;
+  dg = &df->dgrams[i];
+  df->free_dgrams = dg->next;
+
+  memcpy(dg->src, sum->frag_src, sizeof dg->src);
+  memcpy(dg->dst, sum->frag_dst, sizeof dg->dst);
+  dg->id = sum->frag_id;
+  dg->proto = sum->frag_proto;
+  dg->v6 = v6;
+  dg->first_ns = now;
+  dg->len = 0;
+  dg->hdrlen = 0;
+  dg->holes[0].first = 0;
+  dg->holes[0].last = DEFRAG_MAX_LEN - 1;
+  dg->nholes = 1;
+  dg->nfrags = 0;
+
+  dg->next = df->buckets[bucket];
+  df->buckets[bucket] = i;
+  dg->newer = DEFRAG_NONE;
+  dg->older = df->newest;
+  if(df->newest != DEFRAG_NONE)
+    df->dgrams[df->newest].newer = i;
+  else
+    df->oldest = i;
+  df->newest = i;
+  return i;
+}
+
+/* Take the bytes first through last out of the hole they fall in. They must
+ * fall entirely in one, or they overlap what's there already. The last
+ * fragment must fall in the hole that is still open at the end. */
+static enum fill fill_hole(struct defrag_datagram *dg, uint32_t first,
+                           uint32_t last, bool more) {
+  struct defrag_hole h;
+  unsigned i;
+
+  for(i = 0; i < dg->nholes; ++i)
+    if(first >= dg->holes[i].first && last <= dg->holes[i].last)
+      break;
+  if(i == dg->nholes)
+    return FILL_OVERLAP;
+  h = dg->holes[i];
+  if(!more && h.last != DEFRAG_MAX_LEN - 1)
+    return FILL_OVERLAP;
+
+  dg->holes[i] = dg->holes[--dg->nholes];
+  if(first > h.first) {
+    dg->holes[dg->nholes].first = h.first;
+    dg->holes[dg->nholes++].last = first - 1;
+  }
+  if(more && last < h.last) {
+    if(dg->nholes == DEFRAG_MAX_HOLES)
+      return FILL_TOO_MANY;
+    dg->holes[dg->nholes].first = last + 1;
+    dg->holes[dg->nholes++].last = h.last;
+  }
+  if(!more)
+    dg->len = last + 1;
+  return FILL_OK;
+}
+
+/* Copy fragment data into the datagram's blocks, evicting other datagrams
+ * if the pool runs dry. Return false if it still does. */
+static bool store(struct defrag *df, uint16_t i, uint32_t off,
+                  const u_char *data, uint32_t len) {
+  struct defrag_datagram *dg = &df->dgrams[i];
+  uint32_t b, n;
+
+  while(len) {
+    b = off / DEFRAG_BLOCK_SIZE;
+    if(dg->blocks[b] == DEFRAG_NONE) {
+      while(!df->nfree && df->oldest != i) {
+        release(df, df->oldest);
+        bump(&df->stats.evicted);
+      }
+      if(!df->nfree)
+        return false;
+      dg->blocks[b] = df->free_blocks[--df->nfree];
+    }
+    n = DEFRAG_BLOCK_SIZE - off % DEFRAG_BLOCK_SIZE;
+    if(n > len)
+      n = len;
+    memcpy(df->pool + (size_t)dg->blocks[b] * DEFRAG_BLOCK_SIZE +
+           off % DEFRAG_BLOCK_SIZE, data, n);
+    off += n;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* Keep the header of the first fragment to arrive, or better, of the one at
+ * offset 0. IPv6 gets its fixed header only, pointing at the payload. */
+static void keep_header(struct defrag_datagram *dg, const u_char *pkt,
+                        const struct decode_summary *sum) {
+  uint32_t len = dg->v6 ? IPV6_HDRLEN : sum->frag_data - sum->frag_hdr;
+
+  if((dg->hdrlen && sum->frag_off) || len > DEFRAG_MAX_HDRLEN)
+    return;
+  memcpy(dg->hdr, pkt + sum->frag_hdr, len);
+  dg->hdrlen = len;
+}
+
+/* Put the datagram together in df->out and return its length, or 0 if it's
+ * too long to be a datagram */
+static uint32_t rebuild(struct defrag *df, struct defrag_datagram *dg,
+                        uint8_t proto) {
+  u_char *p = df->out;
+  uint32_t off, n;
+
+  if(dg->v6 ? dg->len > 0xffff : dg->hdrlen + dg->len > IPV4_MAX_LEN)
+    return 0;
+
+  memcpy(p, dg->hdr, dg->hdrlen);
+  if(dg->v6) {
+    p[IPV6_PLEN_OFF] = dg->len >> 8;
+    p[IPV6_PLEN_OFF + 1] = dg->len & 0xff;
+    p[IPV6_NEXT_OFF] = proto;
+  } else {
+    p[IPV4_LEN_OFF] = (dg->hdrlen + dg->len) >> 8;
+    p[IPV4_LEN_OFF + 1] = (dg->hdrlen + dg->len) & 0xff;
+    p[IPV4_FRAG_OFF] = p[IPV4_FRAG_OFF + 1] = 0;
+  }
+
+  for(off = 0; off < dg->len; off += n) {
+    n = dg->len - off < DEFRAG_BLOCK_SIZE ? dg->len - off : DEFRAG_BLOCK_SIZE;
+    memcpy(p + dg->hdrlen + off,
+           df->pool + (size_t)dg->blocks[off / DEFRAG_BLOCK_SIZE] *
+           DEFRAG_BLOCK_SIZE, n);
+  }
+  return dg->hdrlen + dg->len;
+}
+
+void defrag_init(struct defrag *df) {
+  df->dgrams = malloc_or_die(DEFRAG_MAX_DATAGRAMS * sizeof *df->dgrams);
+  df->pool = malloc_or_die((size_t)DEFRAG_POOL_BLOCKS * DEFRAG_BLOCK_SIZE);
+  df->free_blocks = malloc_or_die(DEFRAG_POOL_BLOCKS *
+                                  sizeof *df->free_blocks);
+  df->out = malloc_or_die(DEFRAG_MAX_HDRLEN + DEFRAG_MAX_LEN);
+  memset(&df->stats, 0, sizeof df->stats);
+  defrag_reset(df);
+}
+
+void defrag_reset(struct defrag *df) {
+  unsigned i, b;
+
+  for(i = 0; i < DEFRAG_BUCKETS; ++i)
+    df->buckets[i] = DEFRAG_NONE;
+  for(i = 0; i < DEFRAG_MAX_DATAGRAMS; ++i) {
+    df->dgrams[i].next = i + 1 < DEFRAG_MAX_DATAGRAMS ? i + 1 : DEFRAG_NONE;
+    for(b = 0; b < DEFRAG_DGRAM_BLOCKS; ++b)
+      df->dgrams[i].blocks[b] = DEFRAG_NONE;
+  }
+  df->free_dgrams = 0;
+  df->oldest = df->newest = DEFRAG_NONE;
+  for(i = 0; i < DEFRAG_POOL_BLOCKS; ++i)
+    df->free_blocks[i] = i;
+  df->nfree = DEFRAG_POOL_BLOCKS;
+}
+
+bool defrag_packet(struct defrag *df, const u_char *pkt, uint32_t caplen,
+                   long long ts_ns, struct decode_summary *sum) {
+  struct defrag_datagram *dg;
+  bool v6 = sum->frag_v6;
+  uint32_t first = sum->frag_off, last = first + sum->frag_len - 1, len;
+  unsigned bucket;
+  uint16_t i;
+  enum fill fill;
+
+  bump(&df->stats.fragments);
+  expire(df, ts_ns);
+
+  /* Fragments cut short by the snaplen, empty, misaligned or reaching past
+   * any datagram are of no use */
+  if(!sum->frag_len || sum->frag_data + sum->frag_len > caplen ||
+     last >= DEFRAG_MAX_LEN || (sum->frag_more && sum->frag_len % 8)) {
+    bump(&df->stats.dropped);
+    return false;
+  }
+
+  bucket = bucket_of(sum->frag_src, sum->frag_dst, sum->frag_id,
+                     sum->frag_proto, v6);
+  i = find(df, sum, v6, bucket);
+  if(i == DEFRAG_NONE)
+    i = start_datagram(df, sum, v6, bucket, ts_ns);
+  dg = &df->dgrams[i];
+
+  fill = fill_hole(dg, first, last, sum->frag_more);
+  if(fill != FILL_OK || !store(df, i, first, pkt + sum->frag_data,
+                               sum->frag_len)) {
+    bump(fill == FILL_OVERLAP ? &df->stats.overlaps : &df->stats.dropped);
+    release(df, i);
+    return false;
+  }
+  keep_header(dg, pkt, sum);
+  ++dg->nfrags;
+  if(dg->nholes || !dg->hdrlen)
+    return false;
+
+  len = rebuild(df, dg, sum->frag_proto);
+  sum->reassembled = dg->nfrags;
+  release(df, i);
+  if(!len) {
+    bump(&df->stats.dropped);
+    return false;
+  }
+
+  decode_datagram(df->out, len, sum);
+  sum->layers |= DECODE_REASM;
+  bump(&df->stats.reassembled);
+  return true;
+}
+
+void defrag_free(struct defrag *df) {
+  free(df->dgrams);
+  free(df->pool);
+  free(df->free_blocks);
+  free(df->out);
+  df->dgrams = NULL;
+  df->pool = df->out = NULL;
+  df->free_blocks = NULL;
+}
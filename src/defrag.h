@@ -0,0 +1,184 @@
+/*
+ * defrag.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_DEFRAG_H
+#define PROTODUMP_DEFRAG_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "decode.h"
+
+/* Datagrams being put back together at once, per reassembler */
+#define DEFRAG_MAX_DATAGRAMS 64
+#define DEFRAG_BUCKET_BITS   7
+#define DEFRAG_BUCKETS       (1 << DEFRAG_BUCKET_BITS)
+
+/* Fragment data is kept in blocks from a fixed pool, which is all the memory
+ * a reassembler will ever hold on to: 2 MiB */
+#define DEFRAG_BLOCK_SIZE  2048
+#define DEFRAG_POOL_BLOCKS 1024
+
+/* Longest datagram payload, and the blocks it takes up */
+#define DEFRAG_MAX_LEN     65536
+#define DEFRAG_DGRAM_BLOCKS (DEFRAG_MAX_LEN / DEFRAG_BLOCK_SIZE)
+
+/* Longest IP header kept for the rebuilt datagram */
+#define DEFRAG_MAX_HDRLEN  60
+
+/* Gaps a datagram may have at once before it's given up on */
+#define DEFRAG_MAX_HOLES   16
+
+/* Datagrams not complete this long after their first fragment, going by
+ * packet timestamps, are dropped */
+#define DEFRAG_TIMEOUT_NS  (30 * 1000000000LL)
+
+/* Counters of what happened to fragments.
+ *
+ * fragments:   Fragments handed to the reassembler
+ * reassembled: Datagrams put back together
+ * expired:     Datagrams dropped after DEFRAG_TIMEOUT_NS
+ * evicted:     Datagrams dropped to make room for newer ones
+ * overlaps:    Datagrams dropped because fragments overlapped or disagreed
+ *              about where the datagram ends
+ * dropped:     Fragments that could not be used, or datagrams dropped for
+ *              being too long or too full of holes
+ */
+struct defrag_stats {
+  unsigned long long fragments;
+  unsigned long long reassembled;
+  unsigned long long expired;
+  unsigned long long evicted;
+  unsigned long long overlaps;
+  unsigned long long dropped;
+};
+
+/* A range of payload bytes not received yet, both ends inclusive */
+struct defrag_hole {
+  uint32_t first;
+  uint32_t last;
+};
+
+/* A datagram being put back together. Slots are linked by index, with
+ * DEFRAG_NONE for none.
+ *
+ * src, dst, id, proto, v6: What identifies the datagram
+ * first_ns:                Timestamp of its first fragment to arrive
+ * len:                     Payload length, or 0 until the last fragment
+ * hdr:                     IP header to put in front of the payload
+ * hdrlen:                  Length of hdr
+ * holes:                   Gaps left in the payload
+ * nholes:                  Number of gaps
+ * blocks:                  Pool block holding each part of the payload
+ * nfrags:                  Number of fragments taken in
+ * older, newer:            Neighbours in the age list
+ * next:                    Next slot in the same hash bucket, or in the
+ *                          free list
+ */
+struct defrag_datagram {
+  uint8_t src[16];
+  uint8_t dst[16];
+  uint32_t id;
+  uint8_t proto;
+  bool v6;
+  long long first_ns;
+  uint32_t len;
+  u_char hdr[DEFRAG_MAX_HDRLEN];
+  uint8_t hdrlen;
+  struct defrag_hole holes[DEFRAG_MAX_HOLES];
+  uint8_t nholes;
+  uint16_t blocks[DEFRAG_DGRAM_BLOCKS];
+  uint16_t nfrags;
+  uint16_t older, newer;
+  uint16_t next;
+};
+
+#define DEFRAG_NONE UINT16_MAX
+
+/* An IPv4 and IPv6 fragment reassembler. Everything it needs is allocated
+ * up front, so traffic can't make it grow: when slots or blocks run out, the
+ * oldest datagram is evicted. Holes are tracked per datagram as in RFC 815,
+ * and any overlap drops the datagram, as RFC 5722 has it for IPv6. Only one
+ * thread may use a reassembler; with several workers, the kernel's fanout
+ * hash sends all fragments of a datagram to the same one.
+ *
+ * dgrams:      Datagram slots
+ * buckets:     Hash table of datagrams in use
+ * free_dgrams: First unused slot
+ * oldest:      Oldest datagram in use
+ * newest:      Newest datagram in use
+ * pool:        Memory for the blocks
+ * free_blocks: Stack of unused blocks
+ * nfree:       Number of unused blocks
+ * out:         Space for the rebuilt datagram
+ * stats:       Counters, which other threads may read
+ */
+struct defrag {
+  struct defrag_datagram *dgrams;
+  uint16_t buckets[DEFRAG_BUCKETS];
+  uint16_t free_dgrams;
+  uint16_t oldest;
+  uint16_t newest;
+  u_char *pool;
+  uint16_t *free_blocks;
+  unsigned nfree;
+  u_char *out;
+  struct defrag_stats stats;
+};
+
+/* Allocate everything a reassembler will use. Die on failure. */
+void defrag_init(struct defrag *df);
+
+/* Drop every datagram in progress, keeping the counters. */
+void defrag_reset(struct defrag *df);
+
+/* Take in a fragment that decode_packet() found. If it completes its
+ * datagram, the datagram is decoded into sum in place of the fragment (see
+ * decode_datagram()).
+ *
+ * df:     Reassembler to use
+ * pkt:    The packet the fragment came in
+ * caplen: Number of bytes captured of it
+ * ts_ns:  Timestamp of the packet, in ns
+ * sum:    Summary of the packet, with DECODE_FRAG set
+ *
+ * Return true if sum now describes a whole datagram.
+ */
+bool defrag_packet(struct defrag *df, const u_char *pkt, uint32_t caplen,
+                   long long ts_ns, struct decode_summary *sum);
+
+/* Free a reassembler's memory. */
+void defrag_free(struct defrag *df);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * filter.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "filter.h"
+
+volatile sig_atomic_t filter_reload_requested;
+
+static void request_reload(int sig) {
+  filter_reload_requested = 1;
+}
+
+/* Read a whole filter file into a new string. Return NULL if it can't be
+ * read, with errno set. */
+static char *read_expr(const char *file) {
+  FILE *fp = fopen(file, "r");
+  char *expr = NULL;
+  size_t len = 0, cap = 0, n;
+
+  if(!fp)
+    return NULL;
+
+  do {
+    if(len + 1 >= cap) {
+      cap = cap ? 2 * cap : 256;
+      expr = realloc_or_die(expr, cap);
+    }
+    n = fread(&expr[len], 1, cap - len - 1, fp);
+    len += n;
+  } while(n);
+
+  /* Drop the trailing newline so the expression logs nicely */
+  while(len && isspace((unsigned char)expr[len - 1]))
+    --len;
+  expr[len] = '\0';
+
+  if(ferror(fp)) {
+    free(expr);
+    expr = NULL;
+  }
+  fclose(fp);
+  return expr;
+}
+
+/* Compile expr for the given link type. On failure, put pcap's complaint in
+ * errbuf and return false. */
+static bool compile(const char *expr, int linktype, struct bpf_program *prog,
+                    char *errbuf) {
+  pcap_t *dead = pcap_open_dead(linktype, options.snaplen);
+  bool ok;
+
+  if(!dead)
+    die(0, "pcap_open_dead(): Out of memory");
+
+  ok = !pcap_compile(dead, prog, expr, 1, PCAP_NETMASK_UNKNOWN);
+  if(!ok)
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(dead));
+
+  pcap_close(dead);
+  return ok;
+}
+
+void filter_init(struct filter *f, const char *spec) {
+  struct sigaction sa;
+
+  pthread_mutex_init(&f->lock, NULL);
+  f->spec = spec;
+  f->expr = NULL;
+  f->nprogs = 0;
+  f->gen = 0;
+
+  if(!spec)
+    return;
+
+  if(spec[0] == '@') {
+    f->expr = read_expr(&spec[1]);
+    if(!f->expr)
+      die(errno, "Reading filter from %s", &spec[1]);
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = request_reload;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGHUP, &sa, NULL))
+      die(errno, "sigaction()");
+  } else {
+    f->expr = malloc_or_die(strlen(spec) + 1);
+    strcpy(f->expr, spec);
+  }
+
+  f->gen = 1;
+  plog(1, "Filtering with: %s", f->expr);
+}
+
+/* Find or compile the program for linktype. Call with the lock held. */
+static struct bpf_program *lookup_program(struct filter *f, int linktype) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  struct filter_prog *fp;
+  int i;
+
+  for(i = 0; i < f->nprogs; ++i)
+    if(f->progs[i].linktype == linktype)
+      return &f->progs[i].prog;
+
+  if(f->nprogs == FILTER_MAX_PROGS)
+    die(0, "Too many different link types to filter");
+
+  fp = &f->progs[f->nprogs];
+  if(!compile(f->expr, linktype, &fp->prog, errbuf))
+    die(0, "Bad filter expression: %s", errbuf);
+  fp->linktype = linktype;
+  ++f->nprogs;
+
+  return &fp->prog;
+}
+
+const struct bpf_program *filter_program(struct filter *f, int linktype) {
+  const struct bpf_program *prog;
+
+  if(!f->spec)
+    return NULL;
+
+  pthread_mutex_lock(&f->lock);
+  prog = lookup_program(f, linktype);
+  pthread_mutex_unlock(&f->lock);
+
+  return prog;
+}
+
+/* Re-read the filter file and compile it for every link type in use. If
+ * anything goes wrong, complain and keep the old filter, since the capture
+ * is better off with it than with no filter at all. Call with the lock
+ * held. */
+static void reload(struct filter *f) {
+  struct filter_prog progs[FILTER_MAX_PROGS];
+  char errbuf[PCAP_ERRBUF_SIZE];
+  char *expr;
+  int i, j;
+
+  filter_reload_requested = 0;
+  expr = read_expr(&f->spec[1]);
+  if(!expr) {
+    plog(0, "Keeping the old filter: can't read %s: %s", &f->spec[1],
+         strerror(errno));
+    return;
+  }
+
+  for(i = 0; i < f->nprogs; ++i) {
+    progs[i].linktype = f->progs[i].linktype;
+    if(!compile(expr, progs[i].linktype, &progs[i].prog, errbuf)) {
+      plog(0, "Keeping the old filter: %s", errbuf);
+      for(j = 0; j < i; ++j)
+        pcap_freecode(&progs[j].prog);
+      free(expr);
+      return;
+    }
+  }
+
+  for(i = 0; i < f->nprogs; ++i) {
+    pcap_freecode(&f->progs[i].prog);
+    f->progs[i] = progs[i];
+  }
+  free(f->expr);
+  f->expr = expr;
+  __atomic_store_n(&f->gen, f->gen + 1, __ATOMIC_RELEASE);
+
+  plog(1, "Filtering with: %s", f->expr);
+}
+
+/* Cheap check for whether a handle on generation gen needs a new program */
+static bool stale(struct filter *f, unsigned gen) {
+  return f->spec && (filter_reload_requested
+                     || __atomic_load_n(&f->gen, __ATOMIC_ACQUIRE) != gen);
+}
+
+void filter_attach_pcap(struct filter *f, pcap_t *handle, unsigned *gen) {
+  if(!stale(f, *gen))
+    return;
+
+  pthread_mutex_lock(&f->lock);
+  if(filter_reload_requested)
+    reload(f);
+
+  if(*gen != f->gen) {
+    if(pcap_setfilter(handle, lookup_program(f, pcap_datalink(handle))))
+      die(0, "pcap_setfilter(): %s", pcap_geterr(handle));
+    *gen = f->gen;
+  }
+  pthread_mutex_unlock(&f->lock);
+}
+
+void filter_attach_tpacket(struct filter *f, struct tpacket *tp,
+                           unsigned *gen) {
+  if(!stale(f, *gen))
+    return;
+
+  pthread_mutex_lock(&f->lock);
+  if(filter_reload_requested)
+    reload(f);
+
+  if(*gen != f->gen) {
+    tpacket_set_filter(tp->fd, lookup_program(f, tp->linktype));
+    *gen = f->gen;
+  }
+  pthread_mutex_unlock(&f->lock);
+}
+
+void filter_free(struct filter *f) {
+  int i;
+
+  for(i = 0; i < f->nprogs; ++i)
+    pcap_freecode(&f->progs[i].prog);
+  free(f->expr);
+  f->expr = NULL;
+  f->nprogs = 0;
+  pthread_mutex_destroy(&f->lock);
+}
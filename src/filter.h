@@ -0,0 +1,115 @@
+/*
+ * filter.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_FILTER_H
+#define PROTODUMP_FILTER_H
+
+#include <ctype.h>
+#include <pcap/pcap.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "options.h"
+#include "tpacket.h"
+
+/* Most distinct link types a single capture is expected to filter */
+#define FILTER_MAX_PROGS 4
+
+/* A filter program compiled for one link type. */
+struct filter_prog {
+  int linktype;
+  struct bpf_program prog;
+};
+
+/* A capture filter shared by every handle of a capture. The expression is
+ * compiled once per link type and the same program is attached to each
+ * handle. If the expression came from a file, SIGHUP makes it be read and
+ * compiled again, and each capture thread swaps the new program into its
+ * handles the next time it calls one of the filter_attach functions, without
+ * reopening anything.
+ *
+ * lock:   Protects everything below
+ * spec:   The filter as given: an expression, or @FILE
+ * expr:   The current expression, or NULL if there is no filter
+ * progs:  Compiled programs for expr
+ * nprogs: Number of programs in progs
+ * gen:    Bumped each time expr changes
+ */
+struct filter {
+  pthread_mutex_t lock;
+  const char *spec;
+  char *expr;
+  struct filter_prog progs[FILTER_MAX_PROGS];
+  int nprogs;
+  unsigned gen;
+};
+
+/* Set by the SIGHUP handler installed by filter_init(). */
+extern volatile sig_atomic_t filter_reload_requested;
+
+/* Set up a filter. Die if the file can't be read.
+ *
+ * f:    Filter to initialize
+ * spec: A filter expression ala pcap-filter(7), or @FILE to read the
+ *       expression from FILE and re-read it on SIGHUP. If NULL, every
+ *       packet passes.
+ */
+void filter_init(struct filter *f, const char *spec);
+
+/* Return the program for packets of the given DLT_* link type, compiling it
+ * if this is the first time that link type is asked for. Die if the
+ * expression doesn't compile. Return NULL if there is no filter. The program
+ * stays valid until the next reload, which only ever happens inside the
+ * filter_attach functions. */
+const struct bpf_program *filter_program(struct filter *f, int linktype);
+
+/* Attach the filter to a pcap handle if the handle doesn't have the current
+ * program yet, first picking up a new expression if a reload was requested.
+ * This is cheap when nothing has changed, so capture loops can call it once
+ * per batch.
+ *
+ * f:      The filter
+ * handle: An activated handle owned by the calling thread
+ * gen:    The generation the handle's program came from; start at 0
+ */
+void filter_attach_pcap(struct filter *f, pcap_t *handle, unsigned *gen);
+
+/* Like filter_attach_pcap(), but for a tpacket ring. */
+void filter_attach_tpacket(struct filter *f, struct tpacket *tp,
+                           unsigned *gen);
+
+/* Free the compiled programs. */
+void filter_free(struct filter *f);
+
+#endif
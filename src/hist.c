@@ -0,0 +1,111 @@
+/*
+ * hist.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "hist.h"
+
+unsigned hist_index(uint64_t v) {
+  unsigned shift;
+
+  if(v < HIST_SUB)
+    return v;
+
+  shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + ((v >> shift) & (HIST_SUB - 1));
+}
+
+/* Return the largest value that falls into bucket idx */
+static uint64_t hist_bucket_top(unsigned idx) {
+  unsigned shift;
+
+  if(idx < HIST_SUB)
+    return idx;
+
+  shift = idx / HIST_SUB - 1;
+  return (((uint64_t)(HIST_SUB + idx % HIST_SUB) + 1) << shift) - 1;
+}
+
+void hist_init(struct hist *h) {
+  memset(h, 0, sizeof *h);
+  h->min = UINT64_MAX;
+}
+
+/* Only the owner writes a histogram, but others may merge it at any time,
+ * so each field is stored and loaded in one piece. On the platforms we care
+ * about these are plain moves. */
+#define HIST_STORE(field, val) __atomic_store_n(&(field), (val), __ATOMIC_RELAXED)
+#define HIST_LOAD(field)       __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+void hist_record(struct hist *h, uint64_t v) {
+  unsigned idx = hist_index(v);
+
+  HIST_STORE(h->buckets[idx], h->buckets[idx] + 1);
+  HIST_STORE(h->count, h->count + 1);
+  HIST_STORE(h->sum, h->sum + v);
+  if(v < h->min)
+    HIST_STORE(h->min, v);
+  if(v > h->max)
+    HIST_STORE(h->max, v);
+}
+
+void hist_merge(struct hist *dst, const struct hist *src) {
+  unsigned i;
+  uint64_t min = HIST_LOAD(src->min), max = HIST_LOAD(src->max);
+
+  for(i = 0; i < HIST_BUCKETS; ++i)
+    dst->buckets[i] += HIST_LOAD(src->buckets[i]);
+  dst->count += HIST_LOAD(src->count);
+  dst->sum += HIST_LOAD(src->sum);
+  if(min < dst->min)
+    dst->min = min;
+  if(max > dst->max)
+    dst->max = max;
+}
+
+uint64_t hist_percentile(const struct hist *h, double pct) {
+  uint64_t seen = 0, want;
+  unsigned i;
+
+  if(!h->count)
+    return 0;
+
+  want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+  if(want < 1)
+    want = 1;
+
+  for(i = 0; i < HIST_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if(seen >= want)
+      return hist_bucket_top(i) < h->max ? hist_bucket_top(i) : h->max;
+  }
+
+  return h->max;
+}
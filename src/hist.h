@@ -0,0 +1,87 @@
+/*
+ * hist.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_HIST_H
+#define PROTODUMP_HIST_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Values are bucketed by their highest set bit and the HIST_SUB_BITS bits
+ * below it, so each power of two is split into HIST_SUB linear buckets and
+ * every bucket is within about 6% of the values it holds. This covers the
+ * whole uint64_t range in a fixed, small amount of memory. */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* A log-bucketed histogram in the style of HdrHistogram.
+ *
+ * count:   Number of values recorded
+ * sum:     Sum of the values recorded
+ * min:     Smallest value recorded
+ * max:     Largest value recorded
+ * buckets: Number of values in each bucket
+ */
+struct hist {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Return the bucket v falls into, below HIST_BUCKETS. Buckets are in
+ * increasing order of the values they hold. */
+unsigned hist_index(uint64_t v);
+
+/* Empty a histogram. */
+void hist_init(struct hist *h);
+
+/* Record a value. Only one thread may record into a histogram, but other
+ * threads may merge it into theirs meanwhile. */
+void hist_record(struct hist *h, uint64_t v);
+
+/* Add all values recorded in src to dst. If src is being recorded into at
+ * the same time, the result is a close snapshot rather than an exact one. */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/* Return an estimate of the value below which the given percentage of the
+ * recorded values lie, or 0 if nothing was recorded.
+ *
+ * h:   Histogram to query
+ * pct: Percentile, between 0 and 100
+ */
+uint64_t hist_percentile(const struct hist *h, double pct);
+
+#endif
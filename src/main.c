@@ -35,27 +35,12 @@
 
 #include "arg.h"
 #include "capture.h"
+#include "capwriter.h"
 #include "common.h"
+#include "decode.h"
 #include "netutil.h"
 #include "options.h"
-
-/* Option defaults */
-struct options options = {
-  .action = 0,
-  .dev = NULL,
-  .capwrite = NULL,
-  .capread = NULL,
-  .jsonfile = NULL,
-  .verbose = false,
-  .rfmon = false,
-  .promisc = false,
-  .snaplen = 65536,
-  .read_timeout = 100,
-  .buffer_size = 0,
-  .tstamp_type = PCAP_ERROR,
-  .tstamp_nano = false,
-  .linktype = PCAP_ERROR,
-};
+#include "replay.h"
 
 enum acttypes {
   ACT_NONE,
@@ -63,7 +48,12 @@ enum acttypes {
   ACT_ERR,
   ACT_VERBOSE,
   ACT_DEV,
+  ACT_ALLDEVS,
+  ACT_FILTER,
+  ACT_STATSFILE,
+  ACT_STATSINTERVAL,
   ACT_CAPWRITE,
+  ACT_ROTATE,
   ACT_CAPREAD,
   ACT_JSON,
   ACT_PROMISC,
@@ -74,9 +64,17 @@ enum acttypes {
   ACT_TIMESTAMP,
   ACT_NANORES,
   ACT_LINKTYPE,
+  ACT_BATCH,
+  ACT_BACKEND,
+  ACT_TIMESTART,
+  ACT_TIMEEND,
+  ACT_PACE,
+  ACT_TUNE,
+  ACT_FIELDS,
   ACT_INFO,
   ACT_CAPTURE,
   ACT_REPLAY,
+  ACT_INDEX,
 };
 
 /* Flags come in two types: modes and options. Only one mode flag may be
@@ -86,6 +84,8 @@ enum acttypes {
  * name:           The flag letter
  * description:    Short description that appears in the usage
  * arg:            Argument type from arg.h for syntax checking
+ * optional_arg:   If true, the argument may be left out. When given, it must
+ *                 directly follow the flag letter (e.g. -C4).
  * mode:           Should be true if this is a mode, false otherwise
  * mode_blacklist: Options incompatible with this mode
  * action:         Value for the switch statements in main
@@ -96,47 +96,98 @@ struct flag flaglist[] = {
     .description = "Print information about available devices",
     .arg = ARG_NONE,
     .mode = true,
-    .mode_blacklist = "bjlnprstuw",
+    .mode_blacklist = "abcefgijklnopqrstuwxyz",
     .action = ACT_INFO
   },
   { .name = 'C',
-    .description = "Capture packets",
-    .arg = ARG_NONE,
+    .description = "Capture packets, optionally with the given number of workers",
+    .arg = ARG_POSINTEGER,
+    .optional_arg = true,
     .mode = true,
-    .mode_blacklist = NULL,
+    .mode_blacklist = "x",
     .action = ACT_CAPTURE
   },
   { .name = 'R',
     .description = "Replay packets",
     .arg = ARG_NONE,
     .mode = true,
-    .mode_blacklist = NULL,
+    .mode_blacklist = "aefgilmnoqstuwyz",
     .action = ACT_REPLAY
   },
+  { .name = 'X',
+    .description = "Build a time index for the -r file, sampling every n packets (def. 1024)",
+    .arg = ARG_POSINTEGER,
+    .optional_arg = true,
+    .mode = true,
+    .mode_blacklist = "abcdefgijklmnopqstuwxyz",
+    .action = ACT_INDEX
+  },
+  { .name = 'a',
+    .description = "When reading a file, skip packets before this time",
+    .arg = ARG_TIME,
+    .mode = false,
+    .action = ACT_TIMESTART
+  },
   { .name = 'b',
     .description = "Try to set the size of pcap's packet buffer",
     .arg = ARG_POSINTEGER,
     .mode = false,
     .action = ACT_BUFSIZE
   },
+  { .name = 'c',
+    .description = "Number of packets to handle per batch (def. 64)",
+    .arg = ARG_POSINTEGER,
+    .mode = false,
+    .action = ACT_BATCH
+  },
   { .name = 'd',
     .description = "Specify the device to capture/replay on by regex",
     .arg = ARG_REGEX,
     .mode = false,
     .action = ACT_DEV
   },
+  { .name = 'e',
+    .description = "When reading a file, stop at packets after this time",
+    .arg = ARG_TIME,
+    .mode = false,
+    .action = ACT_TIMEEND
+  },
+  { .name = 'f',
+    .description = "Filter ala pcap-filter(7), or @FILE to read it from FILE (again on SIGHUP)",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_FILTER
+  },
+  { .name = 'g',
+    .description = "Capture on every device matching -d, merged by timestamp",
+    .arg = ARG_NONE,
+    .mode = false,
+    .action = ACT_ALLDEVS
+  },
   { .name = 'h',
     .description = "Print this message",
     .arg = ARG_NONE,
     .mode = false,
     .action = ACT_HELP
   },
+  { .name = 'i',
+    .description = "JSON fields to write, e.g. ts,src,dst,proto,len (def. all)",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_FIELDS
+  },
   { .name = 'j',
     .description = "Specify JSON file to use instead of stdin/stdout",
     .arg = ARG_STRING,
     .mode = false,
     .action = ACT_JSON
   },
+  { .name = 'k',
+    .description = "Backend to use: pcap or tpacket (def. pcap for -C, tpacket for -R)",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_BACKEND
+  },
   { .name = 'l',
     .description = "Tell pcap which link type to use, ala pcap-linktype(7)",
     .arg = ARG_STRING,
@@ -155,12 +206,24 @@ struct flag flaglist[] = {
     .mode = false,
     .action = ACT_NANORES
   },
+  { .name = 'o',
+    .description = "Append capture statistics as JSON lines to this file",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_STATSFILE
+  },
   { .name = 'p',
     .description = "Try to put the interface into promiscuous mode",
     .arg = ARG_NONE,
     .mode = false,
     .action = ACT_PROMISC
   },
+  { .name = 'q',
+    .description = "Seconds between statistics lines; SIGUSR1 forces one (def. 10)",
+    .arg = ARG_POSINTEGER,
+    .mode = false,
+    .action = ACT_STATSINTERVAL
+  },
   { .name = 'r',
     .description = "Pcap capture file to capture / replay from",
     .arg = ARG_STRING,
@@ -192,13 +255,60 @@ struct flag flaglist[] = {
     .action = ACT_VERBOSE
   },
   { .name = 'w',
-    .description = "Pcap capture file to capture / replay to",
+    .description = "Write packets to this pcap (or *.pcapng) file, and JSON only if -j is given",
     .arg = ARG_STRING,
     .mode = false,
     .action = ACT_CAPWRITE
   },
+  { .name = 'x',
+    .description = "Pace replay: Nx original speed, N[kMG]pps or N[kMG]bps",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_PACE
+  },
+  { .name = 'y',
+    .description = "Tunables: adaptive (resize on drops), latency (busy-poll, spin),\n"
+                   "\t\turing (write via io_uring), direct (O_DIRECT for -w)",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_TUNE
+  },
+  { .name = 'z',
+    .description = "Rotate -w files at SIZE[kMG] bytes and/or SECS seconds: SIZE[,SECS]",
+    .arg = ARG_STRING,
+    .mode = false,
+    .action = ACT_ROTATE
+  },
 };
 
+/* Parse a comma-separated list of tunables into options.tune. Return false
+ * if any of them is unknown. */
+static bool parse_tunables(const char *arg) {
+  static const struct { const char *name; unsigned bit; } tunables[] = {
+    { "adaptive", TUNE_ADAPTIVE },
+    { "latency", TUNE_LATENCY },
+    { "uring", TUNE_URING },
+    { "direct", TUNE_DIRECT },
+  };
+  size_t len, i;
+
+  while(*arg) {
+    len = strcspn(arg, ",");
+    for(i = 0; i < sizeof tunables / sizeof *tunables; ++i)
+      if(strlen(tunables[i].name) == len && !strncmp(arg, tunables[i].name, len))
+        break;
+    if(i == sizeof tunables / sizeof *tunables)
+      return false;
+
+    options.tune |= tunables[i].bit;
+    arg += len;
+    if(*arg)
+      ++arg;
+  }
+
+  return true;
+}
+
 int main(int argc, char **argv) {
   char *arg = NULL, *optstr = make_optstr(flaglist, FLAGCOUNT);
   int a;
@@ -225,15 +335,33 @@ int main(int argc, char **argv) {
       case ACT_DEV:
         options.dev = arg;
         break;
+      case ACT_ALLDEVS:
+        options.all_devs = true;
+        break;
+      case ACT_FILTER:
+        filter = arg;
+        break;
       case ACT_CAPWRITE:
         options.capwrite = arg;
         break;
+      case ACT_ROTATE:
+        if(!parse_rotate(arg))
+          die(0, "Not a valid rotation spec: %s", arg);
+        break;
       case ACT_CAPREAD:
         options.capread = arg;
         break;
       case ACT_JSON:
         options.jsonfile = arg;
         break;
+      case ACT_STATSFILE:
+        options.statsfile = arg;
+        break;
+      case ACT_STATSINTERVAL:
+        options.stats_interval = (int)strtoul(arg, NULL, 0);
+        if(options.stats_interval < 1)
+          die(0, "Statistics interval must be at least 1");
+        break;
       case ACT_PROMISC:
         ++options.promisc;
         break;
@@ -262,10 +390,54 @@ int main(int argc, char **argv) {
         if(options.linktype == PCAP_ERROR)
           die(0, "Not a valid pcap linktype: %s\nSee pcap-linktype(7)", arg);
         break;
+      case ACT_BATCH:
+        options.batch = (int)strtoul(arg, NULL, 0);
+        if(options.batch < 1)
+          die(0, "Batch size must be at least 1");
+        break;
+      case ACT_BACKEND:
+        if(!strcmp(arg, "pcap"))
+          options.backend = BACKEND_PCAP;
+        else if(!strcmp(arg, "tpacket"))
+          options.backend = BACKEND_TPACKET;
+        else
+          die(0, "Not a valid capture backend: %s", arg);
+        break;
+      case ACT_TIMESTART:
+        options.time_start = time_arg_to_ns(arg);
+        break;
+      case ACT_TIMEEND:
+        options.time_end = time_arg_to_ns(arg);
+        break;
+      case ACT_PACE:
+        if(!parse_pace(arg))
+          die(0, "Not a valid pacing spec: %s", arg);
+        break;
+      case ACT_TUNE:
+        if(!parse_tunables(arg))
+          die(0, "Not a valid list of tunables: %s", arg);
+        break;
+      case ACT_FIELDS:
+        if(!parse_fields(arg))
+          die(0, "Not a valid list of fields: %s", arg);
+        break;
 
       /* Pass modes on to the next switch */
+      case ACT_CAPTURE:
+        if(arg)
+          options.workers = (int)strtoul(arg, NULL, 0);
+        if(options.workers < 1)
+          die(0, "Worker count must be at least 1");
+        options.action = a;
+        break;
+      case ACT_INDEX:
+        if(arg)
+          options.index_interval = strtoul(arg, NULL, 0);
+        if(options.index_interval < 1)
+          die(0, "Index interval must be at least 1");
+        options.action = a;
+        break;
       case ACT_INFO:
-      case ACT_CAPTURE: /* Fallthrough */
       case ACT_REPLAY:  /* Fallthrough */
         options.action = a;
         break;
@@ -277,13 +449,26 @@ int main(int argc, char **argv) {
       dev_info(options.dev);
       break;
     case ACT_CAPTURE:
+      if((options.rotate_size || options.rotate_secs) && !options.capwrite)
+        die(0, "-z needs a file to write to, given with -w");
+      decode_init();
       if(options.capread)
         capture_from_file(filter, options.capread);
       else
         capture_live(filter);
       break;
     case ACT_REPLAY:
-      die(0, "Replay not yet implemented");
+      if(options.capread)
+        replay(options.capread);
+      else if(options.jsonfile)
+        replay_json(options.jsonfile);
+      else
+        die(0, "-R needs a capture file (-r) or JSON file (-j) to replay");
+      break;
+    case ACT_INDEX:
+      if(!options.capread)
+        die(0, "-X needs a capture file to be given with -r");
+      pcapfile_write_index(options.capread, options.index_interval);
       break;
     default:
       print_flag_usage(stderr, flaglist, FLAGCOUNT);
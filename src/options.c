@@ -0,0 +1,70 @@
+/*
+ * options.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <limits.h>
+#include <pcap/pcap.h>
+
+#include "decode.h"
+#include "options.h"
+
+/* Option defaults */
+struct options options = {
+  .action = 0,
+  .dev = NULL,
+  .all_devs = false,
+  .capwrite = NULL,
+  .rotate_size = 0,
+  .rotate_secs = 0,
+  .capread = NULL,
+  .jsonfile = NULL,
+  .statsfile = NULL,
+  .stats_interval = 10,
+  .verbose = false,
+  .rfmon = false,
+  .promisc = false,
+  .snaplen = 65536,
+  .read_timeout = 100,
+  .buffer_size = 0,
+  .tstamp_type = PCAP_ERROR,
+  .tstamp_nano = false,
+  .linktype = PCAP_ERROR,
+  .batch = 64,
+  .backend = BACKEND_DEFAULT,
+  .workers = 1,
+  .index_interval = 1024,
+  .time_start = 0,
+  .time_end = LLONG_MAX,
+  .pace = PACE_NONE,
+  .pace_value = 0,
+  .tune = 0,
+  .fields = DECODE_ALL_FIELDS,
+};
@@ -35,12 +35,37 @@
 
 #include <stdbool.h>
 
+enum backend {
+  BACKEND_DEFAULT,
+  BACKEND_PCAP,
+  BACKEND_TPACKET,
+};
+
+enum pace {
+  PACE_NONE,
+  PACE_SPEED,
+  PACE_PPS,
+  PACE_BPS,
+};
+
+enum tune {
+  TUNE_ADAPTIVE = 1 << 0,
+  TUNE_LATENCY  = 1 << 1,
+  TUNE_URING    = 1 << 2,
+  TUNE_DIRECT   = 1 << 3,
+};
+
 struct options {
   int action;
   char *dev;
+  bool all_devs;
   char *capwrite;
+  long long rotate_size;
+  int rotate_secs;
   char *capread;
   char *jsonfile;
+  char *statsfile;
+  int stats_interval;
   int verbose;
   bool rfmon;
   bool promisc;
@@ -50,6 +75,16 @@ struct options {
   int tstamp_type;
   bool tstamp_nano;
   int linktype;
+  int batch;
+  int backend;
+  int workers;
+  unsigned index_interval;
+  long long time_start;
+  long long time_end;
+  int pace;
+  double pace_value;
+  unsigned tune;
+  unsigned long long fields;
 };
 extern struct options options;
 
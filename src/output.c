@@ -0,0 +1,343 @@
+/*
+ * output.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <arpa/inet.h>
+
+#include "output.h"
+
+#define JSONW_INITIAL_CAP (1 << 16)
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static void jsonw_reserve(struct jsonw *w, size_t need) {
+  if(w->len + need <= w->cap)
+    return;
+
+  while(w->len + need > w->cap)
+    w->cap *= 2;
+  w->buf = realloc_or_die(w->buf, w->cap);
+}
+
+/* Append len bytes to the buffer, which must have room for them */
+static inline void put(struct jsonw *w, const char *s, size_t len) {
+  memcpy(&w->buf[w->len], s, len);
+  w->len += len;
+}
+
+#define PUT_LITERAL(w, s) put(w, s, sizeof s - 1)
+
+static void put_uint(struct jsonw *w, unsigned long long n) {
+  char digits[20];
+  size_t i = sizeof digits;
+
+  jsonw_reserve(w, sizeof digits + 1);
+  do {
+    digits[--i] = (char)('0' + n % 10);
+    n /= 10;
+  } while(n);
+  put(w, &digits[i], sizeof digits - i);
+}
+
+static void put_int(struct jsonw *w, long long n) {
+  if(n < 0) {
+    jsonw_reserve(w, 1);
+    w->buf[w->len++] = '-';
+    put_uint(w, -(unsigned long long)n);
+  } else {
+    put_uint(w, n);
+  }
+}
+
+/* Write s as a JSON string. Bytes outside printable ASCII are escaped as the
+ * code point of the same value, so any byte string comes out valid. */
+static void put_string(struct jsonw *w, const char *s) {
+  jsonw_reserve(w, 6 * strlen(s) + 2);
+  w->buf[w->len++] = '"';
+  for(; *s; ++s) {
+    unsigned char c = *s;
+    if(c == '"' || c == '\\') {
+      w->buf[w->len++] = '\\';
+      w->buf[w->len++] = c;
+    } else if(c >= 0x20 && c < 0x7f) {
+      w->buf[w->len++] = c;
+    } else {
+      put(w, "\\u00", 4);
+      w->buf[w->len++] = hexdigits[c >> 4];
+      w->buf[w->len++] = hexdigits[c & 0xf];
+    }
+  }
+  w->buf[w->len++] = '"';
+}
+
+static void put_hex(struct jsonw *w, const u_char *bytes, size_t len,
+                    char sep) {
+  size_t i;
+
+  jsonw_reserve(w, 3 * len + 2);
+  w->buf[w->len++] = '"';
+  for(i = 0; i < len; ++i) {
+    if(sep && i)
+      w->buf[w->len++] = sep;
+    w->buf[w->len++] = hexdigits[bytes[i] >> 4];
+    w->buf[w->len++] = hexdigits[bytes[i] & 0xf];
+  }
+  w->buf[w->len++] = '"';
+}
+
+/* Start a member, with a comma unless it is the first in the record */
+static void put_key(struct jsonw *w, const char *key) {
+  size_t len = strlen(key);
+
+  jsonw_reserve(w, len + 4);
+  if(w->buf[w->len - 1] != '{')
+    w->buf[w->len++] = ',';
+  w->buf[w->len++] = '"';
+  put(w, key, len);
+  PUT_LITERAL(w, "\":");
+}
+
+static void put_addr(struct jsonw *w, bool v6, const uint8_t *addr) {
+  char str[INET6_ADDRSTRLEN];
+
+  inet_ntop(v6 ? AF_INET6 : AF_INET, addr, str, sizeof str);
+  put_string(w, str);
+}
+
+static void put_array(struct jsonw *w, const void *vals, size_t size,
+                      unsigned n) {
+  unsigned i;
+
+  jsonw_reserve(w, 1);
+  w->buf[w->len++] = '[';
+  for(i = 0; i < n; ++i) {
+    if(i) {
+      jsonw_reserve(w, 1);
+      w->buf[w->len++] = ',';
+    }
+    if(size == sizeof(uint16_t))
+      put_uint(w, ((const uint16_t *)vals)[i]);
+    else
+      put_uint(w, ((const uint32_t *)vals)[i]);
+  }
+  jsonw_reserve(w, 1);
+  w->buf[w->len++] = ']';
+}
+
+static const char *tunnel_name(uint32_t layer) {
+  switch(layer) {
+    case DECODE_GRE:    return "gre";
+    case DECODE_VXLAN:  return "vxlan";
+    case DECODE_GENEVE: return "geneve";
+    case DECODE_IPIP:   return "ipip";
+    default:            return "";
+  }
+}
+
+static void put_field(struct jsonw *w, const struct decode_summary *sum,
+                      enum decode_field f) {
+  put_key(w, decode_fields[f].name);
+  switch(f) {
+    case DECODE_F_LINKTYPE:
+      put_uint(w, pcapfile_linktype(sum->linktype));
+      break;
+    case DECODE_F_SRC_MAC:
+      put_hex(w, sum->src_mac, sum->addr_len, ':');
+      break;
+    case DECODE_F_DST_MAC:     put_hex(w, sum->dst_mac, 6, ':');   break;
+    case DECODE_F_ETHERTYPE:   put_uint(w, sum->ethertype);        break;
+    case DECODE_F_VLAN:
+      put_array(w, sum->vlan, sizeof *sum->vlan, sum->nvlans);
+      break;
+    case DECODE_F_MPLS:
+      put_array(w, sum->mpls, sizeof *sum->mpls, sum->nlabels);
+      break;
+    case DECODE_F_TUNNEL:      put_string(w, tunnel_name(sum->tunnel)); break;
+    case DECODE_F_TUNNEL_ID:   put_uint(w, sum->tunnel_id);        break;
+    case DECODE_F_OUTER_SRC:
+      put_addr(w, sum->outer_v6, sum->outer_src);
+      break;
+    case DECODE_F_OUTER_DST:
+      put_addr(w, sum->outer_v6, sum->outer_dst);
+      break;
+    case DECODE_F_OUTER_PROTO: put_uint(w, sum->outer_proto);      break;
+    case DECODE_F_OUTER_SPORT: put_uint(w, sum->outer_sport);      break;
+    case DECODE_F_OUTER_DPORT: put_uint(w, sum->outer_dport);      break;
+    case DECODE_F_SRC:
+      put_addr(w, sum->layers & DECODE_IPV6, sum->src);
+      break;
+    case DECODE_F_DST:
+      put_addr(w, sum->layers & DECODE_IPV6, sum->dst);
+      break;
+    case DECODE_F_PROTO:       put_uint(w, sum->proto);            break;
+    case DECODE_F_TTL:         put_uint(w, sum->ttl);              break;
+    case DECODE_F_IP_LEN:      put_uint(w, sum->ip_len);           break;
+    case DECODE_F_REASSEMBLED: put_uint(w, sum->reassembled);      break;
+    case DECODE_F_SPORT:       put_uint(w, sum->sport);            break;
+    case DECODE_F_DPORT:       put_uint(w, sum->dport);            break;
+    case DECODE_F_TCP_FLAGS:   put_uint(w, sum->tcp_flags);        break;
+    case DECODE_F_ICMP_TYPE:   put_uint(w, sum->icmp_type);        break;
+    case DECODE_F_ICMP_CODE:   put_uint(w, sum->icmp_code);        break;
+    case DECODE_F_DNS_ID:      put_uint(w, sum->dns_id);           break;
+    case DECODE_F_DNS_RCODE:   put_uint(w, sum->dns_rcode);        break;
+    case DECODE_F_DNS_QTYPE:   put_uint(w, sum->dns_qtype);        break;
+    case DECODE_F_DNS_QNAME:   put_string(w, sum->dns_qname);      break;
+    case DECODE_F_TLS_TYPE:    put_uint(w, sum->tls_type);         break;
+    case DECODE_F_TLS_VERSION: put_uint(w, sum->tls_version);      break;
+    case DECODE_F_TLS_HS:      put_uint(w, sum->tls_hs);           break;
+    case DECODE_F_TLS_SNI:     put_string(w, sum->tls_sni);        break;
+    case DECODE_F_PAYLOAD_LEN: put_uint(w, sum->payload_len);      break;
+    case DECODE_F_FRAGMENT:
+    case DECODE_F_DNS_QR: {
+      bool b = f == DECODE_F_FRAGMENT ? sum->fragment : sum->dns_qr;
+      jsonw_reserve(w, 5);
+      if(b)
+        PUT_LITERAL(w, "true");
+      else
+        PUT_LITERAL(w, "false");
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static void jsonw_init(struct jsonw *w, FILE *fp, bool owns_fp,
+                       struct sink *sink, bool nano) {
+  w->fp = fp;
+  w->owns_fp = owns_fp;
+  w->sink = sink;
+  w->owns_sink = false;
+  w->cap = JSONW_INITIAL_CAP;
+  w->buf = malloc_or_die(w->cap);
+  w->len = 0;
+  w->nano = nano;
+  w->records = 0;
+}
+
+void jsonw_open(struct jsonw *w, const char *filename, bool nano) {
+  FILE *fp = filename ? fopen_or_die(filename, "w") : stdout;
+
+  jsonw_init(w, fp, fp != stdout, NULL, nano);
+
+  /* The sink writes the fd directly, so nothing may be left in fp's buffer */
+  if(options.tune & TUNE_URING) {
+    if(fflush(fp))
+      die(errno, "fflush()");
+    w->sink = malloc_or_die(sizeof *w->sink);
+    w->owns_sink = true;
+    sink_open_fd(w->sink, fileno(fp), SINK_URING);
+  }
+}
+
+void jsonw_attach(struct jsonw *w, const struct jsonw *parent) {
+  jsonw_init(w, parent->fp, false, parent->sink, parent->nano);
+}
+
+void jsonw_packet(struct jsonw *w, const struct pcap_pkthdr *hdr,
+                  const u_char *bytes, const struct decode_summary *sum) {
+  jsonw_packet_dev(w, NULL, hdr, bytes, sum);
+}
+
+void jsonw_packet_dev(struct jsonw *w, const char *dev,
+                      const struct pcap_pkthdr *hdr, const u_char *bytes,
+                      const struct decode_summary *sum) {
+  unsigned long long fields = options.fields;
+  long nsec = w->nano ? hdr->ts.tv_usec : hdr->ts.tv_usec * 1000L;
+  unsigned f;
+
+  jsonw_reserve(w, 1);
+  w->buf[w->len++] = '{';
+  if(dev && fields & DECODE_FIELD(DECODE_F_DEV)) {
+    put_key(w, "dev");
+    put_string(w, dev);
+  }
+  if(fields & DECODE_FIELD(DECODE_F_TS)) {
+    put_key(w, "sec");
+    put_int(w, hdr->ts.tv_sec);
+    put_key(w, "nsec");
+    put_int(w, nsec);
+  }
+  if(fields & DECODE_FIELD(DECODE_F_CAPLEN)) {
+    put_key(w, "caplen");
+    put_uint(w, hdr->caplen);
+  }
+  if(fields & DECODE_FIELD(DECODE_F_LEN)) {
+    put_key(w, "len");
+    put_uint(w, hdr->len);
+  }
+
+  if(sum)
+    for(f = DECODE_F_LINKTYPE; f <= DECODE_F_PAYLOAD_LEN; ++f)
+      if(fields & DECODE_FIELD(f) &&
+         (!decode_fields[f].layer || sum->layers & decode_fields[f].layer))
+        put_field(w, sum, f);
+
+  if(fields & DECODE_FIELD(DECODE_F_DATA)) {
+    put_key(w, "data");
+    put_hex(w, bytes, hdr->caplen, 0);
+  }
+  jsonw_reserve(w, 2);
+  put(w, "}\n", 2);
+  /* Other threads may sample the count, so store it in one piece */
+  __atomic_store_n(&w->records, w->records + 1, __ATOMIC_RELAXED);
+}
+
+void jsonw_flush(struct jsonw *w) {
+  if(!w->len)
+    return;
+
+  if(w->sink)
+    sink_write(w->sink, w->buf, w->len);
+  else {
+    errno = 0;
+    if(fwrite(w->buf, 1, w->len, w->fp) != w->len)
+      die(errno, "fwrite()");
+    if(fflush(w->fp))
+      die(errno, "fflush()");
+  }
+
+  w->len = 0;
+}
+
+void jsonw_close(struct jsonw *w) {
+  jsonw_flush(w);
+
+  if(w->owns_sink) {
+    sink_close(w->sink);
+    free(w->sink);
+  }
+  if(w->owns_fp)
+    fclose(w->fp);
+
+  free(w->buf);
+  w->buf = NULL;
+}
@@ -0,0 +1,120 @@
+/*
+ * output.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_OUTPUT_H
+#define PROTODUMP_OUTPUT_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "decode.h"
+#include "options.h"
+#include "sink.h"
+
+/* A JSON record writer. Records are emitted one JSON object per line into an
+ * in-memory buffer, which is written out in one go by jsonw_flush(). Callers
+ * are expected to flush once per batch of packets rather than per packet.
+ * With TUNE_URING in options.tune, flushing only copies the buffer into a
+ * sink, whose thread writes it out through io_uring (see sink.h).
+ * Records are formatted straight into the buffer, without building a tree of
+ * JSON nodes, so that nothing is allocated per packet.
+ *
+ * fp:        Stream the records are written to
+ * buf:       Pending output that has not been flushed yet
+ * len:       Number of bytes used in buf
+ * cap:       Allocated size of buf
+ * nano:      True if timestamps handed to the writer have ns resolution
+ * records:   Number of records written so far
+ * owns_fp:   False if fp belongs to another writer (see jsonw_attach())
+ * sink:      Sink that takes flushed records instead of fp, or NULL
+ * owns_sink: False if sink belongs to another writer
+ */
+struct jsonw {
+  FILE *fp;
+  bool owns_fp;
+  struct sink *sink;
+  bool owns_sink;
+  char *buf;
+  size_t len;
+  size_t cap;
+  bool nano;
+  unsigned long records;
+};
+
+/* Open a JSON record writer.
+ *
+ * w:        Writer to initialize
+ * filename: File to write to. If NULL, write to stdout.
+ * nano:     True if packet timestamps will have ns rather than us resolution
+ */
+void jsonw_open(struct jsonw *w, const char *filename, bool nano);
+
+/* Set up a writer that shares the stream of an already open writer but has
+ * buffers of its own, e.g. for another capture thread. Since every flush is a
+ * single fwrite() or sink_write(), batches from different writers never
+ * interleave.
+ *
+ * w:      Writer to initialize
+ * parent: Open writer whose stream should be shared
+ */
+void jsonw_attach(struct jsonw *w, const struct jsonw *parent);
+
+/* Append a record for a single packet to the writer's buffer. Nothing is
+ * written to the underlying stream until jsonw_flush() is called. Each field
+ * of the summary whose layer was decoded gets a member of its own, named as
+ * in decode_fields, between "len" and "data". Only the fields in
+ * options.fields are written.
+ *
+ * w:     Writer to append to
+ * hdr:   Packet header as handed out by pcap
+ * bytes: Packet data, of length hdr->caplen
+ * sum:   What decode_packet() made of the packet, or NULL
+ */
+void jsonw_packet(struct jsonw *w, const struct pcap_pkthdr *hdr,
+                  const u_char *bytes, const struct decode_summary *sum);
+
+/* Like jsonw_packet(), but also record the device the packet was captured
+ * on in a "dev" member. */
+void jsonw_packet_dev(struct jsonw *w, const char *dev,
+                      const struct pcap_pkthdr *hdr, const u_char *bytes,
+                      const struct decode_summary *sum);
+
+/* Write out all buffered records. */
+void jsonw_flush(struct jsonw *w);
+
+/* Flush any remaining records, close the stream (unless it is stdout or
+ * belongs to another writer), and free the writer's buffers. */
+void jsonw_close(struct jsonw *w);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * pcapfile.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcapfile.h"
+
+static uint32_t get32(const struct pcapfile *pf, const uint8_t *p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof v);
+  return pf->swapped ? __builtin_bswap32(v) : v;
+}
+
+void pcapfile_open(struct pcapfile *pf, const char *file) {
+  struct stat st;
+  uint32_t magic;
+
+  pf->fd = open(file, O_RDONLY);
+  if(pf->fd < 0)
+    die(errno, "open(\"%s\")", file);
+
+  if(fstat(pf->fd, &st))
+    die(errno, "fstat(\"%s\")", file);
+  pf->len = st.st_size;
+  if(pf->len < PCAP_FILEHDR_LEN)
+    die(0, "%s: Too short to be a pcap file", file);
+
+  pf->map = mmap(NULL, pf->len, PROT_READ, MAP_SHARED, pf->fd, 0);
+  if(pf->map == MAP_FAILED)
+    die(errno, "mmap(\"%s\")", file);
+
+  /* We walk the file front to back exactly once */
+  madvise((void*)pf->map, pf->len, MADV_SEQUENTIAL);
+
+  memcpy(&magic, pf->map, sizeof magic);
+  pf->swapped = false;
+  if(magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+    pf->nano = magic == PCAP_MAGIC_NS;
+  } else if(__builtin_bswap32(magic) == PCAP_MAGIC_US
+            || __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+    pf->swapped = true;
+    pf->nano = __builtin_bswap32(magic) == PCAP_MAGIC_NS;
+  } else {
+    die(0, "%s: Not a pcap file (bad magic %#x)", file, magic);
+  }
+
+  pf->snaplen = get32(pf, pf->map + 16);
+  pf->linktype = get32(pf, pf->map + 20) & 0x03ffffff;
+  pf->off = PCAP_FILEHDR_LEN;
+  pf->end = pf->len;
+  pf->ordered = false;
+
+  plog(2, "%s: linktype %u, snaplen %u, %s timestamps", file, pf->linktype,
+       pf->snaplen, pf->nano ? "ns" : "us");
+}
+
+bool pcapfile_read(const struct pcapfile *pf, size_t *off,
+                   struct pcap_pkthdr *hdr, const u_char **data) {
+  const uint8_t *rec = pf->map + *off;
+
+  if(*off + PCAP_RECHDR_LEN > pf->end)
+    return false;
+
+  hdr->ts.tv_sec = get32(pf, rec);
+  hdr->ts.tv_usec = get32(pf, rec + 4);
+  hdr->caplen = get32(pf, rec + 8);
+  hdr->len = get32(pf, rec + 12);
+
+  if(*off + PCAP_RECHDR_LEN + hdr->caplen > pf->len) {
+    plog(0, "Truncated record at offset %lu, stopping", *off);
+    return false;
+  }
+
+  *data = rec + PCAP_RECHDR_LEN;
+  *off += PCAP_RECHDR_LEN + hdr->caplen;
+
+  return true;
+}
+
+bool pcapfile_next(struct pcapfile *pf, struct pcap_pkthdr *hdr,
+                   const u_char **data) {
+  return pcapfile_read(pf, &pf->off, hdr, data);
+}
+
+size_t pcapfile_chunks(const struct pcapfile *pf, size_t chunk_size,
+                       struct pcapfile_chunk **chunks) {
+  size_t n = 0, cap = 1024, off = pf->off;
+  struct pcapfile_chunk *c = malloc_or_die(cap * sizeof *c);
+  struct pcap_pkthdr hdr;
+  const u_char *data;
+
+  c[0].off = off;
+  c[0].npkts = 0;
+  while(pcapfile_read(pf, &off, &hdr, &data)) {
+    ++c[n].npkts;
+    if(off - c[n].off < chunk_size)
+      continue;
+
+    c[n].end = off;
+    if(++n == cap) {
+      cap *= 2;
+      c = realloc_or_die(c, cap * sizeof *c);
+    }
+    c[n].off = off;
+    c[n].npkts = 0;
+  }
+
+  /* Keep the last partial chunk, if there is one */
+  if(c[n].npkts) {
+    c[n].end = off;
+    ++n;
+  }
+
+  *chunks = c;
+  return n;
+}
+
+long long pcapfile_ts_ns(const struct pcapfile *pf,
+                         const struct pcap_pkthdr *hdr) {
+  return hdr->ts.tv_sec * 1000000000LL
+       + hdr->ts.tv_usec * (pf->nano ? 1LL : 1000LL);
+}
+
+static char *index_name(const char *file) {
+  char *name = malloc_or_die(strlen(file) + sizeof PDIDX_SUFFIX);
+
+  sprintf(name, "%s%s", file, PDIDX_SUFFIX);
+  return name;
+}
+
+size_t pcapfile_write_index(const char *file, unsigned interval) {
+  struct pcapfile pf;
+  struct pdidx_header ih;
+  struct pdidx_entry e;
+  struct pcap_pkthdr hdr;
+  const u_char *data;
+  size_t pktno, off;
+  long long ts, last = LLONG_MIN;
+  char *name = index_name(file);
+  FILE *fp = fopen_or_die(name, "w");
+
+  pcapfile_open(&pf, file);
+
+  memset(&ih, 0, sizeof ih);
+  memcpy(ih.magic, PDIDX_MAGIC, sizeof PDIDX_MAGIC);
+  ih.interval = interval;
+  ih.flags = PDIDX_ORDERED;
+  ih.filesize = pf.len;
+
+  /* The entry count is filled in once we know it */
+  if(fwrite(&ih, sizeof ih, 1, fp) != 1)
+    die(errno, "fwrite(\"%s\")", name);
+
+  for(pktno = 0, off = pf.off; pcapfile_read(&pf, &pf.off, &hdr, &data);
+      ++pktno, off = pf.off) {
+    ts = pcapfile_ts_ns(&pf, &hdr);
+    if(ts < last)
+      ih.flags &= ~PDIDX_ORDERED;
+    last = ts;
+    if(pktno % interval)
+      continue;
+
+    e.pktno = pktno;
+    e.offset = off;
+    e.ts_ns = ts;
+    if(fwrite(&e, sizeof e, 1, fp) != 1)
+      die(errno, "fwrite(\"%s\")", name);
+    ++ih.nentries;
+  }
+
+  errno = 0;
+  if(fseek(fp, 0, SEEK_SET) || fwrite(&ih, sizeof ih, 1, fp) != 1 || fclose(fp))
+    die(errno, "Writing index header to %s", name);
+
+  plog(1, "Wrote %lu index entries for %lu packets to %s", ih.nentries,
+       pktno, name);
+  if(!(ih.flags & PDIDX_ORDERED))
+    plog(0, "%s: Packets are out of time order; time bounds will scan the "
+         "whole file", file);
+
+  pcapfile_close(&pf);
+  free(name);
+  return pktno;
+}
+
+/* Map the index of a file and check that it still describes it. Return the
+ * number of entries, or 0 if there is no usable index. */
+static size_t map_index(const struct pcapfile *pf, const char *file,
+                        const struct pdidx_entry **entries, size_t *maplen,
+                        uint32_t *flags) {
+  const struct pdidx_header *ih;
+  struct stat st;
+  void *map;
+  char *name = index_name(file);
+  int fd = open(name, O_RDONLY);
+
+  if(fd < 0) {
+    plog(1, "No index at %s, scanning from the start", name);
+    free(name);
+    return 0;
+  }
+
+  if(fstat(fd, &st))
+    die(errno, "fstat(\"%s\")", name);
+  *maplen = st.st_size;
+  if(*maplen < sizeof *ih)
+    die(0, "%s: Too short to be an index", name);
+
+  map = mmap(NULL, *maplen, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED)
+    die(errno, "mmap(\"%s\")", name);
+  close(fd);
+
+  ih = map;
+  if(memcmp(ih->magic, PDIDX_MAGIC, sizeof PDIDX_MAGIC)
+     || *maplen < sizeof *ih + ih->nentries * sizeof **entries)
+    die(0, "%s: Not a valid index", name);
+  if(ih->filesize != pf->len) {
+    plog(0, "%s is stale, ignoring it; rebuild it with -X", name);
+    munmap(map, *maplen);
+    free(name);
+    return 0;
+  }
+
+  free(name);
+  *entries = (const struct pdidx_entry*)(ih + 1);
+  *flags = ih->flags;
+  return ih->nentries;
+}
+
+void pcapfile_seek(struct pcapfile *pf, const char *file, long long start_ns,
+                   long long end_ns) {
+  const struct pdidx_entry *e;
+  size_t lo, hi, mid, n, maplen;
+  uint32_t flags;
+
+  n = map_index(pf, file, &e, &maplen, &flags);
+  if(!n)
+    return;
+
+  /* A binary search means nothing if timestamps go backwards */
+  if(!(flags & PDIDX_ORDERED)) {
+    plog(1, "%s: Packets are out of time order, scanning the whole file",
+         file);
+    munmap((void*)((const struct pdidx_header*)e - 1), maplen);
+    return;
+  }
+  pf->ordered = true;
+
+  /* Find the first entry at or after start_ns, and start at the one before */
+  for(lo = 0, hi = n; lo < hi; ) {
+    mid = lo + (hi - lo) / 2;
+    if(e[mid].ts_ns < start_ns)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo > 0)
+    pf->off = e[lo - 1].offset;
+
+  /* Find the first entry after end_ns; nothing from there on is wanted */
+  for(hi = n; lo < hi; ) {
+    mid = lo + (hi - lo) / 2;
+    if(e[mid].ts_ns <= end_ns)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo < n)
+    pf->end = e[lo].offset;
+
+  plog(1, "Index narrowed reading to offsets %lu-%lu of %lu", pf->off,
+       pf->end, pf->len);
+
+  munmap((void*)((const struct pdidx_header*)e - 1), maplen);
+}
+
+void pcapfile_put_header(u_char *buf, bool nano, uint32_t snaplen,
+                         uint32_t linktype) {
+  struct {
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t thiszone;
+    uint32_t sigfigs, snaplen, linktype;
+  } fh = { nano ? PCAP_MAGIC_NS : PCAP_MAGIC_US, 2, 4, 0, 0, snaplen, linktype };
+
+  memcpy(buf, &fh, PCAP_FILEHDR_LEN);
+}
+
+void pcapfile_put_record_header(u_char *buf, const struct pcap_pkthdr *hdr) {
+  uint32_t rh[4] = { hdr->ts.tv_sec, hdr->ts.tv_usec, hdr->caplen, hdr->len };
+
+  memcpy(buf, rh, PCAP_RECHDR_LEN);
+}
+
+void pcapfile_write_header(FILE *fp, bool nano, uint32_t snaplen,
+                           uint32_t linktype) {
+  u_char fh[PCAP_FILEHDR_LEN];
+
+  pcapfile_put_header(fh, nano, snaplen, linktype);
+
+  errno = 0;
+  if(fwrite(fh, sizeof fh, 1, fp) != 1)
+    die(errno, "fwrite()");
+}
+
+void pcapfile_write_record(FILE *fp, const struct pcap_pkthdr *hdr,
+                           const u_char *data) {
+  u_char rh[PCAP_RECHDR_LEN];
+
+  pcapfile_put_record_header(rh, hdr);
+
+  errno = 0;
+  if(fwrite(rh, sizeof rh, 1, fp) != 1
+     || fwrite(data, 1, hdr->caplen, fp) != hdr->caplen)
+    die(errno, "fwrite()");
+}
+
+uint32_t pcapfile_linktype(int dlt) {
+  switch(dlt) {
+    case DLT_RAW:
+      return LINKTYPE_RAW;
+    default:
+      return dlt;
+  }
+}
+
+int pcapfile_dlt(uint32_t linktype) {
+  switch(linktype) {
+    case LINKTYPE_RAW:
+      return DLT_RAW;
+    default:
+      return linktype;
+  }
+}
+
+void pcapfile_close(struct pcapfile *pf) {
+  munmap((void*)pf->map, pf->len);
+  close(pf->fd);
+  pf->map = NULL;
+  pf->fd = -1;
+}
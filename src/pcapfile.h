@@ -0,0 +1,232 @@
+/*
+ * pcapfile.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_PCAPFILE_H
+#define PROTODUMP_PCAPFILE_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define PCAP_MAGIC_US      0xa1b2c3d4
+#define PCAP_MAGIC_NS      0xa1b23c4d
+#define PCAP_FILEHDR_LEN   24
+#define PCAP_RECHDR_LEN    16
+
+#define LINKTYPE_ETHERNET  1
+#define LINKTYPE_RAW       101
+
+#define PDIDX_SUFFIX       ".pdidx"
+#define PDIDX_MAGIC        "PDIDX01"
+#define PDIDX_ORDERED      0x1
+
+/* A pcap savefile mapped into memory. Records are read straight out of the
+ * mapping, so packet data handed out by pcapfile_next() stays valid until the
+ * file is closed.
+ *
+ * fd:       The open file
+ * map:      The mapped file
+ * len:      Length of the file in bytes
+ * off:      Offset of the next record header
+ * end:      Offset at which to stop reading records (see pcapfile_seek())
+ * ordered:  True if the records are known to be in time order (see
+ *           pcapfile_seek())
+ * swapped:  True if the file was written with the other byte order
+ * nano:     True if timestamps have ns rather than us resolution
+ * snaplen:  Snapshot length from the file header
+ * linktype: LINKTYPE_* value from the file header
+ */
+struct pcapfile {
+  int fd;
+  const uint8_t *map;
+  size_t len;
+  size_t off;
+  size_t end;
+  bool ordered;
+  bool swapped;
+  bool nano;
+  uint32_t snaplen;
+  uint32_t linktype;
+};
+
+/* Map a pcap file and parse its header. Both the us and the ns magic are
+ * accepted, in either byte order. Die on failure.
+ *
+ * pf:   File to initialize
+ * file: Path of the file to open
+ */
+void pcapfile_open(struct pcapfile *pf, const char *file);
+
+/* A run of consecutive records in a pcap file.
+ *
+ * off:   Offset of the first record header
+ * end:   Offset just past the last record
+ * npkts: Number of records in the chunk
+ */
+struct pcapfile_chunk {
+  size_t off;
+  size_t end;
+  size_t npkts;
+};
+
+/* Read the record at *off and advance *off past it. Unlike pcapfile_next(),
+ * this leaves pf untouched, so several threads can read the same file through
+ * cursors of their own. Return false at pf->end, at the end of the file, or
+ * if the record is truncated.
+ *
+ * pf:   File to read from
+ * off:  Cursor, pointing at a record header
+ * hdr:  Filled with the record header
+ * data: Set to point at the packet data, inside the mapping
+ */
+bool pcapfile_read(const struct pcapfile *pf, size_t *off,
+                   struct pcap_pkthdr *hdr, const u_char **data);
+
+/* Walk the record headers from pf->off to pf->end and split them into chunks of
+ * roughly chunk_size bytes, never splitting a record. Return the number of
+ * chunks, and the chunks themselves through *chunks, which the caller must
+ * free.
+ *
+ * pf:         File to split
+ * chunk_size: Target size of a chunk in bytes
+ * chunks:     Set to a newly allocated array of chunks
+ */
+size_t pcapfile_chunks(const struct pcapfile *pf, size_t chunk_size,
+                       struct pcapfile_chunk **chunks);
+
+/* Read the record at pf->off and advance past it. Timestamps are left at the
+ * file's resolution (see pf->nano). Return false at the end of the file, or
+ * if the last record is truncated.
+ *
+ * pf:   File to read from
+ * hdr:  Filled with the record header
+ * data: Set to point at the packet data, inside the mapping
+ */
+bool pcapfile_next(struct pcapfile *pf, struct pcap_pkthdr *hdr,
+                   const u_char **data);
+
+/* Return the timestamp of a record from pf in ns since the epoch. */
+long long pcapfile_ts_ns(const struct pcapfile *pf,
+                         const struct pcap_pkthdr *hdr);
+
+/* The sidecar index written by pcapfile_write_index() is a header followed by
+ * one entry for every interval-th packet, all in host byte order. Lookups
+ * only work if the file's records are in time order, which doesn't hold for
+ * files written by several workers at once (-C<n> -w), so the index records
+ * whether they are.
+ *
+ * magic:    PDIDX_MAGIC, including the terminating NUL
+ * interval: Number of packets between entries
+ * flags:    PDIDX_ORDERED if no packet is older than the one before it
+ * filesize: Size of the pcap file when the index was built, to spot stale
+ *           indices
+ * nentries: Number of entries following the header
+ */
+struct pdidx_header {
+  char magic[8];
+  uint32_t interval;
+  uint32_t flags;
+  uint64_t filesize;
+  uint64_t nentries;
+};
+
+/* A sampled packet in the sidecar index.
+ *
+ * pktno:  Number of the packet in the file, starting at 0
+ * offset: Offset of the packet's record header
+ * ts_ns:  Timestamp of the packet in ns since the epoch
+ */
+struct pdidx_entry {
+  uint64_t pktno;
+  uint64_t offset;
+  int64_t ts_ns;
+};
+
+/* Build the sidecar index of file, named file PDIDX_SUFFIX, sampling every
+ * interval-th packet. Return the number of packets in the file. */
+size_t pcapfile_write_index(const char *file, unsigned interval);
+
+/* Restrict reading to packets with timestamps in [start_ns, end_ns], as far
+ * as the sidecar index allows: set pf->off to the last sampled packet before
+ * start_ns and pf->end to the first sampled packet after end_ns, and set
+ * pf->ordered. Without a usable index, or if the index says the records are
+ * out of time order, the whole file is left readable. Either way callers
+ * still have to check the bounds of each packet.
+ *
+ * pf:       File to restrict
+ * file:     Path pf was opened from, used to find the index
+ * start_ns: Lower time bound
+ * end_ns:   Upper time bound
+ */
+void pcapfile_seek(struct pcapfile *pf, const char *file, long long start_ns,
+                   long long end_ns);
+
+/* Format a pcap file header into the PCAP_FILEHDR_LEN bytes at buf, with the
+ * same arguments as pcapfile_write_header(). */
+void pcapfile_put_header(u_char *buf, bool nano, uint32_t snaplen,
+                         uint32_t linktype);
+
+/* Format the PCAP_RECHDR_LEN byte record header for hdr into buf. The packet
+ * data is to follow it. */
+void pcapfile_put_record_header(u_char *buf, const struct pcap_pkthdr *hdr);
+
+/* Write a pcap file header to fp. Die on failure.
+ *
+ * fp:       Stream to write to
+ * nano:     True to use the ns magic, false for us
+ * snaplen:  Snapshot length to record
+ * linktype: LINKTYPE_* value of the packets that will follow
+ */
+void pcapfile_write_header(FILE *fp, bool nano, uint32_t snaplen,
+                           uint32_t linktype);
+
+/* Append a record to a pcap file started with pcapfile_write_header(). The
+ * timestamp must have the resolution the header says. Die on failure. */
+void pcapfile_write_record(FILE *fp, const struct pcap_pkthdr *hdr,
+                           const u_char *data);
+
+/* Unmap and close the file. */
+void pcapfile_close(struct pcapfile *pf);
+
+/* Return the LINKTYPE_* value that goes in file headers for a DLT_* value
+ * from a pcap handle. They only differ for a few link types, such as raw IP;
+ * other values, including LINKTYPE_* ones, are returned as they are. */
+uint32_t pcapfile_linktype(int dlt);
+
+/* Return the DLT_* value pcap functions such as pcap_open_dead() expect for
+ * a LINKTYPE_* value from a file header. */
+int pcapfile_dlt(uint32_t linktype);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * pcapng.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "pcapng.h"
+
+static void put32(u_char *buf, uint32_t v) {
+  memcpy(buf, &v, sizeof v);
+}
+
+static void put16(u_char *buf, uint16_t v) {
+  memcpy(buf, &v, sizeof v);
+}
+
+void pcapng_put_shb(u_char *buf) {
+  int64_t section_len = -1;
+
+  put32(buf, PCAPNG_SHB_TYPE);
+  put32(buf + 4, PCAPNG_SHB_LEN);
+  put32(buf + 8, PCAPNG_BYTE_ORDER);
+  put16(buf + 12, 1);
+  put16(buf + 14, 0);
+  memcpy(buf + 16, &section_len, sizeof section_len);
+  put32(buf + 24, PCAPNG_SHB_LEN);
+}
+
+/* Put an option with len bytes of value at buf, padded to four bytes, and
+ * return its length. */
+static size_t put_option(u_char *buf, uint16_t code, const void *val,
+                         uint16_t len) {
+  size_t padded = (len + 3) & ~(size_t)3;
+
+  put16(buf, code);
+  put16(buf + 2, len);
+  if(len)
+    memcpy(buf + 4, val, len);
+  memset(buf + 4 + len, 0, padded - len);
+
+  return 4 + padded;
+}
+
+size_t pcapng_put_idb(u_char *buf, uint32_t linktype, uint32_t snaplen,
+                      const char *name, bool nano) {
+  size_t len = 16, namelen;
+  u_char tsresol = nano ? 9 : 6;
+
+  put32(buf, PCAPNG_IDB_TYPE);
+  put16(buf + 8, linktype);
+  put16(buf + 10, 0);
+  put32(buf + 12, snaplen);
+
+  if(name) {
+    namelen = strlen(name);
+    if(namelen > PCAPNG_NAME_MAX)
+      namelen = PCAPNG_NAME_MAX;
+    len += put_option(buf + len, PCAPNG_IF_NAME, name, namelen);
+  }
+  len += put_option(buf + len, PCAPNG_IF_TSRESOL, &tsresol, 1);
+  len += put_option(buf + len, PCAPNG_OPT_END, NULL, 0);
+
+  len += 4;
+  put32(buf + 4, len);
+  put32(buf + len - 4, len);
+
+  return len;
+}
+
+void pcapng_put_epb_header(u_char *buf, uint32_t iface,
+                           const struct pcap_pkthdr *hdr, bool nano) {
+  uint64_t ts = hdr->ts.tv_sec * (nano ? 1000000000ULL : 1000000ULL)
+              + hdr->ts.tv_usec;
+
+  put32(buf, PCAPNG_EPB_TYPE);
+  put32(buf + 4, pcapng_epb_len(hdr));
+  put32(buf + 8, iface);
+  put32(buf + 12, ts >> 32);
+  put32(buf + 16, ts & 0xffffffff);
+  put32(buf + 20, hdr->caplen);
+  put32(buf + 24, hdr->len);
+}
+
+size_t pcapng_put_epb_trailer(u_char *buf, const struct pcap_pkthdr *hdr) {
+  size_t pad = ((hdr->caplen + 3) & ~3u) - hdr->caplen;
+
+  memset(buf, 0, pad);
+  put32(buf + pad, pcapng_epb_len(hdr));
+
+  return pad + PCAPNG_EPB_TRAILER;
+}
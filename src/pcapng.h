@@ -0,0 +1,98 @@
+/*
+ * pcapng.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_PCAPNG_H
+#define PROTODUMP_PCAPNG_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define PCAPNG_SUFFIX      ".pcapng"
+
+#define PCAPNG_SHB_TYPE    0x0a0d0d0a
+#define PCAPNG_IDB_TYPE    0x00000001
+#define PCAPNG_EPB_TYPE    0x00000006
+#define PCAPNG_BYTE_ORDER  0x1a2b3c4d
+
+#define PCAPNG_OPT_END     0
+#define PCAPNG_IF_NAME     2
+#define PCAPNG_IF_TSRESOL  9
+
+/* Block lengths. Interface names longer than PCAPNG_NAME_MAX are cut short. */
+#define PCAPNG_SHB_LEN     28
+#define PCAPNG_NAME_MAX    255
+#define PCAPNG_IDB_MAXLEN  (16 + 4 + PCAPNG_NAME_MAX + 3 + 8 + 4 + 4)
+#define PCAPNG_EPB_HDRLEN  28
+#define PCAPNG_EPB_TRAILER 4
+
+/* Format a Section Header Block into the PCAPNG_SHB_LEN bytes at buf. A
+ * section's length is left unspecified, so the block can be written before
+ * anything that follows it. */
+void pcapng_put_shb(u_char *buf);
+
+/* Format an Interface Description Block into buf, which must have room for
+ * PCAPNG_IDB_MAXLEN bytes, and return its length.
+ *
+ * linktype: LINKTYPE_* value of the interface's packets
+ * snaplen:  Snapshot length the interface was captured with
+ * name:     Name of the interface, or NULL to leave it out
+ * nano:     True if its timestamps have ns rather than us resolution
+ */
+size_t pcapng_put_idb(u_char *buf, uint32_t linktype, uint32_t snaplen,
+                      const char *name, bool nano);
+
+/* Return the total length of an Enhanced Packet Block for hdr. */
+static inline size_t pcapng_epb_len(const struct pcap_pkthdr *hdr) {
+  return PCAPNG_EPB_HDRLEN + ((hdr->caplen + 3) & ~3u) + PCAPNG_EPB_TRAILER;
+}
+
+/* Format the part of an Enhanced Packet Block in front of the packet data into
+ * the PCAPNG_EPB_HDRLEN bytes at buf. The data is to follow, padded to four
+ * bytes, and then the block length again, as pcapng_put_epb_trailer() puts
+ * it.
+ *
+ * iface: Index of the packet's interface in the section
+ * hdr:   The packet's header, with a timestamp in the interface's resolution
+ */
+void pcapng_put_epb_header(u_char *buf, uint32_t iface,
+                           const struct pcap_pkthdr *hdr, bool nano);
+
+/* Format the end of an Enhanced Packet Block for hdr into buf: the padding
+ * after the packet data and the repeated block length. Return the number of
+ * bytes, at most 3 + PCAPNG_EPB_TRAILER. */
+size_t pcapng_put_epb_trailer(u_char *buf, const struct pcap_pkthdr *hdr);
+
+#endif
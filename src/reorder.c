@@ -0,0 +1,127 @@
+/*
+ * reorder.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "reorder.h"
+
+void reorder_init(struct reorder *ro, const struct jsonw *out, size_t nslots,
+                  size_t nitems) {
+  size_t i;
+
+  pthread_mutex_init(&ro->lock, NULL);
+  pthread_cond_init(&ro->cond, NULL);
+  ro->slots = malloc_or_die(nslots * sizeof *ro->slots);
+  ro->ready = malloc_or_die(nslots * sizeof *ro->ready);
+  for(i = 0; i < nslots; ++i) {
+    jsonw_attach(&ro->slots[i], out);
+    ro->ready[i] = false;
+  }
+  ro->nslots = nslots;
+  ro->nitems = nitems;
+  ro->next_item = ro->next_emit = 0;
+  ro->stopped = false;
+}
+
+struct jsonw *reorder_claim(struct reorder *ro, size_t *item) {
+  struct jsonw *w = NULL;
+
+  pthread_mutex_lock(&ro->lock);
+
+  while(!ro->stopped && ro->next_item < ro->nitems
+        && ro->next_item >= ro->next_emit + ro->nslots)
+    pthread_cond_wait(&ro->cond, &ro->lock);
+
+  if(!ro->stopped && ro->next_item < ro->nitems) {
+    *item = ro->next_item++;
+    w = &ro->slots[*item % ro->nslots];
+  }
+
+  pthread_mutex_unlock(&ro->lock);
+  return w;
+}
+
+void reorder_complete(struct reorder *ro, size_t item) {
+  pthread_mutex_lock(&ro->lock);
+  ro->ready[item % ro->nslots] = true;
+  pthread_cond_broadcast(&ro->cond);
+  pthread_mutex_unlock(&ro->lock);
+}
+
+void reorder_drain(struct reorder *ro) {
+  struct jsonw *w;
+  size_t slot;
+
+  pthread_mutex_lock(&ro->lock);
+
+  for(;;) {
+    slot = ro->next_emit % ro->nslots;
+    while(ro->next_emit < ro->next_item && !ro->ready[slot])
+      pthread_cond_wait(&ro->cond, &ro->lock);
+
+    if(ro->next_emit == ro->next_item) {
+      /* Nothing in flight: either we're done or no item was claimed yet */
+      if(ro->stopped || ro->next_item == ro->nitems)
+        break;
+      pthread_cond_wait(&ro->cond, &ro->lock);
+      continue;
+    }
+
+    /* Write without holding the lock, so workers can keep claiming */
+    w = &ro->slots[slot];
+    pthread_mutex_unlock(&ro->lock);
+    jsonw_flush(w);
+    pthread_mutex_lock(&ro->lock);
+
+    ro->ready[slot] = false;
+    ++ro->next_emit;
+    pthread_cond_broadcast(&ro->cond);
+  }
+
+  pthread_mutex_unlock(&ro->lock);
+}
+
+void reorder_stop(struct reorder *ro) {
+  pthread_mutex_lock(&ro->lock);
+  ro->stopped = true;
+  pthread_cond_broadcast(&ro->cond);
+  pthread_mutex_unlock(&ro->lock);
+}
+
+void reorder_free(struct reorder *ro) {
+  size_t i;
+
+  for(i = 0; i < ro->nslots; ++i)
+    jsonw_close(&ro->slots[i]);
+  free(ro->slots);
+  free(ro->ready);
+  pthread_mutex_destroy(&ro->lock);
+  pthread_cond_destroy(&ro->cond);
+}
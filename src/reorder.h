@@ -0,0 +1,99 @@
+/*
+ * reorder.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_REORDER_H
+#define PROTODUMP_REORDER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "output.h"
+
+/* A reorder buffer for work that is done out of order but has to be written
+ * out in order. Work items are numbered 0 to nitems - 1 and handed out in that
+ * order. Each item in flight gets one of a fixed number of slots to buffer its
+ * output in, which bounds both memory use and how far ahead of the writer the
+ * workers can get.
+ *
+ * lock:      Protects everything below
+ * cond:      Signalled whenever an item is handed out, completed or written
+ * slots:     Output buffers; item i uses slots[i % nslots]
+ * ready:     ready[i % nslots] is true once item i is complete
+ * nslots:    Number of slots
+ * nitems:    Total number of items
+ * next_item: Next item to hand out
+ * next_emit: Next item to write out
+ * stopped:   Set by reorder_stop(); no more items are handed out
+ */
+struct reorder {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct jsonw *slots;
+  bool *ready;
+  size_t nslots;
+  size_t nitems;
+  size_t next_item;
+  size_t next_emit;
+  bool stopped;
+};
+
+/* Set up a reorder buffer whose slots write to the stream of out.
+ *
+ * ro:     Reorder buffer to initialize
+ * out:    Writer whose stream the output goes to
+ * nslots: Number of items that may be in flight at once
+ * nitems: Total number of items
+ */
+void reorder_init(struct reorder *ro, const struct jsonw *out, size_t nslots,
+                  size_t nitems);
+
+/* Wait for the next item and a free slot for it. Return the writer to buffer
+ * the item's output in and set *item to its number, or return NULL once all
+ * items have been handed out or reorder_stop() was called. */
+struct jsonw *reorder_claim(struct reorder *ro, size_t *item);
+
+/* Mark an item claimed with reorder_claim() as complete. */
+void reorder_complete(struct reorder *ro, size_t item);
+
+/* Write out completed items in order until every item handed out has been
+ * written. This is meant to run on its own thread, alongside the workers. */
+void reorder_drain(struct reorder *ro);
+
+/* Stop handing out items. Items already handed out are still written. */
+void reorder_stop(struct reorder *ro);
+
+/* Free the reorder buffer. */
+void reorder_free(struct reorder *ro);
+
+#endif
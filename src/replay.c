@@ -0,0 +1,446 @@
+/*
+ * replay.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "replay.h"
+
+/* Suffix of the compiled form of a JSON file given to replay_json() */
+#define PDCACHE_SUFFIX ".pdcache"
+#define PDCACHE_SNAPLEN 262144
+
+/* Below this much time to go, stop sleeping and spin instead. Sleeps wake up
+ * late by tens of microseconds, which would wreck sub-millisecond gaps. */
+#define PACE_SPIN_NS 50000LL
+
+/* Where packets go: either a TX ring or a pcap handle for pcap_inject().
+ *
+ * tx:      The TX ring, if handle is NULL
+ * handle:  The pcap handle, if sending with pcap_inject()
+ * skipped: Packets that could not be sent
+ */
+struct sender {
+  struct tpacket_tx tx;
+  pcap_t *handle;
+  int skipped;
+};
+
+/* Replay pacing state.
+ *
+ * start:    CLOCK_MONOTONIC_RAW time at which the first packet was due
+ * first_ts: Capture timestamp of the first packet, in ns
+ * bytes:    Bytes sent so far
+ * lateness: How late each paced packet went out relative to its schedule
+ */
+struct pacer {
+  long long start;
+  long long first_ts;
+  unsigned long long bytes;
+  struct hist lateness;
+};
+
+static long long now_raw(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool parse_pace(const char *arg) {
+  char *end;
+  double mult = 1;
+
+  options.pace_value = strtod(arg, &end);
+  if(end == arg || options.pace_value <= 0)
+    return false;
+
+  switch(*end) {
+    case 'k': mult = 1e3; ++end; break;
+    case 'M': mult = 1e6; ++end; break;
+    case 'G': mult = 1e9; ++end; break;
+  }
+  options.pace_value *= mult;
+
+  if(!strcmp(end, "x") && mult == 1)
+    options.pace = PACE_SPEED;
+  else if(!strcmp(end, "pps"))
+    options.pace = PACE_PPS;
+  else if(!strcmp(end, "bps"))
+    options.pace = PACE_BPS;
+  else
+    return false;
+
+  return true;
+}
+
+static void open_sender(struct sender *s, const char *dev,
+                        const struct pcapfile *pf) {
+  int err;
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  s->skipped = 0;
+  s->handle = NULL;
+
+  if(options.backend != BACKEND_PCAP) {
+    if(tpacket_tx_open(&s->tx, dev)) {
+      if(s->tx.linktype == DLT_EN10MB && pf->linktype != LINKTYPE_ETHERNET)
+        plog(0, "Replaying linktype %u frames on an Ethernet device as-is",
+             pf->linktype);
+      return;
+    }
+    plog(0, "Can't set up a TX ring on %s; sending with pcap_inject()", dev);
+  }
+
+  s->handle = pcap_create(dev, errbuf);
+  if(!s->handle)
+    die(0, "pcap_create(): %s", errbuf);
+
+  err = pcap_activate(s->handle);
+  if(err < 0)
+    die(0, "pcap_activate(): %s", pcap_geterr(s->handle));
+  else if(err)
+    plog(0, "pcap_activate(): %s", pcap_geterr(s->handle));
+}
+
+/* Send a packet, or queue it to go out with the next kick. */
+static bool send_packet(struct sender *s, const u_char *bytes, unsigned len) {
+  if(s->handle) {
+    if(pcap_inject(s->handle, bytes, len) < 0) {
+      plog(1, "pcap_inject(): %s", pcap_geterr(s->handle));
+      ++s->skipped;
+      return false;
+    }
+    return true;
+  }
+
+  if(!tpacket_tx_queue(&s->tx, bytes, len)) {
+    ++s->skipped;
+    return false;
+  }
+  if(s->tx.queued >= (unsigned)options.batch)
+    tpacket_tx_kick(&s->tx, false);
+
+  return true;
+}
+
+/* Make sure everything queued so far is on its way. */
+static void kick_sender(struct sender *s) {
+  if(!s->handle)
+    tpacket_tx_kick(&s->tx, false);
+}
+
+static void close_sender(struct sender *s) {
+  if(s->handle)
+    pcap_close(s->handle);
+  else
+    tpacket_tx_close(&s->tx);
+
+  if(s->skipped)
+    plog(0, "Skipped %d packets that could not be sent", s->skipped);
+}
+
+/* Return the CLOCK_MONOTONIC_RAW time at which a packet is due. */
+static long long pace_due(const struct pacer *p, const struct pcapfile *pf,
+                          const struct pcap_pkthdr *hdr, int count) {
+  switch(options.pace) {
+    case PACE_SPEED:
+      return p->start + (pcapfile_ts_ns(pf, hdr) - p->first_ts)
+                        / options.pace_value;
+    case PACE_PPS:
+      return p->start + count * (1e9 / options.pace_value);
+    case PACE_BPS:
+      return p->start + p->bytes * (8e9 / options.pace_value);
+    default:
+      return 0;
+  }
+}
+
+/* Wait until due: sleep while there is plenty of time left, then spin on the
+ * raw monotonic clock for the last stretch. Return how late we are. */
+static long long pace_wait(long long due) {
+  struct timespec nap;
+  long long now = now_raw();
+
+  if(due - now > PACE_SPIN_NS) {
+    nap.tv_sec = (due - now - PACE_SPIN_NS) / 1000000000LL;
+    nap.tv_nsec = (due - now - PACE_SPIN_NS) % 1000000000LL;
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &nap, NULL);
+    now = now_raw();
+  }
+
+  while(now < due)
+    now = now_raw();
+
+  return now - due;
+}
+
+static void pace_report(const struct pacer *p, const struct pcapfile *pf,
+                        int count, long long last_ts) {
+  double secs = (now_raw() - p->start) / 1e9;
+  double target;
+
+  if(count < 1 || secs <= 0)
+    return;
+
+  switch(options.pace) {
+    case PACE_SPEED:
+      target = last_ts > p->first_ts
+             ? (count - 1) / ((last_ts - p->first_ts) / 1e9 / options.pace_value)
+             : 0;
+      plog(0, "Target rate: %.0f pps (%gx the capture rate)", target,
+           options.pace_value);
+      break;
+    case PACE_PPS:
+      plog(0, "Target rate: %.0f pps", options.pace_value);
+      break;
+    case PACE_BPS:
+      plog(0, "Target rate: %.0f bps", options.pace_value);
+      break;
+    default:
+      break;
+  }
+
+  plog(0, "Achieved rate: %.0f pps, %.0f bps over %.3f s", count / secs,
+       p->bytes * 8 / secs, secs);
+
+  if(p->lateness.count)
+    plog(0, "Lateness (ns): p50 %" PRIu64 ", p90 %" PRIu64 ", p99 %" PRIu64
+         ", p99.9 %" PRIu64 ", max %" PRIu64,
+         hist_percentile(&p->lateness, 50), hist_percentile(&p->lateness, 90),
+         hist_percentile(&p->lateness, 99), hist_percentile(&p->lateness, 99.9),
+         p->lateness.max);
+}
+
+int replay(const char *file) {
+  int count = 0;
+  struct pcapfile pf;
+  struct pcap_pkthdr hdr;
+  const u_char *bytes;
+  struct sender sender;
+  struct pacer pacer;
+  long long due, ts = 0;
+  char *dev;
+
+  if(!options.dev)
+    die(0, "Replay needs a device to be given with -d");
+  dev = match_dev_regex_or_die(options.dev);
+
+  pcapfile_open(&pf, file);
+  catch_stop_signals();
+
+  plog(1, "Replaying %s on device: %s", file, dev);
+
+  open_sender(&sender, dev, &pf);
+  hist_init(&pacer.lateness);
+  pacer.bytes = 0;
+  pacer.start = now_raw();
+
+  while(!stop_requested && pcapfile_next(&pf, &hdr, &bytes)) {
+    ts = pcapfile_ts_ns(&pf, &hdr);
+    if(!count)
+      pacer.first_ts = ts;
+
+    if(options.pace != PACE_NONE) {
+      due = pace_due(&pacer, &pf, &hdr, count);
+
+      /* Anything already queued is due by now, so get it out before we
+       * wait for this one */
+      if(due > now_raw()) {
+        kick_sender(&sender);
+        hist_record(&pacer.lateness, pace_wait(due));
+      } else {
+        hist_record(&pacer.lateness, now_raw() - due);
+      }
+    }
+
+    if(send_packet(&sender, bytes, hdr.caplen)) {
+      pacer.bytes += hdr.caplen;
+      ++count;
+    }
+  }
+
+  close_sender(&sender);
+  pcapfile_close(&pf);
+
+  plog(1, "Sent %d packets", count);
+  if(options.pace != PACE_NONE)
+    pace_report(&pacer, &pf, count, ts);
+
+  return count;
+}
+
+/* True if cache exists and is at least as new as the JSON it came from */
+static bool cache_is_fresh(const char *json, const char *cache) {
+  struct stat js, cs;
+
+  if(stat(json, &js))
+    die(errno, "stat(\"%s\")", json);
+  if(stat(cache, &cs))
+    return false;
+
+  return cs.st_mtim.tv_sec > js.st_mtim.tv_sec
+      || (cs.st_mtim.tv_sec == js.st_mtim.tv_sec
+          && cs.st_mtim.tv_nsec >= js.st_mtim.tv_nsec);
+}
+
+static int hex_nibble(char c) {
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Decode a hex string into out, which must hold strlen(hex) / 2 bytes.
+ * Return the number of bytes, or -1 if hex is malformed. */
+static long hex_decode(const char *hex, u_char *out) {
+  long i;
+  int hi, lo;
+
+  for(i = 0; hex[2 * i]; ++i) {
+    hi = hex_nibble(hex[2 * i]);
+    lo = hex_nibble(hex[2 * i + 1]);
+    if(hi < 0 || lo < 0)
+      return -1;
+    out[i] = hi << 4 | lo;
+  }
+
+  return i;
+}
+
+/* Look up a numeric member of a record, or return def if it is absent */
+static double record_number(JsonNode *rec, const char *key, double def) {
+  JsonNode *n = json_find_member(rec, key);
+
+  return n && n->tag == JSON_NUMBER ? n->number_ : def;
+}
+
+/* Parse every record in a JSON file written by -C and write the packets to a
+ * ns-resolution pcap file, so that replaying it again is just an mmap. The
+ * file takes the link type of the records, which must all have the same one.
+ * Return the number of packets. */
+static size_t compile_json(const char *json, const char *cache) {
+  FILE *in = fopen_or_die(json, "r");
+  FILE *out;
+  char *tmp = malloc_or_die(strlen(cache) + sizeof ".tmp");
+  char *line = NULL;
+  size_t linecap = 0, lineno = 0, count = 0, datacap = 0;
+  u_char *data = NULL;
+  struct pcap_pkthdr hdr;
+  JsonNode *rec, *hex;
+  long caplen, linktype = -1, lt;
+  bool guessed = false;
+
+  sprintf(tmp, "%s.tmp", cache);
+  out = fopen_or_die(tmp, "w");
+
+  while(getline(&line, &linecap, in) >= 0) {
+    ++lineno;
+    if(strspn(line, " \t\r\n") == strlen(line))
+      continue;
+
+    rec = json_decode(line);
+    if(!rec || rec->tag != JSON_OBJECT)
+      die(0, "%s:%lu: Not a JSON record", json, lineno);
+    hex = json_find_member(rec, "data");
+    if(!hex || hex->tag != JSON_STRING)
+      die(0, "%s:%lu: No packet data to replay; write the records with "
+          "\"data\" among the -i fields", json, lineno);
+
+    /* Records written without one are most likely Ethernet */
+    lt = record_number(rec, "linktype", -1);
+    if(lt < 0) {
+      if(!guessed)
+        plog(0, "%s:%lu: No linktype, taking the packets to be Ethernet",
+             json, lineno);
+      guessed = true;
+      lt = LINKTYPE_ETHERNET;
+    }
+    if(linktype < 0)
+      pcapfile_write_header(out, true, PDCACHE_SNAPLEN, lt);
+    else if(lt != linktype)
+      die(0, "%s:%lu: Link type %ld differs from the %ld before it; "
+          "replay each link type from a file of its own", json, lineno, lt,
+          linktype);
+    linktype = lt;
+
+    if(strlen(hex->string_) / 2 > datacap) {
+      datacap = strlen(hex->string_) / 2;
+      data = realloc_or_die(data, datacap);
+    }
+    caplen = hex_decode(hex->string_, data);
+    if(caplen < 0)
+      die(0, "%s:%lu: Bad hex in packet data", json, lineno);
+
+    hdr.ts.tv_sec = record_number(rec, "sec", 0);
+    hdr.ts.tv_usec = record_number(rec, "nsec", 0);
+    hdr.caplen = caplen;
+    hdr.len = record_number(rec, "len", caplen);
+    pcapfile_write_record(out, &hdr, data);
+
+    json_delete(rec);
+    ++count;
+  }
+  if(ferror(in))
+    die(errno, "Reading %s", json);
+  if(linktype < 0)
+    pcapfile_write_header(out, true, PDCACHE_SNAPLEN, LINKTYPE_ETHERNET);
+
+  errno = 0;
+  if(fclose(out))
+    die(errno, "fclose(\"%s\")", tmp);
+  if(rename(tmp, cache))
+    die(errno, "rename(\"%s\", \"%s\")", tmp, cache);
+  fclose(in);
+
+  plog(1, "Compiled %lu packets from %s into %s", count, json, cache);
+
+  free(data);
+  free(line);
+  free(tmp);
+  return count;
+}
+
+int replay_json(const char *json) {
+  int count;
+  char *cache = malloc_or_die(strlen(json) + sizeof PDCACHE_SUFFIX);
+
+  sprintf(cache, "%s%s", json, PDCACHE_SUFFIX);
+  if(cache_is_fresh(json, cache))
+    plog(1, "Using compiled packets in %s", cache);
+  else
+    compile_json(json, cache);
+
+  count = replay(cache);
+  free(cache);
+  return count;
+}
@@ -0,0 +1,80 @@
+/*
+ * replay.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_REPLAY_H
+#define PROTODUMP_REPLAY_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "capture.h"
+#include "ccan/json/json.h"
+#include "common.h"
+#include "hist.h"
+#include "options.h"
+#include "pcapfile.h"
+#include "tpacket.h"
+
+/* Send the packets in a pcap file out of the device given by options.dev.
+ * By default, packets go through a memory-mapped TX ring and the kernel is
+ * kicked once every options.batch packets; with options.backend set to
+ * BACKEND_PCAP, each packet is sent with pcap_inject() instead.
+ *
+ * Packets go out as fast as possible unless options.pace says otherwise, in
+ * which case each packet is held back until it is due and a summary of the
+ * achieved rate and of how late packets went out is printed at the end.
+ * Return the number of packets sent.
+ *
+ * file: pcap file to replay
+ */
+int replay(const char *file);
+
+/* Replay the packets in a JSON file written by -C, as replay() does. The
+ * records are parsed once into a pcap file named after the JSON file with
+ * ".pdcache" appended, which later replays map directly for as long as it is
+ * newer than the JSON. The link type comes from each record's "linktype"
+ * member, or is taken to be Ethernet if that is missing; die if the records
+ * have different link types. Return the number of packets sent.
+ *
+ * json: JSON file to replay
+ */
+int replay_json(const char *json);
+
+/* Parse a pacing spec into options.pace and options.pace_value. The spec is
+ * a number followed by "x" to scale the original packet gaps (e.g. 2x for
+ * double speed), or by "pps" or "bps" for a fixed rate, optionally with a k,
+ * M or G multiplier (e.g. 10Mbps). Return false if the spec is invalid. */
+bool parse_pace(const char *arg);
+
+#endif
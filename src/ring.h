@@ -0,0 +1,142 @@
+/*
+ * ring.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_RING_H
+#define PROTODUMP_RING_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/* A captured packet on its way from one pipeline stage to the next.
+ *
+ * hdr:       Packet header as handed out by the capture backend
+ * data:      Packet data, of length hdr.caplen, in a buffer from the
+ *            worker's pool. Whoever holds the desc owns the buffer and
+ *            puts it back.
+ * queued_ns: When the desc was queued, if the pipeline is being timed
+ */
+struct pktdesc {
+  struct pcap_pkthdr hdr;
+  u_char *data;
+  long long queued_ns;
+};
+
+/* A bounded single-producer/single-consumer ring of packet descriptors. It
+ * uses no locks: the producer only ever writes head, the consumer only ever
+ * writes tail, and each side keeps a private copy of the other's index so it
+ * only has to touch the shared cache line when the ring looks full or empty.
+ * The two sides live on separate cache lines to avoid false sharing, so a
+ * ring should be allocated with CACHELINE_SIZE alignment.
+ *
+ * head:       Next slot the producer will fill
+ * tail_cache: Producer's last view of tail
+ * tail:       Next slot the consumer will take
+ * head_cache: Consumer's last view of head
+ * slots:      The descriptors themselves
+ * mask:       Number of slots minus one (the size is a power of two)
+ */
+struct ring {
+  size_t head __attribute__((aligned(CACHELINE_SIZE)));
+  size_t tail_cache;
+
+  size_t tail __attribute__((aligned(CACHELINE_SIZE)));
+  size_t head_cache;
+
+  struct pktdesc *slots __attribute__((aligned(CACHELINE_SIZE)));
+  size_t mask;
+};
+
+/* Initialize a ring with room for at least size descriptors. */
+void ring_init(struct ring *r, size_t size);
+
+/* Free the ring's slots. Any descriptors left in it are not touched. */
+void ring_free(struct ring *r);
+
+/* Append a descriptor to the ring. Return false if the ring is full. Must
+ * only be called from the producer thread. */
+static inline bool ring_push(struct ring *r, const struct pktdesc *d) {
+  size_t head = r->head;
+
+  if(head - r->tail_cache > r->mask) {
+    r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if(head - r->tail_cache > r->mask)
+      return false;
+  }
+
+  r->slots[head & r->mask] = *d;
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Take the oldest descriptor out of the ring. Return false if the ring is
+ * empty. Must only be called from the consumer thread. */
+static inline bool ring_pop(struct ring *r, struct pktdesc *d) {
+  size_t tail = r->tail;
+
+  if(tail == r->head_cache) {
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(tail == r->head_cache)
+      return false;
+  }
+
+  *d = r->slots[tail & r->mask];
+  __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Return the oldest descriptor in the ring without taking it out, or NULL if
+ * the ring is empty. The descriptor stays valid until the next ring_pop().
+ * Must only be called from the consumer thread. */
+static inline const struct pktdesc *ring_peek(struct ring *r) {
+  size_t tail = r->tail;
+
+  if(tail == r->head_cache) {
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(tail == r->head_cache)
+      return NULL;
+  }
+
+  return &r->slots[tail & r->mask];
+}
+
+/* Return the number of descriptors currently in the ring. This is only a
+ * snapshot and may be called from any thread. */
+static inline size_t ring_count(struct ring *r) {
+  size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+  return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+#endif
@@ -0,0 +1,388 @@
+/*
+ * sink.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+/* For fallocate() and O_DIRECT */
+#define _GNU_SOURCE
+
+#include "sink.h"
+
+static void set_deadline(struct timespec *deadline) {
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += SINK_FLUSH_MS / 1000;
+  deadline->tv_nsec += SINK_FLUSH_MS % 1000 * 1000000L;
+  if(deadline->tv_nsec >= 1000000000L) {
+    ++deadline->tv_sec;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+/* Close the writer thread's file, giving back whatever was preallocated or
+ * padded past the end of the data. */
+static void finish_file(struct sink *s) {
+  if(s->fd < 0)
+    return;
+
+  if((s->fd_alloc > s->fd_bytes || s->fd_pos > s->fd_bytes)
+     && ftruncate(s->fd, s->fd_bytes))
+    plog(0, "ftruncate(): %s", strerror(errno));
+  if(close(s->fd))
+    die(errno, "close()");
+  s->fd = -1;
+}
+
+static void open_file(struct sink *s, unsigned seq) {
+  char *path = s->name(s->user, seq);
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+  finish_file(s);
+
+  s->fd = open(path, flags | (s->flags & SINK_DIRECT ? O_DIRECT : 0), 0644);
+  if(s->fd < 0 && errno == EINVAL && s->flags & SINK_DIRECT) {
+    plog(0, "Can't write %s with O_DIRECT; going through the page cache",
+         path);
+    s->flags &= ~SINK_DIRECT;
+    s->fd = open(path, flags, 0644);
+  }
+  if(s->fd < 0)
+    die(errno, "open(\"%s\")", path);
+  plog(1, "Writing to %s", path);
+
+  s->fd_file = seq;
+  s->fd_pos = 0;
+  s->fd_bytes = 0;
+  s->fd_alloc = 0;
+  free(path);
+}
+
+/* Make sure the next len bytes of the file have disk space set aside, so
+ * that writes don't have to go looking for free blocks and the file ends up
+ * in one piece. Preallocation is only a hint, so if the filesystem can't do
+ * it, we just stop trying for this file. */
+static void preallocate(struct sink *s, size_t len) {
+  long long want;
+
+  if(!s->name || s->fd_alloc < 0 || s->fd_pos + (long long)len <= s->fd_alloc)
+    return;
+
+  want = s->file_size ? s->file_size : s->fd_alloc + SINK_PREALLOC;
+  if(want < s->fd_pos + (long long)len)
+    want = s->fd_pos + len + SINK_PREALLOC;
+
+  if(fallocate(s->fd, FALLOC_FL_KEEP_SIZE, s->fd_alloc, want - s->fd_alloc)) {
+    plog(1, "Can't preallocate: %s", strerror(errno));
+    s->fd_alloc = -1;
+    return;
+  }
+  s->fd_alloc = want;
+}
+
+static void write_all(struct sink *s, const u_char *data, size_t len) {
+  ssize_t n;
+
+  while(len) {
+    n = write(s->fd, data, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      die(errno, "write()");
+
+    data += n;
+    len -= n;
+  }
+}
+
+/* Start writing a buffer, or with no ring, write it. */
+static void issue(struct sink *s, struct sink_buf *b) {
+  b->wlen = b->len;
+  if(s->flags & SINK_DIRECT) {
+    b->wlen = (b->len + SINK_ALIGN - 1) & ~(size_t)(SINK_ALIGN - 1);
+    memset(b->data + b->len, 0, b->wlen - b->len);
+  }
+
+  preallocate(s, b->wlen);
+  b->off = s->fd_pos;
+  b->done = 0;
+  s->fd_pos += b->wlen;
+  s->fd_bytes += b->len;
+
+  if(!(s->flags & SINK_URING)) {
+    write_all(s, b->data, b->wlen);
+    b->done = b->wlen;
+    return;
+  }
+
+  uring_write(&s->ring, s->fd, b->data, b->wlen, s->seekable ? b->off : -1,
+              b - s->bufs);
+  ++s->inflight;
+}
+
+/* Wait for at least one write to complete, and note all that have. A short
+ * write has the rest of its buffer sent off again. */
+static void reap(struct sink *s) {
+  struct sink_buf *b;
+  uint64_t idx;
+  int res;
+
+  uring_submit(&s->ring, 1);
+
+  while(uring_reap(&s->ring, &idx, &res)) {
+    if(res < 0)
+      die(-res, "write()");
+
+    b = &s->bufs[idx];
+    b->done += res;
+    if(b->done < b->wlen) {
+      uring_write(&s->ring, s->fd, b->data + b->done, b->wlen - b->done,
+                  s->seekable ? b->off + (long long)b->done : -1, idx);
+      continue;
+    }
+    --s->inflight;
+  }
+}
+
+static void *run_sink(void *arg) {
+  struct sink *s = arg;
+  struct sink_buf *b;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&s->lock);
+  set_deadline(&deadline);
+  for(;;) {
+    while(s->submitted == s->filled && !s->inflight && !s->closing)
+      if(pthread_cond_timedwait(&s->ready, &s->lock, &deadline) == ETIMEDOUT) {
+        /* Nothing filled up for a while, so take the partial buffer. With
+         * O_DIRECT that would leave the next write unaligned. */
+        b = &s->bufs[s->filled % SINK_NBUFS];
+        if(b->len && !(s->flags & SINK_DIRECT))
+          ++s->filled;
+        set_deadline(&deadline);
+      }
+
+    if(s->submitted == s->filled && !s->inflight)
+      break;
+
+    /* Queued buffers are left alone by the producers until we're done */
+    while(s->submitted < s->filled && (s->seekable || !s->inflight)) {
+      b = &s->bufs[s->submitted % SINK_NBUFS];
+      if(s->name && b->file != s->fd_file) {
+        /* The old file has to be complete before it is closed */
+        if(s->inflight)
+          break;
+        pthread_mutex_unlock(&s->lock);
+        open_file(s, b->file);
+        pthread_mutex_lock(&s->lock);
+      }
+
+      ++s->submitted;
+      pthread_mutex_unlock(&s->lock);
+      issue(s, b);
+      pthread_mutex_lock(&s->lock);
+    }
+
+    if(s->inflight) {
+      pthread_mutex_unlock(&s->lock);
+      reap(s);
+      pthread_mutex_lock(&s->lock);
+    }
+
+    /* Hand back finished buffers, in order */
+    while(s->written < s->submitted) {
+      b = &s->bufs[s->written % SINK_NBUFS];
+      if(b->done < b->wlen)
+        break;
+      b->len = 0;
+      b->wlen = 0;
+      b->done = 0;
+      ++s->written;
+      pthread_cond_broadcast(&s->freed);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  if(s->name)
+    finish_file(s);
+  return NULL;
+}
+
+static void sink_init(struct sink *s, unsigned flags) {
+  sigset_t all, old;
+  int i, err;
+
+  for(i = 0; i < SINK_NBUFS; ++i) {
+    s->bufs[i].data = aligned_malloc_or_die(SINK_ALIGN, SINK_BUF_SIZE);
+    s->bufs[i].len = 0;
+    s->bufs[i].file = 0;
+    s->bufs[i].wlen = 0;
+    s->bufs[i].done = 0;
+  }
+
+  s->filled = 0;
+  s->submitted = 0;
+  s->written = 0;
+  s->closing = false;
+  s->file = 0;
+  s->flags = flags;
+  s->inflight = 0;
+
+  if(s->flags & SINK_URING && !uring_init(&s->ring, SINK_NBUFS)) {
+    plog(0, "Can't set up io_uring (%s); using write()", strerror(errno));
+    s->flags &= ~SINK_URING;
+  }
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->ready, NULL);
+  pthread_cond_init(&s->freed, NULL);
+
+  /* Leave the signals to the threads that expect them */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  err = pthread_create(&s->thread, NULL, run_sink, s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if(err)
+    die(err, "pthread_create()");
+}
+
+void sink_open_fd(struct sink *s, int fd, unsigned flags) {
+  int fl = fcntl(fd, F_GETFL);
+
+  s->name = NULL;
+  s->user = NULL;
+  s->file_size = 0;
+  s->fd = fd;
+  s->fd_file = 0;
+  s->fd_bytes = 0;
+  s->fd_alloc = 0;
+
+  /* Pipes and appending fds are written at their file position, so their
+   * writes have to go one after the other */
+  s->fd_pos = lseek(fd, 0, SEEK_CUR);
+  s->seekable = s->fd_pos >= 0 && fl >= 0 && !(fl & O_APPEND);
+  if(s->fd_pos < 0)
+    s->fd_pos = 0;
+
+  sink_init(s, flags & ~SINK_DIRECT);
+}
+
+void sink_open_files(struct sink *s, sink_name_fn name, void *user,
+                     long long file_size, unsigned flags) {
+  s->name = name;
+  s->user = user;
+  s->file_size = file_size;
+  s->fd = -1;
+  s->fd_file = -1;
+  s->fd_pos = 0;
+  s->fd_bytes = 0;
+  s->fd_alloc = 0;
+  s->seekable = true;
+
+  sink_init(s, flags);
+}
+
+void sink_lock(struct sink *s) {
+  pthread_mutex_lock(&s->lock);
+}
+
+void sink_unlock(struct sink *s) {
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* Queue the buffer being filled for the writer thread, if it has anything in
+ * it. If every buffer is queued already, the next one isn't ours to queue.
+ * Called with the lock held. */
+static void queue_buf(struct sink *s) {
+  if(s->filled - s->written >= SINK_NBUFS
+     || !s->bufs[s->filled % SINK_NBUFS].len)
+    return;
+
+  ++s->filled;
+  pthread_cond_signal(&s->ready);
+}
+
+void sink_append(struct sink *s, const void *data, size_t len) {
+  const u_char *p = data;
+  struct sink_buf *b;
+  size_t n;
+
+  while(len) {
+    /* Wait for the writer thread to free a buffer if they're all queued */
+    while(s->filled - s->written >= SINK_NBUFS)
+      pthread_cond_wait(&s->freed, &s->lock);
+
+    b = &s->bufs[s->filled % SINK_NBUFS];
+    if(!b->len)
+      b->file = s->file;
+
+    n = SINK_BUF_SIZE - b->len;
+    if(n > len)
+      n = len;
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    p += n;
+    len -= n;
+
+    if(b->len == SINK_BUF_SIZE)
+      queue_buf(s);
+  }
+}
+
+void sink_next_file(struct sink *s) {
+  queue_buf(s);
+  ++s->file;
+}
+
+void sink_write(struct sink *s, const void *data, size_t len) {
+  sink_lock(s);
+  sink_append(s, data, len);
+  sink_unlock(s);
+}
+
+void sink_close(struct sink *s) {
+  int i, err;
+
+  pthread_mutex_lock(&s->lock);
+  queue_buf(s);
+  s->closing = true;
+  pthread_cond_signal(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+
+  err = pthread_join(s->thread, NULL);
+  if(err)
+    die(err, "pthread_join()");
+
+  if(s->flags & SINK_URING)
+    uring_free(&s->ring);
+  for(i = 0; i < SINK_NBUFS; ++i)
+    free(s->bufs[i].data);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->freed);
+  pthread_cond_destroy(&s->ready);
+}
@@ -0,0 +1,191 @@
+/*
+ * sink.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_SINK_H
+#define PROTODUMP_SINK_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "uring.h"
+
+/* Data is gathered into buffers of this many bytes, aligned to SINK_ALIGN,
+ * before it goes to disk */
+#define SINK_BUF_SIZE (1 << 20)
+#define SINK_NBUFS    8
+#define SINK_ALIGN    4096
+
+/* Files are preallocated this much at a time when their size isn't known */
+#define SINK_PREALLOC (64LL << 20)
+
+/* A buffer that hasn't filled up is written out anyway after this long, so
+ * that a quiet stream doesn't sit in memory */
+#define SINK_FLUSH_MS 1000
+
+enum sink_flags {
+  SINK_URING  = 1 << 0,
+  SINK_DIRECT = 1 << 1,
+};
+
+/* Name the seq'th file of a sink, in memory the sink will free. */
+typedef char *(*sink_name_fn)(void *user, unsigned seq);
+
+/* A buffer of data on its way to disk. The last few fields belong to the
+ * writer thread while the buffer is being written.
+ *
+ * data: The data
+ * len:  Number of bytes in data
+ * file: Sequence number of the file the data goes to
+ * off:  Offset in the file the buffer is written at
+ * wlen: Number of bytes to write, which is len padded for O_DIRECT
+ * done: Number of bytes written so far
+ */
+struct sink_buf {
+  u_char *data;
+  size_t len;
+  unsigned file;
+  long long off;
+  size_t wlen;
+  size_t done;
+};
+
+/* A byte stream written out by a thread of its own. Producers copy data into
+ * the sink's buffers, and the writer thread takes full buffers to disk, so
+ * that a slow disk only holds up the producers once every buffer is waiting
+ * to be written. With SINK_URING, the writer keeps every queued buffer in
+ * flight at once through io_uring rather than writing them one at a time.
+ *
+ * A sink either writes to an fd it is given, or to a series of files it
+ * creates itself, moving on to the next one at sink_next_file(). Files it
+ * creates are preallocated, and with SINK_DIRECT opened with O_DIRECT, which
+ * keeps a long capture from pushing everything else out of the page cache.
+ * O_DIRECT writes have to be whole blocks, so buffers are then only written
+ * once full, except for the last one of each file, which is padded out and
+ * truncated back afterwards.
+ *
+ * The buffers are used in turn: bufs[filled % SINK_NBUFS] is the one being
+ * filled, the ones from submitted up to filled are waiting for the writer
+ * thread, and the ones from written up to submitted are being written.
+ *
+ * lock:       Protects the producer side and the buffer counters
+ * ready:      Signalled when a buffer is queued or the writer should finish
+ * freed:      Signalled when the writer thread is done with a buffer
+ * thread:     The writer thread
+ * bufs:       The buffers
+ * filled:     Number of buffers queued for writing so far
+ * submitted:  Number of buffers the writer thread has started writing
+ * written:    Number of buffers written so far
+ * closing:    Set once no more buffers will be queued
+ * file:       Sequence number of the file data goes to now
+ * name:       Names the files to create, or NULL if writing to a given fd
+ * user:       Passed to name
+ * file_size:  Expected size of each file for preallocation, or 0
+ * flags:      SINK_* flags still in effect
+ * ring:       The io_uring, with SINK_URING
+ * fd:         The fd being written (writer thread only)
+ * fd_file:    Sequence number of fd (writer thread only)
+ * fd_pos:     Offset of the next write to fd (writer thread only)
+ * fd_bytes:   Bytes of data written to fd, without padding (writer thread
+ *             only)
+ * fd_alloc:   Bytes preallocated for fd, or -1 if that failed (writer thread
+ *             only)
+ * seekable:   False if fd can only be written at its file position, in
+ *             which case only one write is kept in flight (writer thread
+ *             only)
+ * inflight:   Number of writes in flight (writer thread only)
+ */
+struct sink {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t freed;
+  pthread_t thread;
+  struct sink_buf bufs[SINK_NBUFS];
+  unsigned long filled;
+  unsigned long submitted;
+  unsigned long written;
+  bool closing;
+  unsigned file;
+  sink_name_fn name;
+  void *user;
+  long long file_size;
+  unsigned flags;
+  struct uring ring;
+  int fd;
+  unsigned fd_file;
+  long long fd_pos;
+  long long fd_bytes;
+  long long fd_alloc;
+  bool seekable;
+  unsigned inflight;
+};
+
+/* Start a sink writing to an open fd, from its current position. The fd is
+ * left open. SINK_DIRECT doesn't apply. */
+void sink_open_fd(struct sink *s, int fd, unsigned flags);
+
+/* Start a sink writing to files it creates as data for them comes in.
+ *
+ * s:         Sink to initialize
+ * name:      Names the files
+ * user:      Passed to name
+ * file_size: Size each file is expected to reach, or 0 if unknown
+ * flags:     SINK_* flags
+ */
+void sink_open_files(struct sink *s, sink_name_fn name, void *user,
+                     long long file_size, unsigned flags);
+
+/* Take and release the producer lock, so that several sink_append() and
+ * sink_next_file() calls go into the stream together. */
+void sink_lock(struct sink *s);
+void sink_unlock(struct sink *s);
+
+/* Append len bytes of data. Blocks only if every buffer is waiting on the
+ * disk. Called with the lock held. */
+void sink_append(struct sink *s, const void *data, size_t len);
+
+/* Send everything after this to the next file. Called with the lock held. */
+void sink_next_file(struct sink *s);
+
+/* Append data in one piece, taking the lock around it. */
+void sink_write(struct sink *s, const void *data, size_t len);
+
+/* Write out everything still buffered, stop the writer thread, and close the
+ * last file if the sink created it. */
+void sink_close(struct sink *s);
+
+#endif
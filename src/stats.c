@@ -0,0 +1,214 @@
+/*
+ * stats.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "ccan/json/json.h"
+
+#include "stats.h"
+
+/* How often the stats thread wakes up to check for work, in ms */
+#define STATS_TICK_MS 100
+
+volatile sig_atomic_t stats_requested;
+
+static const char *hist_names[STATS_NHISTS] = {
+  [STATS_CAPTURE_NS] = "capture_ns",
+  [STATS_QUEUE_NS] = "queue_ns",
+  [STATS_DECODE_NS] = "decode_ns",
+  [STATS_ENCODE_NS] = "encode_ns",
+  [STATS_WRITE_NS] = "write_ns",
+  [STATS_CAPTURE_BATCH] = "capture_batch",
+  [STATS_WRITE_BATCH] = "write_batch",
+};
+
+static void request_stats(int sig) {
+  stats_requested = 1;
+}
+
+static JsonNode *counters_to_json(const struct stats_counters *c) {
+  JsonNode *obj = json_mkobject();
+
+  if(c->dev)
+    json_append_member(obj, "dev", json_mkstring(c->dev));
+  json_append_member(obj, "recv", json_mknumber(c->recv));
+  json_append_member(obj, "drop", json_mknumber(c->drop));
+  json_append_member(obj, "ifdrop", json_mknumber(c->ifdrop));
+  json_append_member(obj, "captured", json_mknumber(c->captured));
+  json_append_member(obj, "encoded", json_mknumber(c->encoded));
+  json_append_member(obj, "json_bytes", json_mknumber(c->json_bytes));
+  json_append_member(obj, "queued", json_mknumber(c->queued));
+  json_append_member(obj, "reassembled", json_mknumber(c->reassembled));
+  json_append_member(obj, "frag_expired", json_mknumber(c->frag_expired));
+  json_append_member(obj, "frag_evicted", json_mknumber(c->frag_evicted));
+  json_append_member(obj, "frag_overlaps", json_mknumber(c->frag_overlaps));
+
+  return obj;
+}
+
+static JsonNode *hist_to_json(const struct hist *h) {
+  JsonNode *obj = json_mkobject();
+
+  json_append_member(obj, "count", json_mknumber(h->count));
+  json_append_member(obj, "p50", json_mknumber(hist_percentile(h, 50)));
+  json_append_member(obj, "p99", json_mknumber(hist_percentile(h, 99)));
+  json_append_member(obj, "p999", json_mknumber(hist_percentile(h, 99.9)));
+  json_append_member(obj, "max", json_mknumber(h->max));
+
+  return obj;
+}
+
+/* Merge the histograms of every source and summarize the ones that have
+ * anything in them. Return NULL if none do. */
+static JsonNode *hists_to_json(struct stats *st) {
+  JsonNode *obj = NULL;
+  int i, j;
+
+  for(j = 0; j < STATS_NHISTS; ++j)
+    hist_init(&st->merged[j]);
+  for(i = 0; i < st->nsources; ++i)
+    if(st->counters[i].hists)
+      for(j = 0; j < STATS_NHISTS; ++j)
+        hist_merge(&st->merged[j], &st->counters[i].hists[j]);
+
+  for(j = 0; j < STATS_NHISTS; ++j) {
+    if(!st->merged[j].count)
+      continue;
+    if(!obj)
+      obj = json_mkobject();
+    json_append_member(obj, hist_names[j], hist_to_json(&st->merged[j]));
+  }
+
+  return obj;
+}
+
+/* Collect the counters and write them out as a single line: the totals at
+ * the top level, and each source's own numbers under "sources". */
+static void write_stats(struct stats *st) {
+  struct stats_counters total;
+  struct timespec now;
+  JsonNode *line, *sources, *hists;
+  char *enc;
+  int i;
+
+  memset(st->counters, 0, st->nsources * sizeof *st->counters);
+  st->collect(st->counters, st->user);
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  memset(&total, 0, sizeof total);
+  sources = json_mkarray();
+  for(i = 0; i < st->nsources; ++i) {
+    total.recv += st->counters[i].recv;
+    total.drop += st->counters[i].drop;
+    total.ifdrop += st->counters[i].ifdrop;
+    total.captured += st->counters[i].captured;
+    total.encoded += st->counters[i].encoded;
+    total.json_bytes += st->counters[i].json_bytes;
+    total.queued += st->counters[i].queued;
+    total.reassembled += st->counters[i].reassembled;
+    total.frag_expired += st->counters[i].frag_expired;
+    total.frag_evicted += st->counters[i].frag_evicted;
+    total.frag_overlaps += st->counters[i].frag_overlaps;
+    json_append_element(sources, counters_to_json(&st->counters[i]));
+  }
+
+  line = counters_to_json(&total);
+  json_prepend_member(line, "time", json_mknumber(now.tv_sec + now.tv_nsec / 1e9));
+  json_append_member(line, "sources", sources);
+  hists = hists_to_json(st);
+  if(hists)
+    json_append_member(line, "hists", hists);
+
+  enc = json_encode(line);
+  errno = 0;
+  if(fprintf(st->fp, "%s\n", enc) < 0 || fflush(st->fp))
+    die(errno, "Writing stats");
+
+  free(enc);
+  json_delete(line);
+}
+
+static void *run_stats(void *arg) {
+  static const struct timespec tick = {
+    .tv_sec = 0, .tv_nsec = STATS_TICK_MS * 1000000L
+  };
+  struct stats *st = arg;
+  long waited = 0;
+
+  while(!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+    nanosleep(&tick, NULL);
+    waited += STATS_TICK_MS;
+
+    if(stats_requested || waited >= st->interval * 1000L) {
+      stats_requested = 0;
+      waited = 0;
+      write_stats(st);
+    }
+  }
+
+  return NULL;
+}
+
+void stats_start(struct stats *st, const char *file, int interval,
+                 int nsources, stats_collect_fn collect, void *user) {
+  struct sigaction sa;
+  int err;
+
+  st->fp = fopen_or_die(file, "a");
+  st->interval = interval;
+  st->nsources = nsources;
+  st->counters = malloc_or_die(nsources * sizeof *st->counters);
+  st->merged = malloc_or_die(STATS_NHISTS * sizeof *st->merged);
+  st->collect = collect;
+  st->user = user;
+  st->stop = false;
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = request_stats;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if(sigaction(SIGUSR1, &sa, NULL))
+    die(errno, "sigaction()");
+
+  err = pthread_create(&st->thread, NULL, run_stats, st);
+  if(err)
+    die(err, "pthread_create()");
+}
+
+void stats_stop(struct stats *st) {
+  __atomic_store_n(&st->stop, true, __ATOMIC_RELEASE);
+  pthread_join(st->thread, NULL);
+
+  write_stats(st);
+
+  fclose(st->fp);
+  free(st->counters);
+  free(st->merged);
+}
@@ -0,0 +1,149 @@
+/*
+ * stats.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_STATS_H
+#define PROTODUMP_STATS_H
+
+#include <pcap/pcap.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "common.h"
+#include "hist.h"
+#include "options.h"
+
+/* Histograms kept per source when stats are enabled. Latencies are in ns.
+ *
+ * STATS_CAPTURE_NS:    From the kernel's timestamp to the capture thread
+ * STATS_QUEUE_NS:      Time spent queued between capture and encoder
+ * STATS_DECODE_NS:     Decoding a single packet, including reassembly
+ * STATS_ENCODE_NS:     Writing a single decoded packet as JSON and/or pcap
+ * STATS_WRITE_NS:      Writing out one batch of records
+ * STATS_CAPTURE_BATCH: Packets handed over per backend read
+ * STATS_WRITE_BATCH:   Records per write
+ */
+enum stats_hist {
+  STATS_CAPTURE_NS,
+  STATS_QUEUE_NS,
+  STATS_DECODE_NS,
+  STATS_ENCODE_NS,
+  STATS_WRITE_NS,
+  STATS_CAPTURE_BATCH,
+  STATS_WRITE_BATCH,
+  STATS_NHISTS
+};
+
+/* Counters for one source of packets (a worker or a device), from the kernel
+ * down through each stage of the pipeline.
+ *
+ * dev:           Device the packets come from, or NULL if reading a file
+ * recv:          Packets the kernel saw, as reported by pcap_stats()
+ * drop:          Packets the kernel dropped for lack of buffer space
+ * ifdrop:        Packets the interface or its driver dropped
+ * captured:      Packets the capture thread queued for encoding
+ * encoded:       Packets the encoder turned into JSON records
+ * json_bytes:    Bytes of JSON written out
+ * queued:        Packets waiting between the capture and encoder threads
+ * reassembled:   IP datagrams put back together from fragments
+ * frag_expired:  Datagrams whose fragments timed out before all came in
+ * frag_evicted:  Datagrams dropped to make room in the reassembler
+ * frag_overlaps: Datagrams dropped for overlapping fragments
+ * hists:         The source's histograms, or NULL if it keeps none. They
+ *                belong to the source's threads and are only read here.
+ */
+struct stats_counters {
+  const char *dev;
+  unsigned long long recv;
+  unsigned long long drop;
+  unsigned long long ifdrop;
+  unsigned long long captured;
+  unsigned long long encoded;
+  unsigned long long json_bytes;
+  unsigned long long queued;
+  unsigned long long reassembled;
+  unsigned long long frag_expired;
+  unsigned long long frag_evicted;
+  unsigned long long frag_overlaps;
+  const struct hist *hists;
+};
+
+/* Fill in counters for each of the sources given to stats_start(). */
+typedef void (*stats_collect_fn)(struct stats_counters *counters, void *user);
+
+/* A thread writing the counters of a running capture to a file as one JSON
+ * line every so often, and whenever SIGUSR1 is received. Histograms are
+ * merged across sources and summarized by their percentiles.
+ *
+ * fp:       Stream the lines go to
+ * interval: Seconds between lines
+ * nsources: Number of sources to collect counters for
+ * counters: Space for the collected counters
+ * merged:   Space for merging every source's histograms
+ * collect:  Fills in counters
+ * user:     Passed on to collect
+ * thread:   The stats thread
+ * stop:     Set by stats_stop()
+ */
+struct stats {
+  FILE *fp;
+  int interval;
+  int nsources;
+  struct stats_counters *counters;
+  struct hist *merged;
+  stats_collect_fn collect;
+  void *user;
+  pthread_t thread;
+  bool stop;
+};
+
+/* Set by the SIGUSR1 handler installed by stats_start(). */
+extern volatile sig_atomic_t stats_requested;
+
+/* Open the stats file and start the stats thread. Die on failure.
+ *
+ * st:       Stats to initialize
+ * file:     File to append the lines to
+ * interval: Seconds between lines
+ * nsources: Number of sources collect reports on
+ * collect:  Called from the stats thread to fill in the counters
+ * user:     Passed on to collect
+ */
+void stats_start(struct stats *st, const char *file, int interval,
+                 int nsources, stats_collect_fn collect, void *user);
+
+/* Write a last line, stop the stats thread and close the file. */
+void stats_stop(struct stats *st);
+
+#endif
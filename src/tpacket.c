@@ -0,0 +1,424 @@
+/*
+ * tpacket.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "tpacket.h"
+
+#define TPACKET_BLOCK_SIZE   (1 << 20)
+#define TPACKET_FRAME_SIZE   2048
+
+#define TPACKET_DEFAULT_TX_RING (4 << 20)
+#define TPACKET_L2_OVERHEAD     (14 + 2 * 4) /* Ethernet with QinQ tags */
+
+static int arphrd_to_dlt(int arphrd) {
+  switch(arphrd) {
+    case ARPHRD_ETHER:
+    case ARPHRD_LOOPBACK: /* Fallthrough */
+      return DLT_EN10MB;
+    case ARPHRD_NONE:
+    case ARPHRD_IPGRE:    /* Fallthrough */
+    case ARPHRD_TUNNEL:   /* Fallthrough */
+    case ARPHRD_TUNNEL6:  /* Fallthrough */
+      return DLT_RAW;
+    default:
+      return PCAP_ERROR;
+  }
+}
+
+static unsigned block_size_for_snaplen(int snaplen) {
+  unsigned sz = TPACKET_BLOCK_SIZE;
+  unsigned need = snaplen + TPACKET3_HDRLEN + sizeof(struct tpacket_block_desc);
+
+  while(sz < need)
+    sz <<= 1;
+
+  return sz;
+}
+
+/* Have the kernel truncate packets to snaplen before they reach the ring, so
+ * we don't spend ring space on bytes we'd throw away anyway. */
+static void attach_snaplen_filter(int fd, int snaplen) {
+  struct sock_filter insn = BPF_STMT(BPF_RET | BPF_K, snaplen);
+  struct sock_fprog prog = { .len = 1, .filter = &insn };
+
+  if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog))
+    die(errno, "setsockopt(SO_ATTACH_FILTER)");
+}
+
+/* Open an AF_PACKET socket for dev and get its ARPHRD_* hardware type. The
+ * socket is not bound yet, since rings have to be set up before binding.
+ * Until then it has no protocol, so it doesn't pick up packets from every
+ * device (and past the snaplen filter) in the meantime. */
+static int open_packet_socket(const char *dev, int *ifindex, int *hwtype) {
+  struct ifreq ifr;
+  int fd;
+
+  *ifindex = if_nametoindex(dev);
+  if(!*ifindex)
+    die(errno, "if_nametoindex(\"%s\")", dev);
+
+  fd = socket(AF_PACKET, SOCK_RAW, 0);
+  if(fd < 0)
+    die(errno, "socket(AF_PACKET)");
+
+  memset(&ifr, 0, sizeof ifr);
+  strncpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name) - 1);
+  if(ioctl(fd, SIOCGIFHWADDR, &ifr))
+    die(errno, "ioctl(SIOCGIFHWADDR, \"%s\")", dev);
+  *hwtype = ifr.ifr_hwaddr.sa_family;
+
+  return fd;
+}
+
+static void bind_packet_socket(int fd, int ifindex, const char *dev) {
+  struct sockaddr_ll sll;
+
+  memset(&sll, 0, sizeof sll);
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex = ifindex;
+  if(bind(fd, (struct sockaddr*)&sll, sizeof sll))
+    die(errno, "bind(\"%s\")", dev);
+}
+
+void tpacket_open(struct tpacket *tp, const char *dev, int ring_size,
+                  int timeout) {
+  struct tpacket_req3 req;
+  int version = TPACKET_V3, hwtype;
+  unsigned ring = ring_size > 0 ? ring_size : TPACKET_DEFAULT_RING;
+
+  tp->fd = open_packet_socket(dev, &tp->ifindex, &hwtype);
+  tp->linktype = arphrd_to_dlt(hwtype);
+  if(tp->linktype == PCAP_ERROR)
+    die(0, "Unsupported hardware type %d on %s for the tpacket backend",
+           hwtype, dev);
+
+  if(setsockopt(tp->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof version))
+    die(errno, "setsockopt(PACKET_VERSION)");
+
+  attach_snaplen_filter(tp->fd, options.snaplen);
+
+  tp->block_size = block_size_for_snaplen(options.snaplen);
+  tp->block_nr = ring / tp->block_size;
+  if(tp->block_nr < 2)
+    tp->block_nr = 2;
+
+  memset(&req, 0, sizeof req);
+  req.tp_block_size = tp->block_size;
+  req.tp_block_nr = tp->block_nr;
+  req.tp_frame_size = TPACKET_FRAME_SIZE;
+  req.tp_frame_nr = (tp->block_size / TPACKET_FRAME_SIZE) * tp->block_nr;
+  req.tp_retire_blk_tov = timeout;
+  if(setsockopt(tp->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req))
+    die(errno, "setsockopt(PACKET_RX_RING)");
+
+  tp->maplen = (size_t)tp->block_size * tp->block_nr;
+  tp->map = mmap(NULL, tp->maplen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, tp->fd, 0);
+  if(tp->map == MAP_FAILED)
+    die(errno, "mmap(%lu)", tp->maplen);
+  tp->block = 0;
+  tp->timeout = timeout;
+  tp->spin_ns = 0;
+  memset(&tp->stats, 0, sizeof tp->stats);
+}
+
+void tpacket_bind(struct tpacket *tp, const char *dev) {
+  struct packet_mreq mreq;
+
+  bind_packet_socket(tp->fd, tp->ifindex, dev);
+
+  if(options.promisc) {
+    memset(&mreq, 0, sizeof mreq);
+    mreq.mr_ifindex = tp->ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if(setsockopt(tp->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof mreq))
+      die(errno, "setsockopt(PACKET_ADD_MEMBERSHIP)");
+  }
+
+  plog(1, "tpacket: %u blocks of %u bytes on %s", tp->block_nr, tp->block_size, dev);
+}
+
+static bool block_ready(struct tpacket_block_desc *bd) {
+  return __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+         & TP_STATUS_USER;
+}
+
+/* Spin for up to ns nanoseconds waiting for a block. Return true if it
+ * showed up. */
+static bool spin_for_block(struct tpacket_block_desc *bd, long long ns) {
+  struct timespec now;
+  long long until;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  until = now.tv_sec * 1000000000LL + now.tv_nsec + ns;
+
+  do {
+    if(block_ready(bd))
+      return true;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while(now.tv_sec * 1000000000LL + now.tv_nsec < until);
+
+  return false;
+}
+
+int tpacket_dispatch(struct tpacket *tp, pcap_handler cb, u_char *user) {
+  struct tpacket_block_desc *bd;
+  struct tpacket3_hdr *ppd;
+  struct pcap_pkthdr hdr;
+  struct pollfd pfd = { .fd = tp->fd, .events = POLLIN | POLLERR };
+  uint32_t i, npkts;
+
+  bd = (struct tpacket_block_desc*)(tp->map + (size_t)tp->block * tp->block_size);
+
+  if(!block_ready(bd) && !(tp->spin_ns && spin_for_block(bd, tp->spin_ns))) {
+    if(poll(&pfd, 1, tp->timeout) < 0) {
+      if(errno == EINTR)
+        return -1;
+      die(errno, "poll()");
+    }
+    if(!block_ready(bd))
+      return 0;
+  }
+
+  npkts = bd->hdr.bh1.num_pkts;
+  ppd = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+  for(i = 0; i < npkts; ++i) {
+    hdr.ts.tv_sec = ppd->tp_sec;
+    hdr.ts.tv_usec = options.tstamp_nano ? ppd->tp_nsec : ppd->tp_nsec / 1000;
+    hdr.caplen = ppd->tp_snaplen;
+    hdr.len = ppd->tp_len;
+    cb(user, &hdr, (u_char*)ppd + ppd->tp_mac);
+    ppd = (struct tpacket3_hdr*)((uint8_t*)ppd + ppd->tp_next_offset);
+  }
+
+  /* Hand the whole block back at once */
+  __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+  tp->block = (tp->block + 1) % tp->block_nr;
+
+  return npkts;
+}
+
+bool tpacket_tx_open(struct tpacket_tx *tx, const char *dev) {
+  struct tpacket_req req;
+  struct ifreq ifr;
+  int version = TPACKET_V2, one = 1, hwtype;
+  unsigned ring = options.buffer_size > 0 ? options.buffer_size
+                                          : TPACKET_DEFAULT_TX_RING;
+
+  tx->fd = open_packet_socket(dev, &tx->ifindex, &hwtype);
+  tx->linktype = arphrd_to_dlt(hwtype);
+  if(tx->linktype == PCAP_ERROR) {
+    plog(0, "Unsupported hardware type %d on %s for a TX ring", hwtype, dev);
+    goto fail;
+  }
+
+  if(setsockopt(tx->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof version))
+    die(errno, "setsockopt(PACKET_VERSION)");
+
+  /* Frames only need to hold what the device will actually send */
+  memset(&ifr, 0, sizeof ifr);
+  strncpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name) - 1);
+  if(ioctl(tx->fd, SIOCGIFMTU, &ifr))
+    die(errno, "ioctl(SIOCGIFMTU, \"%s\")", dev);
+  tx->max_len = ifr.ifr_mtu + TPACKET_L2_OVERHEAD;
+  for(tx->frame_size = TPACKET_ALIGNMENT;
+      tx->frame_size < TPACKET2_HDRLEN + tx->max_len; )
+    tx->frame_size <<= 1;
+
+  /* Frames go out straight to the driver; replay has no use for qdiscs */
+  if(setsockopt(tx->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof one))
+    plog(1, "setsockopt(PACKET_QDISC_BYPASS): %s", strerror(errno));
+
+  memset(&req, 0, sizeof req);
+  req.tp_block_size = TPACKET_BLOCK_SIZE > tx->frame_size ? TPACKET_BLOCK_SIZE
+                                                          : tx->frame_size;
+  req.tp_block_nr = ring / req.tp_block_size;
+  if(req.tp_block_nr < 1)
+    req.tp_block_nr = 1;
+  req.tp_frame_size = tx->frame_size;
+  req.tp_frame_nr = (req.tp_block_size / tx->frame_size) * req.tp_block_nr;
+  if(setsockopt(tx->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof req)) {
+    plog(0, "setsockopt(PACKET_TX_RING): %s", strerror(errno));
+    goto fail;
+  }
+
+  tx->frame_nr = req.tp_frame_nr;
+  tx->maplen = (size_t)req.tp_block_size * req.tp_block_nr;
+  tx->map = mmap(NULL, tx->maplen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, tx->fd, 0);
+  if(tx->map == MAP_FAILED) {
+    plog(0, "mmap(%lu): %s", tx->maplen, strerror(errno));
+    goto fail;
+  }
+  tx->frame = 0;
+  tx->queued = 0;
+
+  bind_packet_socket(tx->fd, tx->ifindex, dev);
+
+  plog(1, "tpacket: %u TX frames of %u bytes on %s", tx->frame_nr,
+       tx->frame_size, dev);
+  return true;
+
+fail:
+  close(tx->fd);
+  tx->fd = -1;
+  return false;
+}
+
+void tpacket_tx_kick(struct tpacket_tx *tx, bool wait) {
+  if(!tx->queued && !wait)
+    return;
+
+  while(sendto(tx->fd, NULL, 0, wait ? 0 : MSG_DONTWAIT, NULL, 0) < 0) {
+    if(errno == EAGAIN || errno == ENOBUFS) {
+      if(!wait)
+        return;
+    } else if(errno != EINTR) {
+      die(errno, "sendto()");
+    }
+  }
+
+  tx->queued = 0;
+}
+
+bool tpacket_tx_queue(struct tpacket_tx *tx, const u_char *data,
+                      unsigned len) {
+  struct tpacket2_hdr *hdr;
+  struct pollfd pfd = { .fd = tx->fd, .events = POLLOUT };
+  uint32_t status;
+
+  if(len > tx->max_len)
+    return false;
+
+  hdr = (struct tpacket2_hdr*)(tx->map + (size_t)tx->frame * tx->frame_size);
+
+  /* If the ring is full, send what we have and wait for the kernel to hand
+   * frames back */
+  while((status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE))
+        & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+    tpacket_tx_kick(tx, false);
+    if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      die(errno, "poll()");
+  }
+  if(status & TP_STATUS_WRONG_FORMAT)
+    die(0, "tpacket: Kernel rejected a frame as malformed");
+
+  memcpy((uint8_t*)hdr + TPACKET_ALIGN(sizeof *hdr), data, len);
+  hdr->tp_len = len;
+  hdr->tp_snaplen = len;
+  __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+  tx->frame = (tx->frame + 1) % tx->frame_nr;
+  ++tx->queued;
+
+  return true;
+}
+
+void tpacket_tx_close(struct tpacket_tx *tx) {
+  struct tpacket2_hdr *hdr;
+  unsigned i;
+
+  tpacket_tx_kick(tx, true);
+
+  /* Don't pull the ring out from under frames that are still going out */
+  for(i = 0; i < tx->frame_nr; ++i) {
+    hdr = (struct tpacket2_hdr*)(tx->map + (size_t)i * tx->frame_size);
+    while(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)
+          & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+      sched_yield();
+  }
+
+  munmap(tx->map, tx->maplen);
+  close(tx->fd);
+  tx->map = NULL;
+  tx->fd = -1;
+}
+
+void tpacket_stats(struct tpacket *tp, struct pcap_stat *ps) {
+  struct tpacket_stats_v3 st;
+  socklen_t len = sizeof st;
+
+  /* Reading the counters resets them, so keep a running total */
+  if(getsockopt(tp->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+    die(errno, "getsockopt(PACKET_STATISTICS)");
+
+  tp->stats.ps_recv += st.tp_packets;
+  tp->stats.ps_drop += st.tp_drops;
+  *ps = tp->stats;
+}
+
+void tpacket_join_fanout(int fd, unsigned group) {
+  int arg = (group & 0xffff)
+          | (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+
+  if(setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof arg))
+    die(errno, "setsockopt(PACKET_FANOUT)");
+}
+
+void tpacket_close(struct tpacket *tp) {
+  munmap(tp->map, tp->maplen);
+  close(tp->fd);
+  tp->map = NULL;
+  tp->fd = -1;
+}
+
+void tpacket_set_filter(int fd, const struct bpf_program *prog) {
+  /* struct bpf_insn and struct sock_filter have the same layout */
+  struct sock_fprog fprog = {
+    .len = prog->bf_len,
+    .filter = (struct sock_filter*)prog->bf_insns
+  };
+
+  if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof fprog))
+    die(errno, "setsockopt(SO_ATTACH_FILTER)");
+}
+
+void tpacket_drop_all(int fd) {
+  attach_snaplen_filter(fd, 0);
+}
+
+bool tpacket_busy_poll(int fd, int usec) {
+  return !setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec);
+}
@@ -0,0 +1,199 @@
+/*
+ * tpacket.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_TPACKET_H
+#define PROTODUMP_TPACKET_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "options.h"
+
+/* Total size of a receive ring when none is asked for */
+#define TPACKET_DEFAULT_RING (32 << 20)
+
+/* A TPACKET_V3 memory-mapped receive ring on an AF_PACKET socket. The kernel
+ * fills fixed-size blocks with a variable number of packets and hands each
+ * block over once it is full or its retire timeout expires. Packets are
+ * handed to the callback in place, straight out of the mapped ring.
+ *
+ * fd:         The AF_PACKET socket
+ * ifindex:    Index of the bound interface
+ * linktype:   DLT_* value describing the frames we receive
+ * map:        The mapped ring
+ * maplen:     Length of map in bytes
+ * block_size: Size of a single block in bytes
+ * block_nr:   Number of blocks in the ring
+ * block:      Index of the next block to look at
+ * timeout:    Block retire timeout in ms, also used to wait for blocks
+ * spin_ns:    How long to spin waiting for a block before sleeping in
+ *             poll(); 0 (the default) to go straight to sleep
+ * stats:      Kernel counters accumulated by tpacket_stats()
+ */
+struct tpacket {
+  int fd;
+  int ifindex;
+  int linktype;
+  uint8_t *map;
+  size_t maplen;
+  unsigned block_size;
+  unsigned block_nr;
+  unsigned block;
+  int timeout;
+  long long spin_ns;
+  struct pcap_stat stats;
+};
+
+/* Open a TPACKET_V3 ring for the given device, using options.snaplen. The
+ * socket takes in no packets until tpacket_bind(), so a filter attached with
+ * tpacket_set_filter() in between applies from the first packet. Die on
+ * failure.
+ *
+ * tp:        Ring to initialize
+ * dev:       Name of the device the ring is for
+ * ring_size: Total size of the ring in bytes, or 0 for TPACKET_DEFAULT_RING
+ * timeout:   Block retire timeout in ms
+ */
+void tpacket_open(struct tpacket *tp, const char *dev, int ring_size,
+                  int timeout);
+
+/* Bind a ring from tpacket_open() to its device so packets start arriving,
+ * entering promiscuous mode if options.promisc is set. Die on failure. */
+void tpacket_bind(struct tpacket *tp, const char *dev);
+
+/* Fill in ps with the number of packets the kernel has seen and dropped on
+ * the ring so far, like pcap_stats() does for pcap handles. */
+void tpacket_stats(struct tpacket *tp, struct pcap_stat *ps);
+
+/* Wait up to the block retire timeout for the next block, spinning for the
+ * first tp->spin_ns of it, then hand every packet in it to cb and give the
+ * block back to the kernel. Return the number of packets handled, 0 if the
+ * wait timed out, or -1 if it was interrupted by a signal.
+ *
+ * tp:   Ring to read from
+ * cb:   Callback invoked for each packet, as with pcap_dispatch()
+ * user: Passed through to cb
+ */
+int tpacket_dispatch(struct tpacket *tp, pcap_handler cb, u_char *user);
+
+/* A TPACKET_V2 memory-mapped transmit ring on an AF_PACKET socket. Frames
+ * are copied into the ring and marked ready, and a single sendto() then has
+ * the kernel send everything that is queued.
+ *
+ * fd:         The AF_PACKET socket
+ * ifindex:    Index of the bound interface
+ * linktype:   DLT_* value describing the frames the device expects
+ * map:        The mapped ring
+ * maplen:     Length of map in bytes
+ * frame_size: Size of a single frame slot in bytes
+ * frame_nr:   Number of frame slots in the ring
+ * frame:      Index of the next frame slot to fill
+ * max_len:    Largest packet the device can send, from its MTU
+ * queued:     Number of frames queued since the last kick
+ */
+struct tpacket_tx {
+  int fd;
+  int ifindex;
+  int linktype;
+  uint8_t *map;
+  size_t maplen;
+  unsigned frame_size;
+  unsigned frame_nr;
+  unsigned frame;
+  unsigned max_len;
+  unsigned queued;
+};
+
+/* Open a TPACKET_V2 transmit ring on the given device, sized by
+ * options.buffer_size if set. If the device or kernel can't give it a ring,
+ * log why and return false, so the caller can send some other way. Die on
+ * other failures.
+ *
+ * tx:  Ring to initialize
+ * dev: Name of the device to send on
+ */
+bool tpacket_tx_open(struct tpacket_tx *tx, const char *dev);
+
+/* Copy a packet into the next free frame of the ring. If the ring is full,
+ * kick it and wait until the kernel frees a frame. Return false, without
+ * queueing anything, if the packet is too big for the device.
+ *
+ * tx:   Ring to queue on
+ * data: Packet data, starting at the link layer header
+ * len:  Length of data
+ */
+bool tpacket_tx_queue(struct tpacket_tx *tx, const u_char *data,
+                      unsigned len);
+
+/* Have the kernel send all queued frames. If wait is false, don't block when
+ * the device queue is full; the frames stay queued for the next kick. */
+void tpacket_tx_kick(struct tpacket_tx *tx, bool wait);
+
+/* Send whatever is still queued, wait for it to go out, then unmap the ring
+ * and close the socket. */
+void tpacket_tx_close(struct tpacket_tx *tx);
+
+/* Join an AF_PACKET socket to a PACKET_FANOUT group in hash mode, so that all
+ * packets of a flow go to the same socket in the group. Works on the sockets
+ * underneath libpcap handles as well as on our own rings. Die on failure.
+ *
+ * fd:    The AF_PACKET socket, which must already be bound
+ * group: Fanout group id shared by all sockets that should split the traffic
+ */
+void tpacket_join_fanout(int fd, unsigned group);
+
+/* Attach a compiled filter to an AF_PACKET socket, replacing whatever filter
+ * it had. The kernel swaps the filter atomically, so no packets slip through
+ * unfiltered in between. Die on failure.
+ *
+ * fd:   The AF_PACKET socket
+ * prog: Program from pcap_compile(), whose return values double as snaplen
+ */
+void tpacket_set_filter(int fd, const struct bpf_program *prog);
+
+/* Attach a filter that drops every packet to an AF_PACKET socket, so that it
+ * stops taking in new packets while what it already holds is read out. */
+void tpacket_drop_all(int fd);
+
+/* Ask the kernel to busy-poll the device's queue for up to usec
+ * microseconds when the socket is read with nothing queued, rather than
+ * wait for an interrupt. Return false if that isn't allowed, e.g. without
+ * CAP_NET_ADMIN or with a driver that can't do it. */
+bool tpacket_busy_poll(int fd, int usec);
+
+/* Unmap the ring and close the socket. */
+void tpacket_close(struct tpacket *tp);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * uring.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include "uring.h"
+
+bool uring_init(struct uring *u, unsigned entries) {
+  struct io_uring_params p;
+  int err;
+
+  memset(&p, 0, sizeof p);
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if(u->fd < 0)
+    return false;
+
+  /* Writes at the file position came along with IORING_OP_WRITE */
+  if(!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(u->fd);
+    errno = EOPNOTSUPP;
+    return false;
+  }
+
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    if(u->cq_len > u->sq_len)
+      u->sq_len = u->cq_len;
+    u->cq_len = u->sq_len;
+  }
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if(u->sq_map == MAP_FAILED)
+    goto fail;
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_map = u->sq_map;
+  else {
+    u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if(u->cq_map == MAP_FAILED)
+      goto fail_sq;
+  }
+
+  u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if(u->sqes == MAP_FAILED)
+    goto fail_cq;
+
+  u->sq_tail = (unsigned*)((char*)u->sq_map + p.sq_off.tail);
+  u->sq_mask = (unsigned*)((char*)u->sq_map + p.sq_off.ring_mask);
+  u->sq_array = (unsigned*)((char*)u->sq_map + p.sq_off.array);
+  u->cq_head = (unsigned*)((char*)u->cq_map + p.cq_off.head);
+  u->cq_tail = (unsigned*)((char*)u->cq_map + p.cq_off.tail);
+  u->cq_mask = (unsigned*)((char*)u->cq_map + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)((char*)u->cq_map + p.cq_off.cqes);
+  u->queued = 0;
+
+  return true;
+
+fail_cq:
+  err = errno;
+  if(u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_len);
+  errno = err;
+fail_sq:
+  err = errno;
+  munmap(u->sq_map, u->sq_len);
+  errno = err;
+fail:
+  err = errno;
+  close(u->fd);
+  errno = err;
+  return false;
+}
+
+void uring_write(struct uring *u, int fd, const void *buf, unsigned len,
+                 long long off, uint64_t data) {
+  unsigned tail = *u->sq_tail, idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+
+  memset(sqe, 0, sizeof *sqe);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = (uint64_t)off;
+  sqe->user_data = data;
+
+  u->sq_array[idx] = idx;
+  /* The kernel must see the entry before the new tail */
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++u->queued;
+}
+
+void uring_submit(struct uring *u, unsigned wait) {
+  int n;
+
+  for(;;) {
+    n = syscall(__NR_io_uring_enter, u->fd, u->queued, wait,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if(n >= 0)
+      break;
+    if(errno != EINTR)
+      die(errno, "io_uring_enter()");
+  }
+
+  u->queued -= n;
+}
+
+bool uring_reap(struct uring *u, uint64_t *data, int *res) {
+  unsigned head = *u->cq_head;
+  const struct io_uring_cqe *cqe;
+
+  if(head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    return false;
+
+  cqe = &u->cqes[head & *u->cq_mask];
+  *data = cqe->user_data;
+  *res = cqe->res;
+  /* Only hand the entry back once we're done reading it */
+  __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+void uring_free(struct uring *u) {
+  munmap(u->sqes, u->sqes_len);
+  if(u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_len);
+  munmap(u->sq_map, u->sq_len);
+  close(u->fd);
+}
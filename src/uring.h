@@ -0,0 +1,111 @@
+/*
+ * uring.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_URING_H
+#define PROTODUMP_URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/* Just enough of io_uring to keep a few writes in flight, set up with the
+ * raw system calls so that we don't depend on liburing.
+ *
+ * fd:        The ring's file descriptor
+ * sq_map:    Mapping of the submission queue ring
+ * sq_len:    Length of sq_map
+ * cq_map:    Mapping of the completion queue ring, which may be sq_map
+ * cq_len:    Length of cq_map
+ * sqes:      The submission queue entries
+ * sqes_len:  Length of the sqes mapping
+ * sq_tail:   Kernel-shared tail of the submission queue
+ * sq_mask:   Mask for indexing the submission queue
+ * sq_array:  Indices of the entries in the submission queue
+ * cq_head:   Kernel-shared head of the completion queue
+ * cq_tail:   Kernel-shared tail of the completion queue
+ * cq_mask:   Mask for indexing the completion queue
+ * cqes:      The completion queue entries
+ * queued:    Entries queued but not yet handed to the kernel
+ */
+struct uring {
+  int fd;
+  void *sq_map;
+  size_t sq_len;
+  void *cq_map;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned queued;
+};
+
+/* Set up a ring with room for at least entries writes in flight. Return false
+ * with errno set if the kernel doesn't have io_uring, or one recent enough
+ * for IORING_OP_WRITE, so that the caller can fall back to write(). */
+bool uring_init(struct uring *u, unsigned entries);
+
+/* Queue a write of len bytes from buf to fd at offset off, or at the file
+ * position if off is -1. The caller has to keep no more writes in flight than
+ * the ring was set up for.
+ *
+ * data: Value to hand back with the write's completion
+ */
+void uring_write(struct uring *u, int fd, const void *buf, unsigned len,
+                 long long off, uint64_t data);
+
+/* Hand the queued writes to the kernel and wait until at least wait of them
+ * have completed. Die on failure. */
+void uring_submit(struct uring *u, unsigned wait);
+
+/* Take a completion off the ring. Return false if there are none.
+ *
+ * data: Set to the value the write was queued with
+ * res:  Set to the number of bytes written, or a negated errno value
+ */
+bool uring_reap(struct uring *u, uint64_t *data, int *res);
+
+/* Unmap and close the ring. */
+void uring_free(struct uring *u);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * run-rotate.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+
+#include "capwriter.h"
+
+/* Parse arg and check that it gives these limits */
+static bool parses_to(const char *arg, long long size, int secs) {
+  options.rotate_size = -1;
+  options.rotate_secs = -1;
+  return parse_rotate(arg) && options.rotate_size == size
+      && options.rotate_secs == secs;
+}
+
+/* Check that arg is refused and the limits are left alone */
+static bool refused(const char *arg) {
+  options.rotate_size = 7;
+  options.rotate_secs = 7;
+  return !parse_rotate(arg) && options.rotate_size == 7
+      && options.rotate_secs == 7;
+}
+
+int main(void) {
+  plan_tests(17);
+
+  ok1(parses_to("1000", 1000, 0));
+  ok1(parses_to("0", 0, 0));
+  ok1(parses_to("10k", 10000, 0));
+  ok1(parses_to("2M", 2000000, 0));
+  ok1(parses_to("1G", 1000000000, 0));
+  ok1(parses_to("1.5M", 1500000, 0));
+  ok1(parses_to("100M,60", 100000000, 60));
+  ok1(parses_to("0,3600", 0, 3600));
+  ok1(parses_to("512k,90", 512000, 90));
+
+  ok1(refused(""));
+  ok1(refused("M"));
+  ok1(refused("-1"));
+  ok1(refused("10T"));
+  ok1(refused("10kB"));
+  ok1(refused("10,"));
+  ok1(refused("10,-5"));
+  ok1(refused("10,5s"));
+
+  return exit_status();
+}
@@ -0,0 +1,187 @@
+/*
+ * run-tunnel.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <netinet/in.h>
+
+#include "decode.h"
+#include "../pkt.h"
+
+static void decode(const struct pkt *p, struct decode_summary *sum) {
+  struct decoder d;
+
+  decode_select(&d, DLT_EN10MB);
+  decode_packet(&d, pkt_bytes(p), p->len, sum);
+}
+
+/* The inner packet every tunnel carries: a DNS query from the IPv6
+ * addresses */
+static void inner(struct pkt *p) {
+  pkt_dns(p, 0x4242, false, "inner.example", 1);
+  pkt_udp(p, 1234, 53);
+  pkt_ipv6(p, IPPROTO_UDP);
+}
+
+static bool inner_ok(const struct decode_summary *sum) {
+  return sum->layers & DECODE_IPV6 && !(sum->layers & DECODE_IPV4) &&
+         !memcmp(sum->src, pkt_ip6_src, 16) && sum->sport == 1234 &&
+         sum->layers & DECODE_DNS && !strcmp(sum->dns_qname, "inner.example");
+}
+
+static bool outer_ok(const struct decode_summary *sum, uint8_t proto,
+                     uint16_t dport) {
+  return !sum->outer_v6 && !memcmp(sum->outer_src, pkt_ip4_src, 4) &&
+         !memcmp(sum->outer_dst, pkt_ip4_dst, 4) &&
+         sum->outer_proto == proto && sum->outer_dport == dport;
+}
+
+static void test_link(void) {
+  struct decode_summary sum;
+  struct pkt p;
+
+  inner(&p);
+  pkt_vlan(&p, 20, 0x86dd);
+  pkt_vlan(&p, 10, 0x8100);
+  pkt_eth(&p, 0x88a8);
+  decode(&p, &sum);
+  ok1(sum.layers & DECODE_VLAN && sum.nvlans == 2);
+  ok1(sum.vlan[0] == 10 && sum.vlan[1] == 20);
+  ok1(inner_ok(&sum) && !(sum.layers & DECODE_TUNNEL));
+
+  inner(&p);
+  pkt_mpls(&p, 200, true);
+  pkt_mpls(&p, 100, false);
+  pkt_eth(&p, 0x8847);
+  decode(&p, &sum);
+  ok1(sum.layers & DECODE_MPLS && sum.nlabels == 2);
+  ok1(sum.mpls[0] == 100 && sum.mpls[1] == 200);
+  ok1(inner_ok(&sum));
+
+  /* An Ethernet pseudowire with a control word */
+  inner(&p);
+  pkt_eth(&p, 0x86dd);
+  pkt_push(&p, 4);
+  pkt_mpls(&p, 300, true);
+  pkt_eth(&p, 0x8847);
+  decode(&p, &sum);
+  ok1(sum.nlabels == 1 && sum.mpls[0] == 300 && inner_ok(&sum));
+  ok1(sum.ethertype == 0x8847);
+}
+
+static void test_tunnels(void) {
+  struct decode_summary sum;
+  struct pkt p;
+
+  inner(&p);
+  pkt_gre(&p, 0x86dd, 77);
+  pkt_ipv4(&p, IPPROTO_GRE);
+  pkt_eth(&p, 0x0800);
+  decode(&p, &sum);
+  ok1(sum.layers & DECODE_GRE && sum.tunnel == DECODE_GRE);
+  ok1(sum.tunnel_id == 77 && outer_ok(&sum, IPPROTO_GRE, 0));
+  ok1(inner_ok(&sum));
+
+  inner(&p);
+  pkt_eth(&p, 0x86dd);
+  pkt_vxlan(&p, 5000);
+  pkt_udp(&p, 40000, 4789);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  pkt_eth(&p, 0x0800);
+  decode(&p, &sum);
+  ok1(sum.tunnel == DECODE_VXLAN && sum.tunnel_id == 5000);
+  ok1(outer_ok(&sum, IPPROTO_UDP, 4789) && sum.outer_sport == 40000);
+  ok1(inner_ok(&sum));
+  ok1(sum.src_mac[5] == 1 && sum.ethertype == 0x0800);
+
+  inner(&p);
+  pkt_geneve(&p, 6000, 0x86dd);
+  pkt_udp(&p, 40000, 6081);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  pkt_eth(&p, 0x0800);
+  decode(&p, &sum);
+  ok1(sum.tunnel == DECODE_GENEVE && sum.tunnel_id == 6000);
+  ok1(outer_ok(&sum, IPPROTO_UDP, 6081) && inner_ok(&sum));
+
+  inner(&p);
+  pkt_ipv4(&p, IPPROTO_IPV6);
+  pkt_eth(&p, 0x0800);
+  decode(&p, &sum);
+  ok1(sum.tunnel == DECODE_IPIP && outer_ok(&sum, IPPROTO_IPV6, 0));
+  ok1(inner_ok(&sum));
+
+  /* Nested: the outer fields are those of the outermost tunnel */
+  inner(&p);
+  pkt_gre(&p, 0x86dd, 0);
+  pkt_ipv4(&p, IPPROTO_GRE);
+  pkt_eth(&p, 0x0800);
+  pkt_vxlan(&p, 1);
+  pkt_udp(&p, 40000, 4789);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  pkt_eth(&p, 0x0800);
+  decode(&p, &sum);
+  ok1(sum.tunnel == DECODE_GRE && sum.layers & DECODE_VXLAN);
+  ok1(outer_ok(&sum, IPPROTO_UDP, 4789) && inner_ok(&sum));
+}
+
+/* However deep the stacking, decoding stops after DECODE_MAX_DEPTH layers */
+static void test_depth(void) {
+  struct decode_summary sum;
+  struct pkt p;
+  unsigned i;
+
+  inner(&p);
+  pkt_vlan(&p, 20, 0x86dd);
+  for(i = 0; i < 19; ++i)
+    pkt_vlan(&p, i, 0x8100);
+  pkt_eth(&p, 0x8100);
+  decode(&p, &sum);
+  ok1(sum.layers & DECODE_VLAN && sum.nvlans == DECODE_MAX_VLANS);
+  ok1(!(sum.layers & DECODE_IP));
+
+  inner(&p);
+  for(i = 0; i < DECODE_MAX_DEPTH + 2; ++i)
+    pkt_mpls(&p, i, i == 0);
+  pkt_eth(&p, 0x8847);
+  decode(&p, &sum);
+  ok1(sum.nlabels == DECODE_MAX_LABELS && !(sum.layers & DECODE_IP));
+}
+
+int main(void) {
+  plan_tests(24);
+  decode_init();
+
+  test_link();
+  test_tunnels();
+  test_depth();
+
+  return exit_status();
+}
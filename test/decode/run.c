@@ -0,0 +1,265 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "decode.h"
+#include "options.h"
+#include "../pkt.h"
+
+static void decode(int linktype, const struct pkt *p,
+                   struct decode_summary *sum) {
+  struct decoder d;
+
+  decode_select(&d, linktype);
+  decode_packet(&d, pkt_bytes(p), p->len, sum);
+}
+
+/* The same DNS query over every link type the decoder knows */
+static void test_linktypes(void) {
+  static const int linktypes[] = {DLT_EN10MB, DLT_LINUX_SLL, DLT_LINUX_SLL2,
+                                  DLT_RAW, LINKTYPE_RAW, DLT_NULL};
+  struct decode_summary sum;
+  struct pkt p;
+  unsigned i;
+
+  for(i = 0; i < sizeof linktypes / sizeof *linktypes; ++i) {
+    pkt_dns(&p, 0x1234, false, "www.example.com", 1);
+    pkt_udp(&p, 40000, 53);
+    pkt_ipv4(&p, IPPROTO_UDP);
+    switch(linktypes[i]) {
+      case DLT_EN10MB:
+        pkt_eth(&p, 0x0800);
+        break;
+      case DLT_LINUX_SLL:
+        pkt_sll(&p, 0x0800);
+        break;
+      case DLT_LINUX_SLL2:
+        pkt_sll2(&p, 0x0800);
+        break;
+      case DLT_NULL:
+        pkt_null(&p, AF_INET);
+        break;
+    }
+    decode(linktypes[i], &p, &sum);
+
+    ok(sum.layers & DECODE_IPV4 && sum.layers & DECODE_UDP &&
+       sum.layers & DECODE_DNS, "linktype %d decodes to DNS", linktypes[i]);
+    ok1(!memcmp(sum.src, pkt_ip4_src, 4) && !memcmp(sum.dst, pkt_ip4_dst, 4));
+    ok1(sum.sport == 40000 && sum.dport == 53);
+    ok1(sum.dns_id == 0x1234 && !sum.dns_qr && sum.dns_qtype == 1);
+    ok1(!strcmp(sum.dns_qname, "www.example.com"));
+  }
+
+  /* Link-layer fields */
+  pkt_init(&p, "", 0);
+  pkt_ipv4(&p, 255);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_ETH && sum.ethertype == 0x0800);
+  ok1(sum.addr_len == 6 && sum.src_mac[0] == 2 && sum.src_mac[5] == 1);
+  ok1(sum.dst_mac[5] == 2);
+
+  pkt_init(&p, "", 0);
+  pkt_ipv4(&p, 255);
+  pkt_sll2(&p, 0x0800);
+  decode(DLT_LINUX_SLL2, &p, &sum);
+  ok1(sum.layers & DECODE_SLL && sum.addr_len == 6 && sum.src_mac[5] == 9);
+}
+
+static void test_transports(void) {
+  static const u_char echo[8] = {8, 0, 0, 0, 0, 1, 0, 1};
+  struct decode_summary sum;
+  struct pkt p;
+
+  pkt_client_hello(&p, "sni.example.org");
+  pkt_tcp(&p, 50000, 443, 0x18);
+  pkt_ipv6(&p, IPPROTO_TCP);
+  pkt_eth(&p, 0x86dd);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_IPV6 && sum.layers & DECODE_TCP);
+  ok1(!memcmp(sum.src, pkt_ip6_src, 16) && !memcmp(sum.dst, pkt_ip6_dst, 16));
+  ok1(sum.proto == IPPROTO_TCP && sum.ttl == 64);
+  ok1(sum.tcp_flags == 0x18 && sum.sport == 50000 && sum.dport == 443);
+  ok1(sum.layers & DECODE_TLS && sum.tls_type == 22 && sum.tls_hs == 1);
+  ok1(sum.tls_version == 0x0301);
+  ok1(!strcmp(sum.tls_sni, "sni.example.org"));
+
+  pkt_init(&p, echo, sizeof echo);
+  pkt_ipv4(&p, IPPROTO_ICMP);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_ICMP && sum.icmp_type == 8 && sum.icmp_code == 0);
+  ok1(sum.payload_len == 4);
+
+  /* Hop-by-hop options in front of mDNS */
+  pkt_dns(&p, 0, true, "printer.local", 12);
+  pkt_udp(&p, 5353, 5353);
+  pkt_ipv6_ext(&p, IPPROTO_UDP);
+  pkt_ipv6(&p, IPPROTO_HOPOPTS);
+  pkt_eth(&p, 0x86dd);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_UDP && sum.proto == IPPROTO_UDP);
+  ok1(sum.layers & DECODE_DNS && sum.dns_qr && sum.dns_rcode == 3);
+  ok1(sum.dns_qtype == 12 && !strcmp(sum.dns_qname, "printer.local"));
+
+  /* DNS over TCP has a length in front */
+  pkt_dns(&p, 7, true, "a.example", 28);
+  pkt_put16(pkt_push(&p, 2), p.len);
+  pkt_tcp(&p, 53, 3333, 0x18);
+  pkt_ipv4(&p, IPPROTO_TCP);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_DNS && sum.dns_id == 7 && sum.dns_qtype == 28);
+  ok1(!strcmp(sum.dns_qname, "a.example"));
+
+  /* A SYN-ACK has no payload to look into */
+  pkt_init(&p, "", 0);
+  pkt_tcp(&p, 443, 50000, 0x12);
+  pkt_ipv4(&p, IPPROTO_TCP);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.tcp_flags == 0x12 && !(sum.layers & DECODE_TLS));
+  ok1(sum.payload_len == 0);
+}
+
+static void test_fragments(void) {
+  struct decode_summary sum;
+  struct pkt p;
+
+  /* Only the first fragment has ports */
+  pkt_init(&p, "12345678", 8);
+  pkt_udp(&p, 1, 2);
+  pkt_ipv4_frag(&p, IPPROTO_UDP, 99, 0x2000);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.fragment && sum.layers & DECODE_UDP);
+  ok1(sum.frag_id == 99 && sum.frag_off == 0 && sum.frag_more);
+  ok1(sum.frag_proto == IPPROTO_UDP && sum.frag_len == 16);
+  ok1(sum.frag_data == 14 + 20);
+
+  pkt_init(&p, "fragment", 8);
+  pkt_ipv4_frag(&p, IPPROTO_UDP, 99, 2);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.fragment && !(sum.layers & DECODE_UDP));
+  ok1(sum.frag_off == 16 && !sum.frag_more && sum.frag_len == 8);
+
+  pkt_init(&p, "fragment", 8);
+  pkt_ipv6_frag(&p, IPPROTO_UDP, 0x01020304, 1200, false);
+  pkt_ipv6(&p, IPPROTO_FRAGMENT);
+  pkt_eth(&p, 0x86dd);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.fragment && !(sum.layers & DECODE_UDP));
+  ok1(sum.frag_id == 0x01020304 && sum.frag_off == 1200 && !sum.frag_more);
+  ok1(sum.frag_proto == IPPROTO_UDP && sum.frag_len == 8);
+}
+
+static void test_malformed(void) {
+  struct decode_summary sum;
+  struct pkt p;
+
+  /* Cut off inside the UDP header: IP is still there */
+  pkt_init(&p, "x", 1);
+  pkt_udp(&p, 1, 2);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  pkt_truncate(&p, 25);
+  decode(DLT_RAW, &p, &sum);
+  ok1(sum.layers & DECODE_IPV4 && !(sum.layers & DECODE_UDP));
+
+  /* Link-layer padding isn't payload */
+  pkt_init(&p, "ab\0\0\0\0", 6);
+  pkt_truncate(&p, 2);
+  pkt_udp(&p, 1, 2);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  p.len += 4;
+  decode(DLT_RAW, &p, &sum);
+  ok1(sum.layers & DECODE_UDP && sum.payload_len == 2);
+
+  /* Neither IPv4 nor IPv6 */
+  pkt_init(&p, "\x50\x00\x00\x00", 4);
+  decode(DLT_RAW, &p, &sum);
+  ok1(!sum.layers && sum.payload_len == 4);
+
+  pkt_init(&p, "", 0);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(!sum.layers && sum.payload_len == 0);
+
+  /* A DNS name running off the end of the packet */
+  pkt_dns(&p, 1, false, "www.example.com", 1);
+  p.data[p.off + 12] = 63;
+  pkt_udp(&p, 40000, 53);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  decode(DLT_RAW, &p, &sum);
+  ok1(sum.layers & DECODE_UDP && !(sum.layers & DECODE_DNS));
+}
+
+/* Only what the fields ask for is decoded */
+static void test_plan(void) {
+  struct decode_summary sum;
+  struct pkt p;
+
+  ok1(parse_fields("ts,src,dst"));
+  decode_init();
+  ok1(decode_wants(DECODE_IP) && !decode_wants(DECODE_DNS));
+  pkt_dns(&p, 1, false, "www.example.com", 1);
+  pkt_udp(&p, 40000, 53);
+  pkt_ipv4(&p, IPPROTO_UDP);
+  pkt_eth(&p, 0x0800);
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(sum.layers & DECODE_IPV4 && !(sum.layers & DECODE_DNS));
+
+  ok1(parse_fields("ts,len"));
+  decode_init();
+  decode(DLT_EN10MB, &p, &sum);
+  ok1(!sum.layers);
+
+  ok1(!parse_fields("ts,bogus"));
+  ok1(!parse_fields(","));
+  options.fields = DECODE_ALL_FIELDS;
+  decode_init();
+}
+
+int main(void) {
+  plan_tests(71);
+  decode_init();
+
+  test_linktypes();
+  test_transports();
+  test_fragments();
+  test_malformed();
+  test_plan();
+
+  return exit_status();
+}
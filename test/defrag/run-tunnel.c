@@ -0,0 +1,163 @@
+/*
+ * run-tunnel.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <netinet/in.h>
+
+#include "decode.h"
+#include "defrag.h"
+#include "../pkt.h"
+
+static struct decoder eth;
+static struct defrag df;
+
+/* Decode a packet as the encoder does, handing any fragment to df. Return
+ * true if it completed a datagram. */
+static bool take(const struct pkt *p, struct decode_summary *sum) {
+  decode_packet(&eth, pkt_bytes(p), p->len, sum);
+  if(!(sum->layers & DECODE_FRAG))
+    return false;
+  return defrag_packet(&df, pkt_bytes(p), p->len, 0, sum);
+}
+
+/* Cut bytes first to last of the datagram d into an IPv4 fragment */
+static void fragment4(struct pkt *f, const struct pkt *d, uint8_t proto,
+                      uint16_t id, uint32_t first, uint32_t last) {
+  bool more = last < d->len;
+
+  pkt_init(f, pkt_bytes(d) + first, last - first);
+  pkt_ipv4_frag(f, proto, id, (more ? 0x2000 : 0) | first / 8);
+  pkt_eth(f, 0x0800);
+}
+
+static void fragment6(struct pkt *f, const struct pkt *d, uint8_t next,
+                      uint32_t id, uint32_t first, uint32_t last) {
+  pkt_init(f, pkt_bytes(d) + first, last - first);
+  pkt_ipv6_frag(f, next, id, first, last < d->len);
+  pkt_ipv6(f, IPPROTO_FRAGMENT);
+  pkt_eth(f, 0x86dd);
+}
+
+/* The inner packet every tunnel carries */
+static void inner(struct pkt *p) {
+  pkt_dns(p, 0x4242, false, "inner.example", 1);
+  pkt_udp(p, 1234, 53);
+  pkt_ipv6(p, IPPROTO_UDP);
+}
+
+static bool inner_ok(const struct decode_summary *sum) {
+  return sum->layers & DECODE_IPV6 && !memcmp(sum->src, pkt_ip6_src, 16) &&
+         sum->sport == 1234 && sum->layers & DECODE_DNS &&
+         !strcmp(sum->dns_qname, "inner.example");
+}
+
+/* The UDP datagram of a VXLAN packet, cut after 24 bytes: the first
+ * fragment then holds the VXLAN header but not all of the inner frame. */
+static void test_vxlan(bool first_last) {
+  struct decode_summary sum;
+  struct pkt d, a, b;
+
+  inner(&d);
+  pkt_eth(&d, 0x86dd);
+  pkt_vxlan(&d, 5000);
+  pkt_udp(&d, 40000, 4789);
+  fragment4(&a, &d, IPPROTO_UDP, 7, 0, 24);
+  fragment4(&b, &d, IPPROTO_UDP, 7, 24, d.len);
+
+  ok1(!take(first_last ? &b : &a, &sum) && sum.layers & DECODE_FRAG);
+  ok(take(first_last ? &a : &b, &sum), "VXLAN in two fragments, %s",
+     first_last ? "first fragment last" : "in order");
+  ok1(sum.layers & DECODE_REASM && sum.reassembled == 2);
+  ok1(sum.tunnel == DECODE_VXLAN && sum.tunnel_id == 5000);
+  ok1(sum.outer_dport == 4789 && !memcmp(sum.outer_src, pkt_ip4_src, 4));
+  ok1(inner_ok(&sum));
+}
+
+/* Geneve over fragmented IPv6 */
+static void test_geneve6(void) {
+  struct decode_summary sum;
+  struct pkt d, a, b;
+
+  inner(&d);
+  pkt_geneve(&d, 6000, 0x86dd);
+  pkt_udp(&d, 40000, 6081);
+  fragment6(&a, &d, IPPROTO_UDP, 0x10203, 0, 32);
+  fragment6(&b, &d, IPPROTO_UDP, 0x10203, 32, d.len);
+
+  ok1(!take(&a, &sum));
+  ok1(take(&b, &sum) && sum.reassembled == 2);
+  ok1(sum.tunnel == DECODE_GENEVE && sum.outer_v6 && inner_ok(&sum));
+}
+
+/* A whole GRE packet whose inner IPv4 datagram is fragmented: the inner
+ * datagram is the one put back together */
+static void test_inner(void) {
+  struct decode_summary sum;
+  struct pkt d, a, b;
+
+  pkt_dns(&d, 0x4242, false, "inner.example", 1);
+  pkt_udp(&d, 1234, 53);
+  fragment4(&a, &d, IPPROTO_UDP, 9, 0, 16);
+  fragment4(&b, &d, IPPROTO_UDP, 9, 16, d.len);
+  /* Swap the Ethernet header of each for GRE in IPv4 */
+  a.off += 14;
+  a.len -= 14;
+  b.off += 14;
+  b.len -= 14;
+  pkt_gre(&a, 0x0800, 0);
+  pkt_ipv4(&a, IPPROTO_GRE);
+  pkt_eth(&a, 0x0800);
+  pkt_gre(&b, 0x0800, 0);
+  pkt_ipv4(&b, IPPROTO_GRE);
+  pkt_eth(&b, 0x0800);
+
+  ok1(!take(&b, &sum) && sum.tunnel == DECODE_GRE);
+  ok1(take(&a, &sum) && sum.reassembled == 2);
+  ok1(sum.tunnel == DECODE_GRE && sum.layers & DECODE_DNS);
+  ok1(!strcmp(sum.dns_qname, "inner.example"));
+}
+
+int main(void) {
+  plan_tests(20);
+  decode_init();
+  decode_select(&eth, DLT_EN10MB);
+  defrag_init(&df);
+
+  test_vxlan(false);
+  test_vxlan(true);
+  test_geneve6();
+  test_inner();
+  ok1(df.stats.reassembled == 4 && !df.stats.overlaps && !df.stats.dropped);
+
+  defrag_free(&df);
+  return exit_status();
+}
@@ -0,0 +1,226 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <netinet/in.h>
+
+#include "decode.h"
+#include "defrag.h"
+#include "../pkt.h"
+
+#define SEC 1000000000LL
+
+static struct decoder raw;
+static struct defrag df;
+static struct pkt datagram;
+
+/* Make datagram a UDP datagram of len bytes in all, DNS then zeroes */
+static void make_datagram(uint32_t len) {
+  u_char pad[PKT_MAX] = {0};
+  struct pkt dns;
+
+  pkt_dns(&dns, 0x4242, false, "frag.example", 1);
+  memcpy(pad, pkt_bytes(&dns), dns.len);
+  pkt_init(&datagram, pad, len - 8);
+  pkt_udp(&datagram, 40000, 53);
+}
+
+/* Hand the reassembler the fragment of datagram from first to last, sent as
+ * IPv4 with the given identification at time ts. Return true if it completed
+ * the datagram, and leave the summary in sum. */
+static bool frag(uint16_t id, uint32_t first, uint32_t last, long long ts,
+                 struct decode_summary *sum) {
+  bool more = last < datagram.len;
+  struct pkt f;
+
+  pkt_init(&f, pkt_bytes(&datagram) + first, last - first);
+  pkt_ipv4_frag(&f, IPPROTO_UDP, id, (more ? 0x2000 : 0) | first / 8);
+  decode_packet(&raw, pkt_bytes(&f), f.len, sum);
+  if(!(sum->layers & DECODE_FRAG))
+    return false;
+  return defrag_packet(&df, pkt_bytes(&f), f.len, ts, sum);
+}
+
+static bool dns_ok(const struct decode_summary *sum) {
+  return sum->layers & DECODE_DNS && !strcmp(sum->dns_qname, "frag.example");
+}
+
+static void test_order(void) {
+  struct decode_summary sum;
+
+  make_datagram(1000);
+  ok1(!frag(1, 0, 400, 0, &sum));
+  ok1(!frag(1, 400, 800, 0, &sum));
+  ok1(frag(1, 800, 1000, 0, &sum));
+  ok1(sum.reassembled == 3 && sum.ip_len == 1020 && !sum.fragment);
+  ok1(sum.layers & DECODE_REASM && sum.sport == 40000 && dns_ok(&sum));
+
+  /* Last first, then the middle, then the start */
+  ok1(!frag(2, 800, 1000, 0, &sum));
+  ok1(!frag(2, 400, 800, 0, &sum));
+  ok1(frag(2, 0, 400, 0, &sum));
+  ok1(sum.reassembled == 3 && sum.ip_len == 1020 && dns_ok(&sum));
+
+  /* Two datagrams at once */
+  ok1(!frag(3, 0, 400, 0, &sum));
+  ok1(!frag(4, 400, 1000, 0, &sum));
+  ok1(frag(3, 400, 1000, 0, &sum) && sum.reassembled == 2);
+  ok1(frag(4, 0, 400, 0, &sum) && sum.reassembled == 2);
+  ok1(df.stats.reassembled == 4 && df.stats.fragments == 10);
+}
+
+static void test_overlap(void) {
+  struct decode_summary sum;
+
+  make_datagram(1000);
+  ok1(!frag(10, 0, 400, 0, &sum));
+  ok1(!frag(10, 200, 600, 0, &sum));
+  ok1(df.stats.overlaps == 1);
+  /* The datagram is gone, so this starts a new one */
+  ok1(!frag(10, 600, 1000, 0, &sum));
+
+  /* The same fragment twice is an overlap too */
+  ok1(!frag(11, 0, 400, 0, &sum));
+  ok1(!frag(11, 0, 400, 0, &sum));
+  ok1(df.stats.overlaps == 2);
+
+  /* So are two different ends */
+  ok1(!frag(12, 400, 1000, 0, &sum));
+  ok1(!frag(12, 0, 504, 0, &sum));
+  ok1(df.stats.overlaps == 3);
+  defrag_reset(&df);
+}
+
+static void test_unusable(void) {
+  struct decode_summary sum;
+  unsigned long long dropped = df.stats.dropped;
+  struct pkt f;
+
+  make_datagram(1000);
+  /* Fragments other than the last come in multiples of 8 */
+  ok1(!frag(20, 0, 401, 0, &sum));
+  ok1(df.stats.dropped == dropped + 1);
+
+  /* Cut short by the snaplen */
+  pkt_init(&f, pkt_bytes(&datagram), 400);
+  pkt_ipv4_frag(&f, IPPROTO_UDP, 21, 0x2000);
+  decode_packet(&raw, pkt_bytes(&f), f.len - 10, &sum);
+  ok1(!defrag_packet(&df, pkt_bytes(&f), f.len - 10, 0, &sum));
+  ok1(df.stats.dropped == dropped + 2 && df.oldest == DEFRAG_NONE);
+}
+
+static void test_holes(void) {
+  struct decode_summary sum;
+  unsigned long long dropped = df.stats.dropped;
+  uint32_t i;
+
+  /* Every other 8-byte piece leaves another hole, until there are too
+   * many */
+  make_datagram(1000);
+  for(i = 0; i < DEFRAG_MAX_HOLES; ++i)
+    frag(30, i * 16, i * 16 + 8, 0, &sum);
+  ok1(df.stats.dropped == dropped && df.oldest != DEFRAG_NONE);
+  frag(30, i * 16, i * 16 + 8, 0, &sum);
+  ok1(df.stats.dropped == dropped + 1 && df.oldest == DEFRAG_NONE);
+}
+
+static void test_expiry(void) {
+  struct decode_summary sum;
+  unsigned long long expired = df.stats.expired;
+
+  make_datagram(1000);
+  ok1(!frag(40, 0, 400, 0, &sum));
+  ok1(!frag(41, 0, 400, 20 * SEC, &sum));
+  /* 40 started more than DEFRAG_TIMEOUT_NS ago and goes; 41 stays */
+  ok1(!frag(41, 400, 800, 31 * SEC, &sum));
+  ok1(df.stats.expired == expired + 1);
+  ok1(!frag(40, 400, 1000, 31 * SEC, &sum));
+  ok1(frag(41, 800, 1000, 31 * SEC, &sum) && sum.reassembled == 3);
+  defrag_reset(&df);
+}
+
+static void test_eviction(void) {
+  struct decode_summary sum;
+  unsigned long long evicted = df.stats.evicted;
+  unsigned i;
+
+  /* More datagrams than slots: the oldest make room */
+  make_datagram(1000);
+  for(i = 0; i < DEFRAG_MAX_DATAGRAMS + 2; ++i)
+    frag(100 + i, 0, 400, 0, &sum);
+  ok1(df.stats.evicted == evicted + 2);
+  ok1(!frag(100, 400, 1000, 0, &sum));
+  ok1(frag(100 + DEFRAG_MAX_DATAGRAMS + 1, 400, 1000, 0, &sum));
+  defrag_reset(&df);
+}
+
+/* Big datagrams use up the pool before the slots run out */
+static void test_memory(void) {
+  static u_char big[20 + 65000];
+  unsigned long long evicted = df.stats.evicted;
+  struct decode_summary sum;
+  struct pkt h;
+  uint32_t i, n;
+
+  /* Nearly 64 KiB in one fragment takes DEFRAG_DGRAM_BLOCKS blocks */
+  n = DEFRAG_POOL_BLOCKS / DEFRAG_DGRAM_BLOCKS;
+  for(i = 0; i <= n; ++i) {
+    pkt_init(&h, "", 0);
+    pkt_ipv4_frag(&h, IPPROTO_UDP, 300 + i, 0x2000);
+    memcpy(big, pkt_bytes(&h), 20);
+    pkt_put16(big + 2, sizeof big);
+    decode_packet(&raw, big, sizeof big, &sum);
+    ok(!defrag_packet(&df, big, sizeof big, 0, &sum) &&
+       df.stats.evicted == evicted + (i == n), "64 KiB datagram %u", i);
+  }
+  ok1(df.nfree == 0);
+  defrag_reset(&df);
+  ok1(df.nfree == DEFRAG_POOL_BLOCKS && df.free_dgrams == 0);
+}
+
+int main(void) {
+  plan_tests(74);
+  decode_init();
+  decode_select(&raw, DLT_RAW);
+  defrag_init(&df);
+
+  test_order();
+  test_overlap();
+  test_unusable();
+  test_holes();
+  test_expiry();
+  test_eviction();
+  test_memory();
+
+  defrag_free(&df);
+  return exit_status();
+}
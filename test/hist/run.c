@@ -0,0 +1,115 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <string.h>
+
+#include "hist.h"
+
+static struct hist a, b, all;
+
+/* Whether est is no less than v and at most a bucket's width (1/HIST_SUB)
+ * above it */
+static bool close_above(uint64_t est, uint64_t v) {
+  return est >= v && est - v <= v / HIST_SUB;
+}
+
+int main(void) {
+  uint64_t v, x = 88172645463325252ULL;
+  unsigned i, last;
+  bool monotonic = true, close = true;
+
+  plan_tests(20);
+
+  /* Small values get a bucket each, then every power of two is split into
+   * HIST_SUB buckets */
+  for(v = 0; v < HIST_SUB; ++v)
+    if(hist_index(v) != v)
+      break;
+  ok1(v == HIST_SUB);
+  ok1(hist_index(16) == 16 && hist_index(31) == 31);
+  ok1(hist_index(32) == 32 && hist_index(33) == 32 && hist_index(34) == 33);
+  ok1(hist_index(UINT64_MAX) == HIST_BUCKETS - 1);
+
+  for(i = 2, last = 0, v = 4; i < 64; ++i, v <<= 1) {
+    monotonic &= hist_index(v - 1) >= last && hist_index(v) > hist_index(v - 1)
+                 && hist_index(v + 1) >= hist_index(v);
+    last = hist_index(v + 1);
+  }
+  ok1(monotonic);
+
+  /* Next to a much larger value, the median is the top of the smaller
+   * one's bucket */
+  for(i = 0; i < 10000; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    v = x >> (x & 63);
+    hist_init(&a);
+    hist_record(&a, v);
+    hist_record(&a, UINT64_MAX);
+    close &= close_above(hist_percentile(&a, 50), v);
+  }
+  ok1(close);
+
+  hist_init(&a);
+  ok1(hist_percentile(&a, 50) == 0);
+  ok1(a.count == 0 && a.min == UINT64_MAX && a.max == 0);
+
+  hist_init(&b);
+  hist_init(&all);
+  for(v = 1; v <= 1000; ++v) {
+    hist_record(v % 3 ? &a : &b, v);
+    hist_record(&all, v);
+  }
+  ok1(all.count == 1000 && all.sum == 500500);
+  ok1(all.min == 1 && all.max == 1000);
+  ok1(close_above(hist_percentile(&all, 50), 500));
+  ok1(close_above(hist_percentile(&all, 99), 990));
+  ok1(hist_percentile(&all, 0) == 1);
+  /* Never more than the largest value recorded */
+  ok1(hist_percentile(&all, 100) == 1000);
+
+  /* Merging the parts gives the same histogram as recording everything */
+  ok1(a.count + b.count == 1000);
+  hist_merge(&a, &b);
+  ok1(a.count == all.count && a.sum == all.sum);
+  ok1(a.min == all.min && a.max == all.max);
+  ok1(!memcmp(a.buckets, all.buckets, sizeof a.buckets));
+
+  hist_init(&b);
+  hist_merge(&a, &b);
+  ok1(a.count == all.count && a.min == all.min && a.max == all.max);
+  ok1(hist_percentile(&a, 50) == hist_percentile(&all, 50));
+
+  return exit_status();
+}
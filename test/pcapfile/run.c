@@ -0,0 +1,140 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcapfile.h"
+
+#define NPKTS 100
+#define SEC 1700000000LL
+#define NS 1000000000LL
+
+/* Write NPKTS packets of varying length to path, the i-th stamped at i ms
+ * unless swap is set, in which case the second half of the file comes
+ * first. */
+static void write_file(const char *path, bool swap) {
+  struct pcap_pkthdr hdr;
+  u_char data[64];
+  size_t i, n;
+  FILE *fp = fopen(path, "w");
+
+  memset(data, 0xab, sizeof data);
+  pcapfile_write_header(fp, false, sizeof data, 1);
+  for(i = 0; i < NPKTS; ++i) {
+    n = swap ? (i + NPKTS / 2) % NPKTS : i;
+    hdr.ts.tv_sec = SEC;
+    hdr.ts.tv_usec = n * 1000;
+    hdr.caplen = hdr.len = 14 + n % 50;
+    pcapfile_write_record(fp, &hdr, data);
+  }
+  fclose(fp);
+}
+
+/* Open path, seek to [start, end] ms and count the packets read in those
+ * bounds and in total */
+static size_t read_bounded(const char *path, long start, long end,
+                           size_t *total, bool *ordered) {
+  struct pcapfile pf;
+  struct pcap_pkthdr hdr;
+  const u_char *data;
+  long long ts, start_ns = SEC * NS + start * 1000000LL;
+  long long end_ns = SEC * NS + end * 1000000LL;
+  size_t n = 0;
+
+  pcapfile_open(&pf, path);
+  pcapfile_seek(&pf, path, start_ns, end_ns);
+  *ordered = pf.ordered;
+  for(*total = 0; pcapfile_next(&pf, &hdr, &data); ++*total) {
+    ts = pcapfile_ts_ns(&pf, &hdr);
+    n += ts >= start_ns && ts <= end_ns;
+  }
+  pcapfile_close(&pf);
+  return n;
+}
+
+int main(void) {
+  char path[] = "/tmp/protodump-pcapfile-XXXXXX";
+  char idx[sizeof path + sizeof PDIDX_SUFFIX];
+  size_t total;
+  bool ordered;
+  FILE *fp;
+
+  plan_tests(20);
+
+  close(mkstemp(path));
+  sprintf(idx, "%s%s", path, PDIDX_SUFFIX);
+
+  /* No index: everything is read */
+  write_file(path, false);
+  ok1(read_bounded(path, 30, 60, &total, &ordered) == 31);
+  ok1(total == NPKTS && !ordered);
+
+  ok1(pcapfile_write_index(path, 8) == NPKTS);
+  ok1(read_bounded(path, 30, 60, &total, &ordered) == 31);
+  /* Sampled packets 24 and 64 bound what's read */
+  ok1(ordered && total == 40);
+  ok1(read_bounded(path, 0, 0, &total, &ordered) == 1);
+  ok1(total == 8);
+  ok1(read_bounded(path, 99, 1000, &total, &ordered) == 1);
+  ok1(total == 4);
+  ok1(read_bounded(path, -10, 1000, &total, &ordered) == NPKTS);
+  ok1(total == NPKTS);
+
+  /* An index that no longer matches the file is ignored */
+  fp = fopen(path, "a");
+  fputc(0, fp);
+  fclose(fp);
+  ok1(read_bounded(path, 30, 60, &total, &ordered) == 31);
+  ok1(total == NPKTS && !ordered);
+
+  /* Out of order, as several writers would leave it: no narrowing, but
+   * every packet in bounds is still found */
+  write_file(path, true);
+  ok1(pcapfile_write_index(path, 8) == NPKTS);
+  ok1(read_bounded(path, 30, 60, &total, &ordered) == 31);
+  ok1(total == NPKTS && !ordered);
+  ok1(read_bounded(path, 90, 95, &total, &ordered) == 6);
+
+  /* Only some link types are numbered differently in files */
+  ok1(pcapfile_linktype(DLT_RAW) == LINKTYPE_RAW);
+  ok1(pcapfile_linktype(DLT_EN10MB) == LINKTYPE_ETHERNET
+      && pcapfile_linktype(LINKTYPE_RAW) == LINKTYPE_RAW);
+  ok1(pcapfile_dlt(LINKTYPE_RAW) == DLT_RAW
+      && pcapfile_dlt(LINKTYPE_ETHERNET) == DLT_EN10MB);
+
+  unlink(idx);
+  unlink(path);
+  return exit_status();
+}
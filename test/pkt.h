@@ -0,0 +1,285 @@
+/*
+ * pkt.h
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#ifndef PROTODUMP_TEST_PKT_H
+#define PROTODUMP_TEST_PKT_H
+
+#include <pcap/pcap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Largest packet the tests build */
+#define PKT_MAX 2048
+
+/* A packet built from the inside out: start with the payload, then push each
+ * header in front of what is there, innermost first. Length fields are
+ * filled in from what they are pushed in front of.
+ *
+ * data: The packet, which starts at data + off
+ * off:  Where the packet starts in data
+ * len:  Length of the packet
+ */
+struct pkt {
+  u_char data[PKT_MAX];
+  uint32_t off;
+  uint32_t len;
+};
+
+static const uint8_t pkt_ip4_src[4] = {10, 0, 0, 1};
+static const uint8_t pkt_ip4_dst[4] = {10, 0, 0, 2};
+static const uint8_t pkt_ip6_src[16] = {0xfe, 0x80, [15] = 1};
+static const uint8_t pkt_ip6_dst[16] = {0xfe, 0x80, [15] = 2};
+
+static inline const u_char *pkt_bytes(const struct pkt *p) {
+  return p->data + p->off;
+}
+
+static inline void pkt_init(struct pkt *p, const void *payload, uint32_t len) {
+  p->off = PKT_MAX - len;
+  p->len = len;
+  memcpy(p->data + p->off, payload, len);
+}
+
+/* Make room for a header of len bytes in front of the packet, and return
+ * where it goes */
+static inline u_char *pkt_push(struct pkt *p, uint32_t len) {
+  p->off -= len;
+  p->len += len;
+  memset(p->data + p->off, 0, len);
+  return p->data + p->off;
+}
+
+static inline void pkt_put16(u_char *at, uint16_t v) {
+  at[0] = v >> 8;
+  at[1] = v & 0xff;
+}
+
+static inline void pkt_put32(u_char *at, uint32_t v) {
+  pkt_put16(at, v >> 16);
+  pkt_put16(at + 2, v & 0xffff);
+}
+
+/* Cut the packet short, as a small snaplen would */
+static inline void pkt_truncate(struct pkt *p, uint32_t len) {
+  p->len = len;
+}
+
+/* Start the packet with a DNS message asking for name, which is in dotted
+ * form */
+static inline void pkt_dns(struct pkt *p, uint16_t id, bool response,
+                           const char *name, uint16_t qtype) {
+  u_char msg[256] = {0};
+  uint32_t len = 12, n;
+  const char *dot;
+
+  pkt_put16(msg, id);
+  pkt_put16(msg + 2, response ? 0x8183 : 0x0100);
+  pkt_put16(msg + 4, 1);
+  while(*name) {
+    dot = strchr(name, '.');
+    n = dot ? (uint32_t)(dot - name) : (uint32_t)strlen(name);
+    msg[len++] = n;
+    memcpy(msg + len, name, n);
+    len += n;
+    name += dot ? n + 1 : n;
+  }
+  msg[len++] = 0;
+  pkt_put16(msg + len, qtype);
+  pkt_put16(msg + len + 2, 1);
+  pkt_init(p, msg, len + 4);
+}
+
+/* Start the packet with a TLS record holding a ClientHello for sni */
+static inline void pkt_client_hello(struct pkt *p, const char *sni) {
+  u_char rec[256] = {0};
+  uint32_t n = strlen(sni), off;
+
+  /* Record header, handshake header, version, random, no session ID, one
+   * cipher suite and one compression method */
+  rec[0] = 22;
+  pkt_put16(rec + 1, 0x0301);
+  rec[5] = 1;
+  pkt_put16(rec + 9, 0x0303);
+  off = 9 + 2 + 32 + 1;
+  pkt_put16(rec + off, 2);
+  pkt_put16(rec + off + 2, 0x1301);
+  rec[off + 4] = 1;
+  off += 6;
+  /* A single server_name extension */
+  pkt_put16(rec + off, 9 + n);
+  pkt_put16(rec + off + 4, 5 + n);
+  pkt_put16(rec + off + 6, 3 + n);
+  pkt_put16(rec + off + 9, n);
+  memcpy(rec + off + 11, sni, n);
+  off += 11 + n;
+  pkt_put16(rec + 3, off - 5);
+  pkt_put32(rec + 5, (1u << 24) | (off - 9));
+  pkt_init(p, rec, off);
+}
+
+static inline void pkt_udp(struct pkt *p, uint16_t sport, uint16_t dport) {
+  u_char *h = pkt_push(p, 8);
+
+  pkt_put16(h, sport);
+  pkt_put16(h + 2, dport);
+  pkt_put16(h + 4, p->len);
+}
+
+static inline void pkt_tcp(struct pkt *p, uint16_t sport, uint16_t dport,
+                           uint8_t flags) {
+  u_char *h = pkt_push(p, 20);
+
+  pkt_put16(h, sport);
+  pkt_put16(h + 2, dport);
+  h[12] = 5 << 4;
+  h[13] = flags;
+}
+
+/* An IPv4 header with the given identification and flags/fragment offset
+ * field */
+static inline void pkt_ipv4_frag(struct pkt *p, uint8_t proto, uint16_t id,
+                                 uint16_t frag) {
+  u_char *h = pkt_push(p, 20);
+
+  h[0] = 0x45;
+  pkt_put16(h + 2, p->len);
+  pkt_put16(h + 4, id);
+  pkt_put16(h + 6, frag);
+  h[8] = 64;
+  h[9] = proto;
+  memcpy(h + 12, pkt_ip4_src, 4);
+  memcpy(h + 16, pkt_ip4_dst, 4);
+}
+
+static inline void pkt_ipv4(struct pkt *p, uint8_t proto) {
+  pkt_ipv4_frag(p, proto, 1, 0);
+}
+
+static inline void pkt_ipv6(struct pkt *p, uint8_t next) {
+  u_char *h = pkt_push(p, 40);
+
+  pkt_put32(h, 0x60000000);
+  pkt_put16(h + 4, p->len - 40);
+  h[6] = next;
+  h[7] = 64;
+  memcpy(h + 8, pkt_ip6_src, 16);
+  memcpy(h + 24, pkt_ip6_dst, 16);
+}
+
+/* An IPv6 extension header of 8 bytes, such as hop-by-hop options */
+static inline void pkt_ipv6_ext(struct pkt *p, uint8_t next) {
+  u_char *h = pkt_push(p, 8);
+
+  h[0] = next;
+}
+
+static inline void pkt_ipv6_frag(struct pkt *p, uint8_t next, uint32_t id,
+                                 uint16_t off, bool more) {
+  u_char *h = pkt_push(p, 8);
+
+  h[0] = next;
+  pkt_put16(h + 2, off | more);
+  pkt_put32(h + 4, id);
+}
+
+static inline void pkt_eth(struct pkt *p, uint16_t ethertype) {
+  static const u_char macs[12] = {2, 0, 0, 0, 0, 2, 2, 0, 0, 0, 0, 1};
+  u_char *h = pkt_push(p, 14);
+
+  memcpy(h, macs, sizeof macs);
+  pkt_put16(h + 12, ethertype);
+}
+
+/* A VLAN tag, which goes after the ethertype of tpid */
+static inline void pkt_vlan(struct pkt *p, uint16_t vid, uint16_t ethertype) {
+  u_char *h = pkt_push(p, 4);
+
+  pkt_put16(h, vid);
+  pkt_put16(h + 2, ethertype);
+}
+
+static inline void pkt_mpls(struct pkt *p, uint32_t label, bool bottom) {
+  pkt_put32(pkt_push(p, 4), label << 12 | (bottom ? 0x100 : 0) | 64);
+}
+
+/* A GRE header, with a key if key is nonzero */
+static inline void pkt_gre(struct pkt *p, uint16_t proto, uint32_t key) {
+  u_char *h = pkt_push(p, key ? 8 : 4);
+
+  pkt_put16(h, key ? 0x2000 : 0);
+  pkt_put16(h + 2, proto);
+  if(key)
+    pkt_put32(h + 4, key);
+}
+
+static inline void pkt_vxlan(struct pkt *p, uint32_t vni) {
+  u_char *h = pkt_push(p, 8);
+
+  h[0] = 0x08;
+  pkt_put32(h + 4, vni << 8);
+}
+
+static inline void pkt_geneve(struct pkt *p, uint32_t vni, uint16_t proto) {
+  u_char *h = pkt_push(p, 8);
+
+  pkt_put16(h + 2, proto);
+  pkt_put32(h + 4, vni << 8);
+}
+
+static inline void pkt_sll(struct pkt *p, uint16_t proto) {
+  u_char *h = pkt_push(p, 16);
+
+  pkt_put16(h + 2, 1);
+  pkt_put16(h + 4, 6);
+  h[6] = 2;
+  h[11] = 9;
+  pkt_put16(h + 14, proto);
+}
+
+static inline void pkt_sll2(struct pkt *p, uint16_t proto) {
+  u_char *h = pkt_push(p, 20);
+
+  pkt_put16(h, proto);
+  pkt_put32(h + 4, 3);
+  pkt_put16(h + 8, 1);
+  h[11] = 6;
+  h[12] = 2;
+  h[17] = 9;
+}
+
+/* A DLT_NULL header, in host byte order */
+static inline void pkt_null(struct pkt *p, uint32_t af) {
+  memcpy(pkt_push(p, 4), &af, 4);
+}
+
+#endif
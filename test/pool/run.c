@@ -0,0 +1,144 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "ring.h"
+
+#define NSLOTS 16
+#define NPASSED 200000
+
+static struct pool pool;
+static struct ring ring;
+
+static void test_single_thread(void) {
+  unsigned char *bufs[NSLOTS];
+  bool aligned = true, distinct = true;
+  size_t i, j;
+
+  /* Buffers round up to whole cache lines */
+  pool_init(&pool, 100, NSLOTS);
+  ok1(pool.slot_size == 128 && pool.nslots == NSLOTS);
+
+  for(i = 0; i < NSLOTS; ++i) {
+    bufs[i] = pool_get(&pool);
+    if(!bufs[i])
+      break;
+    aligned &= !((uintptr_t)bufs[i] % CACHELINE_SIZE);
+    for(j = 0; j < i; ++j)
+      distinct &= bufs[i] - bufs[j] >= 128 || bufs[j] - bufs[i] >= 128;
+  }
+  ok1(i == NSLOTS);
+  ok1(aligned && distinct);
+  ok1(!pool_get(&pool));
+
+  /* The free list is a stack: the last buffer back is the next one out */
+  pool_put(&pool, bufs[3]);
+  pool_put(&pool, bufs[7]);
+  ok1(pool_get(&pool) == bufs[7]);
+  ok1(pool_get(&pool) == bufs[3]);
+  ok1(!pool_get(&pool));
+
+  for(i = 0; i < NSLOTS; ++i)
+    pool_put(&pool, bufs[i]);
+  for(i = 0; i < NSLOTS; ++i)
+    if(!pool_get(&pool))
+      break;
+  ok1(i == NSLOTS && !pool_get(&pool));
+  pool_free(&pool);
+
+  pool_init(&pool, 64, 0);
+  ok1(!pool_get(&pool));
+  pool_free(&pool);
+}
+
+/* Pass buffers to another thread through a ring, as the capture pipeline
+ * does, and have it put them back */
+static void *consume(void *arg) {
+  bool *intact = arg;
+  struct pktdesc d;
+  size_t n = 0;
+
+  while(n < NPASSED) {
+    if(!ring_pop(&ring, &d)) {
+      sched_yield();
+      continue;
+    }
+    *intact &= d.data[0] == (n & 0xff) && d.data[63] == (n & 0xff);
+    pool_put(&pool, d.data);
+    ++n;
+  }
+  return NULL;
+}
+
+static void test_threads(void) {
+  pthread_t consumer;
+  struct pktdesc d;
+  bool intact = true;
+  size_t n = 0;
+
+  pool_init(&pool, 64, NSLOTS);
+  ring_init(&ring, NSLOTS);
+  memset(&d, 0, sizeof d);
+  pthread_create(&consumer, NULL, consume, &intact);
+  while(n < NPASSED) {
+    if(!(d.data = pool_get(&pool))) {
+      sched_yield();
+      continue;
+    }
+    memset(d.data, n & 0xff, 64);
+    ring_push(&ring, &d);
+    ++n;
+  }
+  pthread_join(consumer, NULL);
+  ok1(intact);
+
+  for(n = 0; n < NSLOTS; ++n)
+    if(!pool_get(&pool))
+      break;
+  ok1(n == NSLOTS && !pool_get(&pool));
+  ring_free(&ring);
+  pool_free(&pool);
+}
+
+int main(void) {
+  plan_tests(11);
+
+  test_single_thread();
+  test_threads();
+
+  return exit_status();
+}
@@ -0,0 +1,143 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reorder.h"
+
+#define NWORKERS 4
+#define NSLOTS 3
+#define NITEMS 300
+
+static struct reorder ro;
+static bool bounded = true;
+
+/* Write each item's number as a record's "len", finishing items out of
+ * order */
+static void *work(void *arg) {
+  struct pcap_pkthdr hdr;
+  struct jsonw *w;
+  size_t item;
+
+  (void)arg;
+  memset(&hdr, 0, sizeof hdr);
+  while((w = reorder_claim(&ro, &item))) {
+    pthread_mutex_lock(&ro.lock);
+    bounded &= item < ro.next_emit + NSLOTS;
+    pthread_mutex_unlock(&ro.lock);
+
+    usleep(item % 3 ? 0 : 200);
+    hdr.len = item;
+    jsonw_packet(w, &hdr, NULL, NULL);
+    reorder_complete(&ro, item);
+  }
+  return NULL;
+}
+
+static void *drain(void *arg) {
+  (void)arg;
+  reorder_drain(&ro);
+  return NULL;
+}
+
+/* Run the workers and the writer over nitems items, stopping early if stop
+ * is set, and return the number of records written to path. Set *ordered
+ * if the records came out numbered 0, 1, 2... */
+static size_t run(const char *path, size_t nitems, bool stop,
+                  bool *ordered) {
+  pthread_t workers[NWORKERS], writer;
+  struct jsonw out;
+  struct jsonw *w;
+  char line[256], *len;
+  size_t i, n = 0;
+  FILE *fp;
+
+  jsonw_open(&out, path, false);
+  reorder_init(&ro, &out, NSLOTS, nitems);
+  pthread_create(&writer, NULL, drain, NULL);
+  if(stop) {
+    /* Hold back an item so the workers can't finish before the stop */
+    w = reorder_claim(&ro, &i);
+    for(n = 0; n < NWORKERS; ++n)
+      pthread_create(&workers[n], NULL, work, NULL);
+    usleep(10000);
+    reorder_stop(&ro);
+    jsonw_packet(w, &(struct pcap_pkthdr){ .len = i }, NULL, NULL);
+    reorder_complete(&ro, i);
+  }
+  else
+    for(n = 0; n < NWORKERS; ++n)
+      pthread_create(&workers[n], NULL, work, NULL);
+  for(n = 0; n < NWORKERS; ++n)
+    pthread_join(workers[n], NULL);
+  pthread_join(writer, NULL);
+  ok1(!reorder_claim(&ro, &i));
+  reorder_free(&ro);
+  jsonw_close(&out);
+
+  fp = fopen(path, "r");
+  *ordered = true;
+  for(n = 0; fgets(line, sizeof line, fp); ++n) {
+    len = strstr(line, "\"len\":");
+    *ordered &= len && strtoul(len + 6, NULL, 10) == n;
+  }
+  fclose(fp);
+  return n;
+}
+
+int main(void) {
+  char path[] = "/tmp/protodump-reorder-XXXXXX";
+  bool ordered;
+  size_t n;
+
+  plan_tests(9);
+
+  close(mkstemp(path));
+
+  ok1(run(path, NITEMS, false, &ordered) == NITEMS);
+  ok1(ordered);
+  ok1(bounded);
+
+  /* Whatever was handed out before the stop still gets written */
+  n = run(path, NITEMS, true, &ordered);
+  ok1(n > 0 && n < NITEMS);
+  ok1(ordered);
+
+  ok1(run(path, 0, false, &ordered) == 0);
+
+  unlink(path);
+  return exit_status();
+}
@@ -0,0 +1,129 @@
+/*
+ * run.c
+ *
+ * Copyright (c) 2014 Ben Hamlin <protob3n@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *                       __            __                    
+ *     ____  _________  / /_____  ____/ /_  ______ ___  ____ 
+ *    / __ \/ ___/ __ \/ __/ __ \/ __  / / / / __ `__ \/ __ \
+ *   / /_/ / /  / /_/ / /_/ /_/ / /_/ / /_/ / / / / / / /_/ /
+ *  / .___/_/   \____/\__/\____/\__,_/\__,_/_/ /_/ /_/ .___/ 
+ * /_/                                              /_/      
+ *
+ */
+
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ring.h"
+
+/* Enough to go round a small ring many times */
+#define NPASSED 1000000
+
+static struct ring ring __attribute__((aligned(CACHELINE_SIZE)));
+
+static void test_single_thread(void) {
+  struct pktdesc d, out;
+  const struct pktdesc *peeked;
+  size_t i;
+  bool in_order = true;
+
+  /* Sizes round up to a power of two */
+  ring_init(&ring, 5);
+  ok1(ring.mask == 7);
+  ok1(!ring_pop(&ring, &out) && !ring_peek(&ring) && !ring_count(&ring));
+
+  memset(&d, 0, sizeof d);
+  for(i = 0; i < 8; ++i) {
+    d.hdr.caplen = i;
+    if(!ring_push(&ring, &d))
+      break;
+  }
+  ok1(i == 8 && ring_count(&ring) == 8);
+  d.hdr.caplen = 8;
+  ok1(!ring_push(&ring, &d));
+
+  peeked = ring_peek(&ring);
+  ok1(peeked && peeked->hdr.caplen == 0 && ring_count(&ring) == 8);
+
+  /* Take half out and put more in, so the ring wraps */
+  for(i = 0; i < 4; ++i)
+    in_order &= ring_pop(&ring, &out) && out.hdr.caplen == i;
+  for(i = 8; i < 12; ++i) {
+    d.hdr.caplen = i;
+    in_order &= ring_push(&ring, &d);
+  }
+  for(i = 4; i < 12; ++i)
+    in_order &= ring_pop(&ring, &out) && out.hdr.caplen == i;
+  ok1(in_order);
+  ok1(!ring_pop(&ring, &out) && !ring_count(&ring));
+  ring_free(&ring);
+}
+
+static void *produce(void *arg) {
+  struct pktdesc d;
+  size_t i;
+
+  memset(&d, 0, sizeof d);
+  for(i = 0; i < NPASSED; ++i) {
+    d.hdr.caplen = i;
+    d.data = (u_char*)arg + i;
+    while(!ring_push(&ring, &d))
+      sched_yield();
+  }
+  return NULL;
+}
+
+/* One thread in, one out: everything arrives once and in order */
+static void test_threads(void) {
+  static u_char base[1];
+  struct pktdesc out;
+  pthread_t producer;
+  size_t i = 0;
+  bool in_order = true;
+
+  ring_init(&ring, 64);
+  pthread_create(&producer, NULL, produce, base);
+  while(i < NPASSED) {
+    if(!ring_pop(&ring, &out)) {
+      sched_yield();
+      continue;
+    }
+    in_order &= out.hdr.caplen == (uint32_t)i && out.data == base + i;
+    ++i;
+  }
+  pthread_join(producer, NULL);
+  ok1(in_order);
+  ok1(!ring_count(&ring));
+  ring_free(&ring);
+}
+
+int main(void) {
+  plan_tests(9);
+
+  test_single_thread();
+  test_threads();
+
+  return exit_status();
+}